@@ -19,13 +19,30 @@ COMPONENT_OBJS += libsupla/src/supla-extvalue.o
 COMPONENT_OBJS += libsupla/src/supla-action-trigger.o
 
 COMPONENT_SRCDIRS += platform
+COMPONENT_OBJS += platform/link.o
+COMPONENT_OBJS += platform/journal.o
+COMPONENT_OBJS += platform/mem.o
 COMPONENT_OBJS += platform/arch_esp.o
 
 CFLAGS += -DSUPLA_DEVICE
 
 COMPONENT_SRCDIRS += esp-supla
 COMPONENT_OBJS += esp-supla/esp-supla.o
+COMPONENT_OBJS += esp-supla/esp-supla-json.o
+COMPONENT_OBJS += esp-supla/esp-supla-form.o
+COMPONENT_OBJS += esp-supla/esp-supla-push.o
+COMPONENT_OBJS += esp-supla/esp-supla-registry.o
 COMPONENT_OBJS += esp-supla/esp-supla-httpd.o
+COMPONENT_OBJS += esp-supla/esp-supla-www.o
+COMPONENT_PRIV_INCLUDEDIRS := esp-supla
+
+#config page generated from HTML template
+esp-supla/esp-supla-www.o: esp-supla/esp-supla-www.c
+	$(CC) $(CFLAGS) $(CPPFLAGS) -I$(COMPONENT_PATH)/esp-supla -c $< -o $@
+esp-supla/esp-supla-www.c: $(COMPONENT_PATH)/esp-supla/www/config.html $(COMPONENT_PATH)/tools/www2c.py
+	mkdir -p esp-supla
+	$(PYTHON) $(COMPONENT_PATH)/tools/www2c.py $< $@ supla_www_config
+COMPONENT_EXTRA_CLEAN := esp-supla/esp-supla-www.c
 
 #embed SSL cloud cert
 COMPONENT_EMBED_TXTFILES := supla_org_cert.pem
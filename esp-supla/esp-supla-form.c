@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "esp-supla-form.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <esp_log.h>
+
+static const char *TAG = "ESP-SUPLA";
+
+typedef struct {
+    const form_field_t *fields;
+    size_t count;
+    void *arg;
+    bool in_value;
+    bool skip;       //key or value did not fit, field is dropped
+    uint8_t esc;     //hex digits of % escape still expected
+    uint8_t esc_val;
+    size_t key_len;
+    size_t value_len;
+    char key[FORM_KEY_SIZE];
+    char value[FORM_VALUE_SIZE];
+} form_parser_t;
+
+int form_hex_val(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static void form_field_end(form_parser_t *p)
+{
+    p->key[p->key_len] = '\0';
+    p->value[p->value_len] = '\0';
+
+    if (p->skip) {
+        ESP_LOGW(TAG, "form: field %s too long, skipped", p->key);
+    } else if (p->key_len) {
+        for (size_t i = 0; i < p->count; i++) {
+            if (!strcmp(p->fields[i].key, p->key)) {
+                p->fields[i].set(p->arg, p->value);
+                break;
+            }
+        }
+    }
+
+    p->in_value = false;
+    p->skip = false;
+    p->key_len = 0;
+    p->value_len = 0;
+}
+
+//append decoded character to key or value
+static void form_putc(form_parser_t *p, char c)
+{
+    if (p->in_value) {
+        if (p->value_len + 1 < sizeof(p->value))
+            p->value[p->value_len++] = c;
+        else
+            p->skip = true;
+    } else {
+        if (p->key_len + 1 < sizeof(p->key))
+            p->key[p->key_len++] = c;
+        else
+            p->skip = true;
+    }
+}
+
+static esp_err_t form_feed(form_parser_t *p, const char *data, size_t len)
+{
+    int v;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+
+        //escape may be split between chunks
+        if (p->esc) {
+            if ((v = form_hex_val(c)) < 0)
+                return ESP_ERR_INVALID_ARG;
+            p->esc_val = (p->esc_val << 4) | v;
+            if (--p->esc == 0)
+                form_putc(p, p->esc_val);
+            continue;
+        }
+
+        switch (c) {
+        case '%':
+            p->esc = 2;
+            p->esc_val = 0;
+            break;
+        case '+':
+            form_putc(p, ' ');
+            break;
+        case '&':
+            form_field_end(p);
+            break;
+        case '=':
+            if (!p->in_value) {
+                p->in_value = true;
+                break;
+            }
+            form_putc(p, c);
+            break;
+        default:
+            form_putc(p, c);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t form_parse(httpd_req_t *req, const form_field_t *fields, size_t count, void *arg)
+{
+    form_parser_t parser = { .fields = fields, .count = count, .arg = arg };
+    char buf[FORM_RECV_SIZE];
+    size_t left = req->content_len;
+    int retries = 0;
+    esp_err_t err;
+    int rc;
+
+    if (req->content_len > FORM_MAX_SIZE) {
+        ESP_LOGW(TAG, "form: %u bytes body rejected", (unsigned)req->content_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    while (left) {
+        rc = httpd_req_recv(req, buf, MIN(left, sizeof(buf)));
+        if (rc == HTTPD_SOCK_ERR_TIMEOUT && ++retries < FORM_RECV_RETRIES)
+            continue;
+        if (rc <= 0)
+            return rc == HTTPD_SOCK_ERR_TIMEOUT ? ESP_ERR_TIMEOUT : ESP_FAIL;
+
+        retries = 0;
+        left -= rc;
+        err = form_feed(&parser, buf, rc);
+        if (err != ESP_OK)
+            return err;
+    }
+
+    if (parser.esc)
+        return ESP_ERR_INVALID_ARG;
+    form_field_end(&parser);
+    return ESP_OK;
+}
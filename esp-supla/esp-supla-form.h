@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef ESP_SUPLA_FORM_H_
+#define ESP_SUPLA_FORM_H_
+
+#include <stddef.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#ifndef CONFIG_ESP_LIBSUPLA_HTTPD_FORM_MAX_SIZE
+#define CONFIG_ESP_LIBSUPLA_HTTPD_FORM_MAX_SIZE 1024
+#endif
+
+#define FORM_MAX_SIZE CONFIG_ESP_LIBSUPLA_HTTPD_FORM_MAX_SIZE
+#define FORM_KEY_SIZE 16    //longest known key, longer ones are skipped
+#define FORM_VALUE_SIZE 256 //longest decoded value with terminating NUL
+#define FORM_RECV_SIZE 64   //receive chunk
+#define FORM_RECV_RETRIES 3 //receive timeouts before request is dropped
+
+//called with decoded, NUL terminated value of a known key
+typedef void (*form_field_fn)(void *arg, const char *value);
+
+typedef struct {
+    const char *key;
+    form_field_fn set;
+} form_field_t;
+
+/* Parse application/x-www-form-urlencoded request body chunk by chunk.
+ * Keys and values are decoded as they arrive into fixed size buffers and
+ * every field with key in fields table is passed to its handler, so memory
+ * use does not depend on the body. Unknown keys and values that do not fit
+ * are skipped.
+ *
+ * Returns ESP_ERR_INVALID_SIZE when body is longer than FORM_MAX_SIZE,
+ * ESP_ERR_INVALID_ARG on broken % escape, ESP_ERR_TIMEOUT or ESP_FAIL when
+ * body can not be received. Fields before the error were already passed to
+ * handlers. */
+esp_err_t form_parse(httpd_req_t *req, const form_field_t *fields, size_t count, void *arg);
+
+/* Value of hex digit, -1 for other characters */
+int form_hex_val(char c);
+
+#endif /* ESP_SUPLA_FORM_H_ */
@@ -5,6 +5,9 @@
  */
 
 #include "../include/esp-supla.h"
+#include "esp-supla-crc.h"
+#include "esp-supla-form.h"
+#include "esp-supla-www.h"
 
 #include <time.h>
 #include <string.h>
@@ -19,6 +22,9 @@
 
 static const char *TAG = "ESP-SUPLA";
 
+#define PAGE_BUF_SIZE 256  //small parts and fields are sent in chunks of this size
+#define PAGE_FIELD_SIZE 32 //longest formatted field, text fields are escaped while sent
+
 #define CHECK_ARG(VAL)                  \
     do {                                \
         if (!(VAL))                     \
@@ -34,247 +40,341 @@ static char *btox(char *hex, const char *bb, int len)
     return hex;
 }
 
-static int urldecode(char *out, const char *in)
+//config page fields, see esp-supla/www/config.html
+typedef struct {
+    bool data_saved;
+    char name[SUPLA_DEVICE_NAME_MAXSIZE];
+    char soft_ver[SUPLA_SOFTVER_MAXSIZE];
+    char guid_hex[SUPLA_GUID_HEXSIZE];
+    char ssid[sizeof(((wifi_config_t *)0)->sta.ssid) + 1];
+    uint8_t mac[6];
+    struct supla_config config;
+} cfg_page_t;
+
+typedef struct {
+    httpd_req_t *req;
+    esp_err_t err;
+    size_t len;
+    char buf[PAGE_BUF_SIZE];
+} page_out_t;
 
+static void page_flush(page_out_t *out)
 {
-    const char tab[256] = {
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, 0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  -1, -1, -1, -1, -1, -1, -1, 10,
-        11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
-    };
-    char c, v1, v2, *beg = out;
-    if (in != NULL) {
-        while ((c = *in++) != '\0') {
-            if (c == '%') {
-                if ((v1 = tab[(unsigned char)*in++]) < 0 || (v2 = tab[(unsigned char)*in++]) < 0) {
-                    *beg = '\0';
-                    return -1;
-                }
-                c = (v1 << 4) | v2;
-            }
-            *out++ = c;
-        }
+    if (out->len && out->err == ESP_OK)
+        out->err = httpd_resp_send_chunk(out->req, out->buf, out->len);
+    out->len = 0;
+}
+
+static void page_put(page_out_t *out, const void *data, size_t len)
+{
+    //large static parts are sent straight from flash
+    if (len >= sizeof(out->buf)) {
+        page_flush(out);
+        if (out->err == ESP_OK)
+            out->err = httpd_resp_send_chunk(out->req, data, len);
+        return;
     }
-    *out = '\0';
-    return 0;
+    if (out->len + len > sizeof(out->buf))
+        page_flush(out);
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
 }
 
-static esp_err_t send_html_response(char *html, httpd_req_t *req)
+static const char *html_entity(char c)
 {
-    CHECK_ARG(html);
-    CHECK_ARG(req);
+    switch (c) {
+    case '&':
+        return "&amp;";
+    case '<':
+        return "&lt;";
+    case '>':
+        return "&gt;";
+    case '"':
+        return "&quot;";
+    default:
+        return NULL;
+    }
+}
 
-    httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
-    httpd_resp_send(req, html, -1);
-    free(html);
-    return ESP_OK;
+static void field_part(page_out_t *out, uint32_t *crc, const char *data, size_t len)
+{
+    if (out)
+        page_put(out, data, len);
+    if (crc)
+        *crc = supla_crc32(*crc, data, len);
 }
 
-char *supla_esp_cfgmode_get_html_template(supla_dev_t *dev, bool data_saved)
+/* Field value is put to out and added to crc when they are given. Text is
+ * HTML escaped on the way, so escaped length is not limited by any buffer.
+ * Returns length of sent value */
+static size_t field_put(page_out_t *out, uint32_t *crc, const char *value, bool html)
+{
+    const char *ent;
+    size_t len = 0;
+    size_t n;
+
+    while (*value) {
+        //run of characters sent as they are, then entity of the next one
+        n = html ? strlen(value) : strcspn(value, "&<>\"");
+        field_part(out, crc, value, n);
+        len += n;
+        value += n;
+        if (*value) {
+            ent = html_entity(*value++);
+            field_part(out, crc, ent, strlen(ent));
+            len += strlen(ent);
+        }
+    }
+    return len;
+}
+
+static void cfg_page_load(cfg_page_t *page, supla_dev_t *dev)
 {
-    char *buffer = NULL;
-    char dev_name[SUPLA_DEVICE_NAME_MAXSIZE];
-    char soft_ver[SUPLA_SOFTVER_MAXSIZE];
-    char guid_hex[SUPLA_GUID_HEXSIZE];
-    uint8_t mac[6] = {};
     wifi_config_t wifi_config = { 0 };
-    struct supla_config config;
 
-    const char html_template_header[] =
-        "<!DOCTYPE html><meta http-equiv=\"content-type\" content=\"text/html; "
-        "charset=UTF-8\"><meta name=\"viewport\" "
-        "content=\"width=device-width,initial-scale=1,maximum-scale=1,user-"
-        "scalable=no\"><style>body{font-size:14px;font-family:HelveticaNeue,"
-        "\"Helvetica Neue\",HelveticaNeueRoman,HelveticaNeue-Roman,\"Helvetica "
-        "Neue "
-        "Roman\",TeXGyreHerosRegular,Helvetica,Tahoma,Geneva,Arial,sans-serif;"
-        "font-weight:400;font-stretch:normal;background:#00d151;color:#fff;line-"
-        "height:20px;padding:0}.s{width:460px;margin:0 auto;margin-top:calc(50vh "
-        "- 340px);border:solid 3px #fff;padding:0 10px "
-        "10px;border-radius:3px}#l{display:block;max-width:150px;height:155px;"
-        "margin:-80px auto 20px;background:#00d151;padding-right:5px}#l "
-        "path{fill:#000}.w{margin:3px 0 16px;padding:5px "
-        "0;border-radius:3px;background:#fff;box-shadow:0 1px 3px "
-        "rgba(0,0,0,.3)}h1,h3{margin:10px "
-        "8px;font-family:HelveticaNeueLight,HelveticaNeue-Light,\"Helvetica Neue "
-        "Light\",HelveticaNeue,\"Helvetica "
-        "Neue\",TeXGyreHerosRegular,Helvetica,Tahoma,Geneva,Arial,sans-serif;"
-        "font-weight:300;font-stretch:normal;color:#000;font-size:23px}h1{margin-"
-        "bottom:14px;color:#fff}span{display:block;margin:10px 7px "
-        "14px}i{display:block;font-style:normal;position:relative;border-bottom:"
-        "solid 1px "
-        "#00d151;height:42px}i:last-child{border:none}label{position:absolute;"
-        "display:inline-block;top:0;left:8px;color:#00d151;line-height:41px;"
-        "pointer-events:none}input,select{width:calc(100% - "
-        "145px);border:none;font-size:16px;line-height:40px;border-radius:0;"
-        "letter-spacing:-.5px;background:#fff;color:#000;padding-left:144px;-"
-        "webkit-appearance:none;-moz-appearance:none;appearance:none;outline:0!"
-        "important;height:40px}select{padding:0;float:right;margin:1px 3px 1px "
-        "2px}button{width:100%;border:0;background:#000;padding:5px "
-        "10px;font-size:16px;line-height:40px;color:#fff;border-radius:3px;box-"
-        "shadow:0 1px 3px "
-        "rgba(0,0,0,.3);cursor:pointer}.c{background:#ffe836;position:fixed;"
-        "width:100%;line-height:80px;color:#000;top:0;left:0;box-shadow:0 1px "
-        "3px rgba(0,0,0,.3);text-align:center;font-size:26px;z-index:100}@media "
-        "all and (max-height:920px){.s{margin-top:80px}}@media all and "
-        "(max-width:900px){.s{width:calc(100% - "
-        "20px);margin-top:40px;border:none;padding:0 "
-        "8px;border-radius:0}#l{max-width:80px;height:auto;margin:10px auto "
-        "20px}h1,h3{font-size:19px}i{border:none;height:auto}label{display:block;"
-        "margin:4px 0 "
-        "12px;color:#00d151;font-size:13px;position:relative;line-height:18px}"
-        "input,select{width:calc(100% - "
-        "10px);font-size:16px;line-height:28px;padding:0 5px;border-bottom:solid "
-        "1px #00d151}select{width:100%;float:none;margin:0}}</style><script "
-        "type=\"text/javascript\">function saveAndReboot(){var "
-        "e=document.getElementById(\"cfgform\");e.rbt.value=\"2\",e.submit()}"
-        "setTimeout(function(){var element =  document.getElementById('msg');if "
-        "( element != null ) element.style.visibility = "
-        "\"hidden\";},3200);</script>";
-
-    const char html_template[] =
-        "%s%s<div class=\"s\"><svg version=\"1.1\" id=\"l\" x=\"0\" y=\"0\" "
-        "viewBox=\"0 0 200 200\" xml:space=\"preserve\"><path "
-        "d=\"M59.3,2.5c18.1,0.6,31.8,8,40.2,23.5c3.1,5.7,4.3,11.9,4.1,18.3c-0.1,"
-        "3.6-0.7,7.1-1.9,10.6c-0.2,0.7-0.1,1.1,0.6,1.5c12.8,7.7,25.5,15.4,38.3,"
-        "23c2.9,1.7,5.8,3.4,8.7,5.3c1,0.6,1.6,0.6,2.5-0.1c4.5-3.6,9.8-5.3,15.7-5."
-        "4c12.5-0.1,22.9,7.9,25.2,19c1.9,9.2-2.9,19.2-11.8,23.9c-8.4,4.5-16.9,4."
-        "5-25.5,0.2c-0.7-0.3-1-0.2-1.5,0.3c-4.8,4.9-9.7,9.8-14.5,14.6c-5.3,5.3-"
-        "10.6,10.7-15.9,16c-1.8,1.8-3.6,3.7-5.4,5.4c-0.7,0.6-0.6,1,0,1.6c3.6,3.4,"
-        "5.8,7.5,6.2,12.2c0.7,7.7-2.2,14-8.8,18.5c-12.3,8.6-30.3,3.5-35-10.4c-2."
-        "8-8.4,0.6-17.7,8.6-22.8c0.9-0.6,1.1-1,0.8-2c-2-6.2-4.4-12.4-6.6-18.6c-6."
-        "3-17.6-12.7-35.1-19-52.7c-0.2-0.7-0.5-1-1.4-0.9c-12.5,0.7-23.6-2.6-33-"
-        "10.4c-8-6.6-12.9-15-14.2-25c-1.5-11.5,1.7-21.9,9.6-30.7C32.5,8.9,42.2,4."
-        "2,53.7,2.7c0.7-0.1,1.5-0.2,2.2-0.2C57,2.4,58.2,2.5,59.3,2.5z "
-        "M76.5,81c0,0.1,0.1,0.3,0.1,0.6c1.6,6.3,3.2,12.6,4.7,18.9c4.5,17.7,8.9,"
-        "35.5,13.3,53.2c0.2,0.9,0.6,1.1,1.6,0.9c5.4-1.2,10.7-0.8,15.7,1.6c0.8,0."
-        "4,1.2,0.3,1.7-0.4c11.2-12.9,22.5-25.7,33.4-38.7c0.5-0.6,0.4-1,0-1.6c-5."
-        "6-7.9-6.1-16.1-1.3-24.5c0.5-0.8,0.3-1.1-0.5-1.6c-9.1-4.7-18.1-9.3-27.2-"
-        "14c-6.8-3.5-13.5-7-20.3-10.5c-0.7-0.4-1.1-0.3-1.6,0.4c-1.3,1.8-2.7,3.5-"
-        "4.3,5.1c-4.2,4.2-9.1,7.4-14.7,9.7C76.9,80.3,76.4,80.3,76.5,81z "
-        "M89,42.6c0.1-2.5-0.4-5.4-1.5-8.1C83,23.1,74.2,16.9,61.7,15.8c-10-0.9-18."
-        "6,2.4-25.3,9.7c-8.4,9-9.3,22.4-2.2,32.4c6.8,9.6,19.1,14.2,31.4,11.9C79."
-        "2,67.1,89,55.9,89,42.6z "
-        "M102.1,188.6c0.6,0.1,1.5-0.1,2.4-0.2c9.5-1.4,15.3-10.9,11.6-19.2c-2.6-5."
-        "9-9.4-9.6-16.8-8.6c-8.3,1.2-14.1,8.9-12.4,16.6C88.2,183.9,94.4,188.6,"
-        "102.1,188.6z "
-        "M167.7,88.5c-1,0-2.1,0.1-3.1,0.3c-9,1.7-14.2,10.6-10.8,18.6c2.9,6.8,11."
-        "4,10.3,19,7.8c7.1-2.3,11.1-9.1,9.6-15.9C180.9,93,174.8,88.5,167.7,88."
-        "5z\"/></svg><h1>%s</h1><span>LAST STATE: %s<br>Firmware: %s<br>GUID: "
-        "%s<br>MAC: " MACSTR "</span><form id=\"cfgform\" "
-        "method=\"post\"><div class=\"w\"><h3>Wi-Fi Settings</h3><i><input "
-        "name=\"sid\" value=\"%s\"><label>Network name</label></i><i><input "
-        "name=\"wpw\" type=\"password\"><label>Password</label></i></div><div "
-        "class=\"w\"><h3>Supla Settings</h3><i><input name=\"svr\" "
-        "value=\"%s\"><label>Server</label></i><i><input name=\"eml\" "
-        "value=\"%s\"><label>E-mail</label></i></div><button "
-        "type=\"submit\">SAVE</button><br><br><button type=\"button\" "
-        "onclick=\"saveAndReboot();\">SAVE &amp; RESTART</button><input "
-        "type=\"hidden\" name=\"rbt\" value=\"0\" /></form></div><br><br>";
-
-    supla_dev_get_name(dev, dev_name, sizeof(dev_name));
-    supla_dev_get_software_version(dev, soft_ver, sizeof(soft_ver));
-    supla_dev_get_config(dev, &config);
-    btox(guid_hex, config.guid, sizeof(config.guid));
+    supla_dev_get_name(dev, page->name, sizeof(page->name));
+    supla_dev_get_software_version(dev, page->soft_ver, sizeof(page->soft_ver));
+    supla_dev_get_config(dev, &page->config);
+    btox(page->guid_hex, page->config.guid, sizeof(page->config.guid));
     esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_config);
-    esp_efuse_mac_get_default(mac);
-
-    int len = strlen(dev_name) + strlen(soft_ver) + strlen((const char *)wifi_config.sta.ssid) +
-              strlen(config.server) + strlen(config.email) + strlen(html_template_header) +
-              strlen(html_template) + 200;
-
-    buffer = (char *)malloc(len);
-
-    snprintf(buffer, len, html_template, html_template_header,
-             data_saved == 1 ? "<div id=\"msg\" class=\"c\">Data saved</div>" : "", dev_name,
-             "CONNECTED", soft_ver, guid_hex, MAC2STR(mac), wifi_config.sta.ssid, config.server,
-             config.email);
+    memcpy(page->ssid, wifi_config.sta.ssid, sizeof(wifi_config.sta.ssid));
+    page->ssid[sizeof(wifi_config.sta.ssid)] = 0;
+    esp_efuse_mac_get_default(page->mac);
+}
 
-    return buffer;
+//field value, *html is set for markup that must not be escaped
+static const char *cfg_page_field(const cfg_page_t *page, const char *field, char *buf, size_t size,
+                                  bool *html)
+{
+    *html = false;
+    if (!strcmp(field, "msg")) {
+        *html = true;
+        return page->data_saved ? "<div id=\"msg\" class=\"c\">Data saved</div>" : "";
+    }
+    if (!strcmp(field, "mac")) {
+        snprintf(buf, size, MACSTR, MAC2STR(page->mac));
+        return buf;
+    }
+    if (!strcmp(field, "name"))
+        return page->name;
+    if (!strcmp(field, "firmware"))
+        return page->soft_ver;
+    if (!strcmp(field, "guid"))
+        return page->guid_hex;
+    if (!strcmp(field, "ssid"))
+        return page->ssid;
+    if (!strcmp(field, "server"))
+        return page->config.server;
+    if (!strcmp(field, "email"))
+        return page->config.email;
+    return "";
 }
 
-static esp_err_t handle_post_req(supla_dev_t *dev, httpd_req_t *req, bool *reboot)
+/* Static parts of the page are streamed from flash, fields are rendered
+ * per request. Gzip response is built from precompressed parts with fields
+ * as stored deflate blocks, so nothing is compressed on device. */
+static esp_err_t cfg_page_send(httpd_req_t *req, supla_dev_t *dev, bool data_saved)
 {
-    char *req_data;
-    char *url_encoded;
-    char value[128];
-    struct supla_config config;
-    wifi_config_t wifi_config = {};
-    int bytes_recv = 0;
-    int rc;
+    static const uint8_t gz_header[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0x03 };
+    const supla_www_page_t *www = &supla_www_config;
+    cfg_page_t page = { .data_saved = data_saved };
+    page_out_t out = { .req = req, .err = ESP_OK };
+    char field[PAGE_FIELD_SIZE];
+    const char *value;
+    bool html;
+    char hdr[64];
+    char etag[16];
+    uint8_t block[13];
+    uint32_t crc = 0;
+    uint32_t len = 0;
+    bool gzip;
+    size_t n;
+    esp_err_t rc;
 
-    supla_dev_get_config(dev, &config);
-    if (req->content_len) {
-        /* allocate twice for:
-	 *  decoded[req->content_len + 1] | urlencoded[req->content_len + 1]  */
-        req_data = calloc(2, req->content_len + 1);
-        if (!req_data)
-            return ESP_ERR_NO_MEM;
-
-        url_encoded = req_data + req->content_len + 1;
-        for (int bytes_left = req->content_len; bytes_left > 0;) {
-            if ((rc = httpd_req_recv(req, url_encoded + bytes_recv, bytes_left)) <= 0) {
-                if (rc == HTTPD_SOCK_ERR_TIMEOUT)
-                    continue;
-                else
-                    return ESP_FAIL;
-            }
-            bytes_recv += rc;
-            bytes_left -= rc;
-        }
+    cfg_page_load(&page, dev);
 
-        urldecode(req_data, url_encoded);
-        ESP_LOGW(TAG, "post req:%s", req_data);
-        if (httpd_query_key_value(req_data, "sid", value, sizeof(value)) == ESP_OK) {
-            strncpy((char *)wifi_config.sta.ssid, value, sizeof(wifi_config.sta.ssid));
+    //page checksum is used as ETag and gzip trailer
+    for (size_t i = 0; i <= www->nfields; i++) {
+        n = www->txt_ofs[i + 1] - www->txt_ofs[i];
+        crc = supla_crc32(crc, www->txt + www->txt_ofs[i], n);
+        len += n;
+        if (i < www->nfields) {
+            value = cfg_page_field(&page, www->fields[i], field, sizeof(field), &html);
+            len += field_put(NULL, &crc, value, html);
         }
+    }
 
-        if (httpd_query_key_value(req_data, "wpw", value, sizeof(value)) == ESP_OK) {
-            strncpy((char *)wifi_config.sta.password, value, sizeof(wifi_config.sta.password));
-        }
+    rc = httpd_req_get_hdr_value_str(req, "Accept-Encoding", hdr, sizeof(hdr));
+    gzip = (rc == ESP_OK || rc == ESP_ERR_HTTPD_RESULT_TRUNC) && strstr(hdr, "gzip");
 
-        if (httpd_query_key_value(req_data, "svr", value, sizeof(value)) == ESP_OK) {
-            strncpy(config.server, value, sizeof(config.server));
-        }
+    snprintf(etag, sizeof(etag), "\"%08x%s\"", (unsigned)crc, gzip ? "gz" : "");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    //page shows device data, browser has to revalidate it on every load
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
 
-        if (httpd_query_key_value(req_data, "eml", value, sizeof(value)) == ESP_OK) {
-            strncpy(config.email, value, sizeof(config.email));
-        }
+    if (req->method == HTTP_GET &&
+        httpd_req_get_hdr_value_str(req, "If-None-Match", hdr, sizeof(hdr)) == ESP_OK &&
+        strstr(hdr, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
 
-        if (httpd_query_key_value(req_data, "prt", value, sizeof(value)) == ESP_OK) {
-            config.port = atoi(value);
+    httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+    if (gzip) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        page_put(&out, gz_header, sizeof(gz_header));
+    }
+
+    for (size_t i = 0; i <= www->nfields; i++) {
+        if (gzip) {
+            page_put(&out, www->gz + www->gz_ofs[i], www->gz_ofs[i + 1] - www->gz_ofs[i]);
+        } else {
+            page_put(&out, www->txt + www->txt_ofs[i], www->txt_ofs[i + 1] - www->txt_ofs[i]);
+        }
+        if (i == www->nfields)
+            break;
+
+        value = cfg_page_field(&page, www->fields[i], field, sizeof(field), &html);
+        n = field_put(NULL, NULL, value, html);
+        if (gzip && n) {
+            //stored block: not final, LEN, NLEN
+            block[0] = 0x00;
+            block[1] = n & 0xFF;
+            block[2] = n >> 8;
+            block[3] = ~n & 0xFF;
+            block[4] = (~n >> 8) & 0xFF;
+            page_put(&out, block, 5);
         }
+        field_put(&out, NULL, value, html);
+    }
 
-        if (httpd_query_key_value(req_data, "rbt", value, sizeof(value)) == ESP_OK) {
-            if (reboot != NULL)
-                *reboot = atoi(value);
+    if (gzip) {
+        //empty final stored block, CRC32 and size trailer
+        const uint8_t tail[] = { 0x01, 0x00, 0x00, 0xFF, 0xFF };
+        memcpy(block, tail, sizeof(tail));
+        for (int i = 0; i < 4; i++) {
+            block[5 + i] = crc >> (8 * i);
+            block[9 + i] = len >> (8 * i);
         }
-        free(req_data);
+        page_put(&out, block, sizeof(block));
+    }
+
+    page_flush(&out);
+    if (out.err == ESP_OK)
+        out.err = httpd_resp_send_chunk(req, NULL, 0);
+    return out.err;
+}
+
+//settings posted from config page
+typedef struct {
+    struct supla_config config;
+    wifi_config_t wifi_config;
+    bool reboot;
+    bool too_long; //value would be cut, nothing is saved
+} cfg_post_t;
+
+static void post_string(cfg_post_t *post, char *dst, size_t size, const char *value)
+{
+    size_t len = strlen(value);
+
+    if (len >= size) {
+        post->too_long = true;
+        return;
     }
+    memcpy(dst, value, len + 1);
+}
+
+static void post_ssid(void *arg, const char *value)
+{
+    cfg_post_t *post = arg;
+    //fixed size field, terminator is not needed for the longest SSID
+    if (strlen(value) > sizeof(post->wifi_config.sta.ssid)) {
+        post->too_long = true;
+        return;
+    }
+    strncpy((char *)post->wifi_config.sta.ssid, value, sizeof(post->wifi_config.sta.ssid));
+}
+
+static void post_password(void *arg, const char *value)
+{
+    cfg_post_t *post = arg;
+    post_string(post, (char *)post->wifi_config.sta.password,
+                sizeof(post->wifi_config.sta.password), value);
+}
+
+static void post_server(void *arg, const char *value)
+{
+    cfg_post_t *post = arg;
+    post_string(post, post->config.server, sizeof(post->config.server), value);
+}
+
+static void post_email(void *arg, const char *value)
+{
+    cfg_post_t *post = arg;
+    post_string(post, post->config.email, sizeof(post->config.email), value);
+}
 
-    rc = esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+static void post_port(void *arg, const char *value)
+{
+    cfg_post_t *post = arg;
+    post->config.port = atoi(value);
+}
+
+static void post_reboot(void *arg, const char *value)
+{
+    cfg_post_t *post = arg;
+    post->reboot = atoi(value);
+}
+
+static const form_field_t cfg_post_fields[] = {
+    { "sid", post_ssid },     { "wpw", post_password }, { "svr", post_server },
+    { "eml", post_email },    { "prt", post_port },     { "rbt", post_reboot },
+};
+
+static esp_err_t handle_post_req(supla_dev_t *dev, httpd_req_t *req, bool *reboot)
+{
+    struct supla_config config;
+    cfg_post_t post = { 0 };
+    int rc;
+
+    supla_dev_get_config(dev, &config);
+    post.config = config;
+    esp_wifi_get_config(ESP_IF_WIFI_STA, &post.wifi_config);
+
+    rc = form_parse(req, cfg_post_fields, sizeof(cfg_post_fields) / sizeof(cfg_post_fields[0]),
+                    &post);
+    if (rc != ESP_OK) {
+        ESP_LOGE(TAG, "post req ERR:%s(%d)", esp_err_to_name(rc), rc);
+        return rc;
+    }
+    if (post.too_long) {
+        ESP_LOGE(TAG, "post req ERR: value too long");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (reboot != NULL)
+        *reboot = post.reboot;
+
+    rc = esp_wifi_set_config(ESP_IF_WIFI_STA, &post.wifi_config);
     if (rc == 0) {
         ESP_LOGI(TAG, "wifi config OK");
-        return ESP_OK;
     } else {
         ESP_LOGE(TAG, "wifi config ERR:%s(%d)", esp_err_to_name(rc), rc);
         return rc;
     }
 
-    rc = supla_esp_nvs_config_write(&config);
+    //unchanged cloud settings are not written and device keeps running
+    if (!memcmp(&post.config, &config, sizeof(config)))
+        return ESP_OK;
+
+    rc = supla_esp_nvs_config_write(&post.config);
     if (rc == 0) {
         ESP_LOGI(TAG, "nvs write OK");
+        //stopped device is not started again, restart connects with new config
         supla_dev_stop(dev);
-        supla_dev_set_config(dev, &config);
+        supla_dev_set_config(dev, &post.config);
+        if (reboot != NULL)
+            *reboot = true;
         return ESP_OK;
     } else {
         ESP_LOGE(TAG, "nvs write ERR:%s(%d)", esp_err_to_name(rc), rc);
@@ -292,7 +392,6 @@ esp_err_t supla_dev_basic_httpd_handler(httpd_req_t *req)
     bool data_saved = false;
 
     supla_dev_t *dev = *(supla_dev_t **)req->user_ctx;
-    char *html = NULL;
 
     switch (req->method) {
     case HTTP_POST:
@@ -303,10 +402,11 @@ esp_err_t supla_dev_basic_httpd_handler(httpd_req_t *req)
         break;
     }
 
-    html = supla_esp_cfgmode_get_html_template(dev, data_saved);
-    rc = send_html_response(html, req);
-    if (reboot)
+    rc = cfg_page_send(req, dev, data_saved);
+    if (reboot) {
+        supla_esp_nvs_channel_state_flush();
         esp_restart();
+    }
     else
         return rc;
 }
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "esp-supla-json.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#ifdef CONFIG_ESP_LIBSUPLA_HTTPD_JSON_PRETTY
+#define JSON_PRETTY 1
+#else
+#define JSON_PRETTY 0
+#endif
+
+static void json_flush(json_writer_t *js)
+{
+    if (js->len && js->err == ESP_OK)
+        js->err = httpd_resp_send_chunk(js->req, js->buf, js->len);
+    js->len = 0;
+}
+
+static void json_put(json_writer_t *js, const char *data, size_t len)
+{
+    size_t n;
+
+    while (len) {
+        if (js->len == sizeof(js->buf))
+            json_flush(js);
+        n = MIN(len, sizeof(js->buf) - js->len);
+        memcpy(js->buf + js->len, data, n);
+        js->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void json_putc(json_writer_t *js, char c)
+{
+    if (js->len == sizeof(js->buf))
+        json_flush(js);
+    js->buf[js->len++] = c;
+}
+
+static void json_indent(json_writer_t *js, int depth)
+{
+    while (depth-- > 0)
+        json_putc(js, '\t');
+}
+
+static void json_put_string(json_writer_t *js, const char *str)
+{
+    const char hex[] = "0123456789abcdef";
+    const char *run = str;
+
+    json_putc(js, '"');
+    for (; *str; str++) {
+        unsigned char c = *str;
+        char esc = 0;
+
+        switch (c) {
+        case '"':
+        case '\\':
+            esc = c;
+            break;
+        case '\b':
+            esc = 'b';
+            break;
+        case '\f':
+            esc = 'f';
+            break;
+        case '\n':
+            esc = 'n';
+            break;
+        case '\r':
+            esc = 'r';
+            break;
+        case '\t':
+            esc = 't';
+            break;
+        default:
+            if (c >= 0x20)
+                continue;
+        }
+
+        json_put(js, run, str - run);
+        run = str + 1;
+        json_putc(js, '\\');
+        if (esc) {
+            json_putc(js, esc);
+        } else {
+            json_put(js, "u00", 3);
+            json_putc(js, hex[c >> 4]);
+            json_putc(js, hex[c & 0x0F]);
+        }
+    }
+    json_put(js, run, str - run);
+    json_putc(js, '"');
+}
+
+/* Separator, indentation and key of next value */
+static void json_value_begin(json_writer_t *js, const char *key)
+{
+    uint32_t bit = 1UL << js->depth;
+
+    if (js->depth && (js->has_items & bit)) {
+        json_putc(js, ',');
+        if (JSON_PRETTY)
+            json_putc(js, js->in_array & bit ? ' ' : '\n');
+    }
+    js->has_items |= bit;
+
+    if (!key)
+        return;
+    if (JSON_PRETTY)
+        json_indent(js, js->depth);
+    json_put_string(js, key);
+    json_putc(js, ':');
+    if (JSON_PRETTY)
+        json_putc(js, '\t');
+}
+
+static void json_container_begin(json_writer_t *js, const char *key, char open, bool array)
+{
+    uint32_t bit;
+
+    json_value_begin(js, key);
+    json_putc(js, open);
+    if (js->depth + 1 >= JSON_WRITER_MAX_DEPTH) {
+        js->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+
+    bit = 1UL << ++js->depth;
+    js->has_items &= ~bit;
+    if (array) {
+        js->in_array |= bit;
+    } else {
+        js->in_array &= ~bit;
+        if (JSON_PRETTY)
+            json_putc(js, '\n');
+    }
+}
+
+static void json_container_end(json_writer_t *js, char close)
+{
+    bool array = js->in_array & (1UL << js->depth);
+
+    if (JSON_PRETTY && !array) {
+        if (js->has_items & (1UL << js->depth))
+            json_putc(js, '\n');
+        json_indent(js, js->depth - 1);
+    }
+    json_putc(js, close);
+    if (js->depth)
+        js->depth--;
+}
+
+void json_writer_init(json_writer_t *js, httpd_req_t *req)
+{
+    js->req = req;
+    js->err = ESP_OK;
+    js->depth = 0;
+    js->in_array = 0;
+    js->has_items = 0;
+    js->len = 0;
+    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+}
+
+void json_obj_begin(json_writer_t *js, const char *key)
+{
+    json_container_begin(js, key, '{', false);
+}
+
+void json_obj_end(json_writer_t *js)
+{
+    json_container_end(js, '}');
+}
+
+void json_arr_begin(json_writer_t *js, const char *key)
+{
+    json_container_begin(js, key, '[', true);
+}
+
+void json_arr_end(json_writer_t *js)
+{
+    json_container_end(js, ']');
+}
+
+void json_str(json_writer_t *js, const char *key, const char *value)
+{
+    json_value_begin(js, key);
+    json_put_string(js, value);
+}
+
+void json_int(json_writer_t *js, const char *key, int64_t value)
+{
+    char num[21];
+    char *p = num + sizeof(num);
+    uint64_t u = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (value < 0)
+        *--p = '-';
+
+    json_value_begin(js, key);
+    json_put(js, p, num + sizeof(num) - p);
+}
+
+void json_bool(json_writer_t *js, const char *key, bool value)
+{
+    json_value_begin(js, key);
+    if (value)
+        json_put(js, "true", 4);
+    else
+        json_put(js, "false", 5);
+}
+
+esp_err_t json_writer_finish(json_writer_t *js)
+{
+    json_flush(js);
+    if (js->err == ESP_OK)
+        js->err = httpd_resp_send_chunk(js->req, NULL, 0);
+    return js->err;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef ESP_SUPLA_JSON_H_
+#define ESP_SUPLA_JSON_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#define JSON_WRITER_BUF_SIZE 256
+#define JSON_WRITER_MAX_DEPTH 32
+
+/* Streaming JSON writer. Output is collected in buf and sent with
+ * httpd_resp_send_chunk() when full, no heap is used. Members are written
+ * with key, array elements and root with NULL key. With
+ * CONFIG_ESP_LIBSUPLA_HTTPD_JSON_PRETTY output is byte identical to
+ * cJSON_Print(), otherwise to cJSON_PrintUnformatted(). */
+typedef struct {
+    httpd_req_t *req;
+    esp_err_t err;      //first send error, further output is dropped
+    uint8_t depth;
+    uint32_t in_array;  //bit per depth, container is array
+    uint32_t has_items; //bit per depth, container is not empty
+    size_t len;
+    char buf[JSON_WRITER_BUF_SIZE];
+} json_writer_t;
+
+void json_writer_init(json_writer_t *js, httpd_req_t *req);
+void json_obj_begin(json_writer_t *js, const char *key);
+void json_obj_end(json_writer_t *js);
+void json_arr_begin(json_writer_t *js, const char *key);
+void json_arr_end(json_writer_t *js);
+void json_str(json_writer_t *js, const char *key, const char *value);
+void json_int(json_writer_t *js, const char *key, int64_t value);
+void json_bool(json_writer_t *js, const char *key, bool value);
+/* Send buffered output and end chunked response */
+esp_err_t json_writer_finish(json_writer_t *js);
+
+#endif /* ESP_SUPLA_JSON_H_ */
@@ -0,0 +1,450 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "../include/esp-supla.h"
+#include "esp-supla-push.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#define CHECK_ARG(VAL)                  \
+    do {                                \
+        if (!(VAL))                     \
+            return ESP_ERR_INVALID_ARG; \
+    } while (0)
+
+#ifdef CONFIG_ESP_LIBSUPLA_HTTPD_PUSH
+
+static const char *TAG = "ESP-SUPLA";
+
+#define PUSH_MAX_CLIENTS CONFIG_ESP_LIBSUPLA_HTTPD_PUSH_MAX_CLIENTS
+#define PUSH_QUEUE_SIZE CONFIG_ESP_LIBSUPLA_HTTPD_PUSH_QUEUE_SIZE
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+#define PUSH_STATE_MAX CONFIG_ESP_LIBSUPLA_STATIC_STATE_SIZE //largest state cache accepts
+#else
+#define PUSH_STATE_MAX 64 //longer channel states are not pushed
+#endif
+#define PUSH_DEV_MSG_SIZE 160                      //longest device event
+#define PUSH_CH_MSG_SIZE (2 * PUSH_STATE_MAX + 32) //longest channel event
+#define PUSH_MSG_SIZE \
+    (PUSH_CH_MSG_SIZE > PUSH_DEV_MSG_SIZE ? PUSH_CH_MSG_SIZE : PUSH_DEV_MSG_SIZE)
+#define PUSH_POLL_MS 50   //device state check period
+#define PUSH_RECV_SIZE 32 //longest accepted client message
+
+/* Events are queued per client as 2 byte length and JSON text. When queue
+ * overflows it is dropped and the client gets full state instead. */
+typedef struct {
+    int fd;      //-1 when slot is free
+    bool resync; //full state is sent before queued events
+    supla_dev_t *dev;
+    //last reported by poll timer
+    supla_dev_state_t state;
+    time_t conn_uptime;
+    size_t head;
+    size_t used;
+    uint8_t queue[PUSH_QUEUE_SIZE];
+} push_client_t;
+
+static struct {
+    SemaphoreHandle_t lock;
+    esp_timer_handle_t timer;
+    httpd_handle_t hd;
+    bool work_queued;
+    int clients;
+    push_client_t client[PUSH_MAX_CLIENTS];
+} push;
+
+static size_t push_dev_msg(char *msg, size_t size, supla_dev_t *dev, supla_dev_state_t state,
+                           time_t conn_uptime)
+{
+    time_t uptime = 0;
+
+    supla_dev_get_uptime(dev, &uptime);
+    return snprintf(msg, size, "{\"dev\":{\"state\":\"%s\",\"uptime\":%d,\"connection_uptime\":%d}}",
+                    supla_dev_state_str(state), (int)uptime, (int)conn_uptime);
+}
+
+//channels reported as too long to push, each is logged once
+static uint32_t push_skipped[256 / 32];
+
+static size_t push_ch_msg(char *msg, size_t size, int ch_num, const uint8_t *data, size_t len)
+{
+    const char hex[] = "0123456789abcdef";
+    size_t n;
+
+    if (len > PUSH_STATE_MAX) {
+        if (ch_num >= 0 && ch_num < 256 && !(push_skipped[ch_num / 32] & 1UL << ch_num % 32)) {
+            push_skipped[ch_num / 32] |= 1UL << ch_num % 32;
+            ESP_LOGW(TAG, "push: ch[%d] state of %d bytes not pushed, max %d", ch_num, (int)len,
+                     PUSH_STATE_MAX);
+        }
+        return 0;
+    }
+
+    n = snprintf(msg, size, "{\"ch\":%d,\"state\":\"", ch_num);
+    for (size_t i = 0; i < len; i++) {
+        msg[n++] = hex[data[i] >> 4];
+        msg[n++] = hex[data[i] & 0x0F];
+    }
+    msg[n++] = '"';
+    msg[n++] = '}';
+    return n;
+}
+
+static void queue_put(push_client_t *c, const char *msg, size_t len)
+{
+    const uint8_t hdr[2] = { len & 0xFF, len >> 8 };
+
+    if (c->resync)
+        return;
+    if (c->used + sizeof(hdr) + len > sizeof(c->queue)) {
+        ESP_LOGW(TAG, "push: client %d queue full, resync", c->fd);
+        c->head = 0;
+        c->used = 0;
+        c->resync = true;
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(hdr) + len; i++) {
+        c->queue[(c->head + c->used) % sizeof(c->queue)] = i < sizeof(hdr) ? hdr[i] :
+                                                                             msg[i - sizeof(hdr)];
+        c->used++;
+    }
+}
+
+static size_t queue_get(push_client_t *c, char *msg)
+{
+    size_t len;
+
+    if (!c->used)
+        return 0;
+
+    len = c->queue[c->head] | c->queue[(c->head + 1) % sizeof(c->queue)] << 8;
+    c->head = (c->head + 2) % sizeof(c->queue);
+    for (size_t i = 0; i < len; i++) {
+        msg[i] = c->queue[c->head];
+        c->head = (c->head + 1) % sizeof(c->queue);
+    }
+    c->used -= 2 + len;
+    return len;
+}
+
+static esp_err_t push_send(int fd, const char *msg, size_t len)
+{
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)msg,
+        .len = len //
+    };
+
+    if (httpd_ws_get_fd_info(push.hd, fd) != HTTPD_WS_CLIENT_WEBSOCKET)
+        return ESP_ERR_INVALID_STATE;
+    return httpd_ws_send_frame_async(push.hd, fd, &frame);
+}
+
+/* States are copied out one by one, so slow client does not hold channel
+ * state cache locked while frames are sent */
+static esp_err_t push_snapshot(int fd, supla_dev_t *dev)
+{
+    supla_dev_state_t state;
+    time_t conn_uptime = 0;
+    char msg[PUSH_MSG_SIZE];
+    uint8_t data[PUSH_STATE_MAX];
+    int ch_num;
+    int len;
+    size_t n;
+    esp_err_t err;
+
+    supla_dev_get_state(dev, &state);
+    supla_dev_get_connection_uptime(dev, &conn_uptime);
+    n = push_dev_msg(msg, sizeof(msg), dev, state, conn_uptime);
+    err = push_send(fd, msg, n);
+    for (int i = 0; err == ESP_OK; i++) {
+        len = ch_state_copy(dev, i, &ch_num, data, sizeof(data));
+        if (len < 0)
+            break;
+        n = push_ch_msg(msg, sizeof(msg), ch_num, data, len);
+        if (n)
+            err = push_send(fd, msg, n);
+    }
+    return err;
+}
+
+//called with lock held
+static void push_client_free(push_client_t *c)
+{
+    ESP_LOGI(TAG, "push: client %d removed", c->fd);
+    c->fd = -1;
+    if (--push.clients == 0)
+        esp_timer_stop(push.timer);
+}
+
+/* Runs in httpd task, so frames are never sent concurrently with the
+ * server using the sockets */
+static void push_work(void *arg)
+{
+    char msg[PUSH_MSG_SIZE];
+    push_client_t *c;
+    supla_dev_t *dev;
+    bool resync;
+    size_t len;
+    int fd;
+    esp_err_t err;
+
+    //events queued from now on schedule another run
+    xSemaphoreTake(push.lock, portMAX_DELAY);
+    push.work_queued = false;
+    xSemaphoreGive(push.lock);
+
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+        c = &push.client[i];
+        for (;;) {
+            xSemaphoreTake(push.lock, portMAX_DELAY);
+            fd = c->fd;
+            dev = c->dev;
+            resync = c->resync;
+            c->resync = false;
+            len = fd >= 0 && !resync ? queue_get(c, msg) : 0;
+            xSemaphoreGive(push.lock);
+
+            if (fd < 0 || (!resync && !len))
+                break;
+
+            err = resync ? push_snapshot(fd, dev) : push_send(fd, msg, len);
+            if (err != ESP_OK) {
+                xSemaphoreTake(push.lock, portMAX_DELAY);
+                if (c->fd == fd)
+                    push_client_free(c);
+                xSemaphoreGive(push.lock);
+                break;
+            }
+        }
+    }
+}
+
+//called with lock held, returns true when work has to be queued
+static bool push_schedule(void)
+{
+    if (push.work_queued)
+        return false;
+    push.work_queued = true;
+    return true;
+}
+
+static void push_queue_work(bool schedule)
+{
+    if (!schedule || httpd_queue_work(push.hd, push_work, NULL) == ESP_OK)
+        return;
+
+    xSemaphoreTake(push.lock, portMAX_DELAY);
+    push.work_queued = false;
+    xSemaphoreGive(push.lock);
+}
+
+//clients of other devices are skipped, NULL dev goes to all
+static void push_broadcast(supla_dev_t *dev, const char *msg, size_t len)
+{
+    bool schedule = false;
+
+    xSemaphoreTake(push.lock, portMAX_DELAY);
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+        if (push.client[i].fd >= 0 && (!dev || push.client[i].dev == dev))
+            queue_put(&push.client[i], msg, len);
+    }
+    if (push.clients)
+        schedule = push_schedule();
+    xSemaphoreGive(push.lock);
+    push_queue_work(schedule);
+}
+
+//called with lock held, true when client still watches dev on the same socket
+static bool push_client_is(push_client_t *c, int fd, supla_dev_t *dev)
+{
+    return c->fd >= 0 && c->fd == fd && c->dev == dev;
+}
+
+/* Each client follows state of its own device. Connection uptime is
+ * reported when it restarts, clients count it on their own between events.
+ * Device is read without lock held */
+static void push_poll_cb(void *arg)
+{
+    supla_dev_t *dev[PUSH_MAX_CLIENTS];
+    int fd[PUSH_MAX_CLIENTS];
+    supla_dev_state_t state;
+    time_t conn_uptime;
+    char msg[PUSH_DEV_MSG_SIZE];
+    push_client_t *c;
+    bool schedule = false;
+    bool changed;
+    size_t n;
+
+    xSemaphoreTake(push.lock, portMAX_DELAY);
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+        fd[i] = push.client[i].fd;
+        dev[i] = push.client[i].dev;
+    }
+    xSemaphoreGive(push.lock);
+
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+        c = &push.client[i];
+        if (fd[i] < 0)
+            continue;
+
+        conn_uptime = 0;
+        supla_dev_get_state(dev[i], &state);
+        supla_dev_get_connection_uptime(dev[i], &conn_uptime);
+        xSemaphoreTake(push.lock, portMAX_DELAY);
+        changed = false;
+        if (push_client_is(c, fd[i], dev[i])) {
+            changed = state != c->state || conn_uptime < c->conn_uptime;
+            c->state = state;
+            c->conn_uptime = conn_uptime;
+        }
+        xSemaphoreGive(push.lock);
+        if (!changed)
+            continue;
+
+        n = push_dev_msg(msg, sizeof(msg), dev[i], state, conn_uptime);
+        xSemaphoreTake(push.lock, portMAX_DELAY);
+        if (push_client_is(c, fd[i], dev[i])) {
+            queue_put(c, msg, n);
+            schedule |= push_schedule();
+        }
+        xSemaphoreGive(push.lock);
+    }
+    push_queue_work(schedule);
+}
+
+static esp_err_t push_init(void)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = push_poll_cb,
+        .name = "supla_push" //
+    };
+    SemaphoreHandle_t lock;
+    esp_err_t rc;
+
+    if (push.lock)
+        return ESP_OK;
+
+    rc = esp_timer_create(&timer_args, &push.timer);
+    if (rc != ESP_OK)
+        return rc;
+
+    lock = xSemaphoreCreateMutex();
+    if (!lock) {
+        esp_timer_delete(push.timer);
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++)
+        push.client[i].fd = -1;
+    //channel state changes are queued from now on
+    push.lock = lock;
+    return ESP_OK;
+}
+
+static esp_err_t push_subscribe(httpd_req_t *req, supla_dev_t *dev)
+{
+    int fd = httpd_req_to_sockfd(req);
+    push_client_t *slot = NULL;
+    push_client_t *c;
+    supla_dev_state_t state;
+    time_t conn_uptime = 0;
+    bool schedule = false;
+    esp_err_t rc;
+
+    rc = push_init();
+    if (rc != ESP_OK)
+        return rc;
+
+    supla_dev_get_state(dev, &state);
+    supla_dev_get_connection_uptime(dev, &conn_uptime);
+
+    xSemaphoreTake(push.lock, portMAX_DELAY);
+    push.hd = req->handle;
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+        c = &push.client[i];
+        //closed connections are noticed on send, reclaim them for new client
+        if (c->fd >= 0 &&
+            (c->fd == fd || httpd_ws_get_fd_info(push.hd, c->fd) != HTTPD_WS_CLIENT_WEBSOCKET))
+            push_client_free(c);
+        if (c->fd < 0 && !slot)
+            slot = c;
+    }
+
+    if (slot) {
+        slot->fd = fd;
+        slot->resync = true;
+        slot->dev = dev;
+        slot->state = state;
+        slot->conn_uptime = conn_uptime;
+        slot->head = 0;
+        slot->used = 0;
+        if (push.clients++ == 0)
+            esp_timer_start_periodic(push.timer, PUSH_POLL_MS * 1000);
+        schedule = push_schedule();
+    }
+    xSemaphoreGive(push.lock);
+
+    if (!slot) {
+        ESP_LOGW(TAG, "push: max %d clients, %d rejected", PUSH_MAX_CLIENTS, fd);
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "push: client %d added", fd);
+    push_queue_work(schedule);
+    return ESP_OK;
+}
+
+void push_channel_state(supla_dev_t *dev, int ch_num, const void *data, size_t len)
+{
+    char msg[PUSH_MSG_SIZE];
+    size_t n;
+
+    if (!push.lock || !push.clients)
+        return;
+    n = push_ch_msg(msg, sizeof(msg), ch_num, data, len);
+    if (n)
+        push_broadcast(dev, msg, n);
+}
+
+esp_err_t supla_dev_ws_handler(httpd_req_t *req)
+{
+    CHECK_ARG(req);
+    CHECK_ARG(req->user_ctx);
+    httpd_ws_frame_t frame = { 0 };
+    uint8_t buf[PUSH_RECV_SIZE];
+    esp_err_t rc;
+
+    //handshake done, connection becomes subscriber
+    if (req->method == HTTP_GET)
+        return push_subscribe(req, *(supla_dev_t **)req->user_ctx);
+
+    //client messages are not used, payload is read and dropped
+    rc = httpd_ws_recv_frame(req, &frame, 0);
+    if (rc != ESP_OK || !frame.len)
+        return rc;
+    if (frame.len > sizeof(buf))
+        return ESP_ERR_INVALID_SIZE;
+    frame.payload = buf;
+    return httpd_ws_recv_frame(req, &frame, frame.len);
+}
+
+#else
+
+esp_err_t supla_dev_ws_handler(httpd_req_t *req)
+{
+    CHECK_ARG(req);
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* CONFIG_ESP_LIBSUPLA_HTTPD_PUSH */
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef ESP_SUPLA_PUSH_H_
+#define ESP_SUPLA_PUSH_H_
+
+#include <stddef.h>
+#include <libsupla/device.h>
+
+/* Copy state of n-th cached channel of dev, implemented in esp-supla.c.
+ * Channels with unknown device are counted for every device. New channels
+ * are appended so indexes stay valid between calls. Returns state length,
+ * state longer than size is not copied, or -1 past the last one */
+int ch_state_copy(supla_dev_t *dev, int index, int *ch_num, void *buf, size_t size);
+
+#ifdef CONFIG_ESP_LIBSUPLA_HTTPD_PUSH
+/* Queue changed channel state for WebSocket subscribers of dev, all
+ * subscribers get it when dev is NULL */
+void push_channel_state(supla_dev_t *dev, int ch_num, const void *data, size_t len);
+#else
+static inline void push_channel_state(supla_dev_t *dev, int ch_num, const void *data, size_t len)
+{
+}
+#endif
+
+#endif /* ESP_SUPLA_PUSH_H_ */
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "../include/esp-supla.h"
+#include "../include/esp-supla-mem.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+static const char *TAG = "ESP-SUPLA";
+
+#define REGISTRY_MIN_CAPACITY 4
+#define REGISTRY_MAX_CAPACITY 0xFFFF
+
+#define CHECK_ARG(VAL)                  \
+    do {                                \
+        if (!(VAL))                     \
+            return ESP_ERR_INVALID_ARG; \
+    } while (0)
+
+/* Devices are kept in array indexed by id, so routing a request is one
+ * bounds check and load. Freed ids are reused, array only grows. */
+static struct {
+    SemaphoreHandle_t lock;
+    supla_dev_t **devs;
+    uint16_t capacity;
+    uint16_t count;
+} registry;
+
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+static supla_dev_t *registry_devs[CONFIG_ESP_LIBSUPLA_STATIC_DEVICES];
+#endif
+
+static esp_err_t registry_init(void)
+{
+    SemaphoreHandle_t lock;
+
+    if (registry.lock)
+        return ESP_OK;
+
+    lock = xSemaphoreCreateMutex();
+    if (!lock)
+        return ESP_ERR_NO_MEM;
+    registry.lock = lock;
+    return ESP_OK;
+}
+
+static esp_err_t registry_grow(void)
+{
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+    //all slots are taken into use by first registration
+    if (registry.capacity)
+        return ESP_ERR_NO_MEM;
+    registry.devs = registry_devs;
+    registry.capacity = CONFIG_ESP_LIBSUPLA_STATIC_DEVICES;
+    return ESP_OK;
+#else
+    size_t capacity = registry.capacity ? 2 * registry.capacity : REGISTRY_MIN_CAPACITY;
+    supla_dev_t **devs;
+
+    if (capacity > REGISTRY_MAX_CAPACITY)
+        capacity = REGISTRY_MAX_CAPACITY;
+    if (capacity == registry.capacity)
+        return ESP_ERR_NO_MEM;
+
+    devs = supla_mem_realloc(SUPLA_MEM_REGISTRY, registry.devs, capacity * sizeof(*devs));
+    if (!devs)
+        return ESP_ERR_NO_MEM;
+
+    memset(devs + registry.capacity, 0, (capacity - registry.capacity) * sizeof(*devs));
+    registry.devs = devs;
+    registry.capacity = capacity;
+    return ESP_OK;
+#endif
+}
+
+esp_err_t supla_esp_dev_register(supla_dev_t *dev, int *id)
+{
+    CHECK_ARG(dev);
+    CHECK_ARG(id);
+    esp_err_t rc;
+    int i;
+
+    rc = registry_init();
+    if (rc != ESP_OK)
+        return rc;
+
+    xSemaphoreTake(registry.lock, portMAX_DELAY);
+    if (registry.count == registry.capacity)
+        rc = registry_grow();
+
+    if (rc == ESP_OK) {
+        for (i = 0; registry.devs[i]; i++)
+            ;
+        registry.devs[i] = dev;
+        registry.count++;
+        *id = i;
+    }
+    xSemaphoreGive(registry.lock);
+    return rc;
+}
+
+esp_err_t supla_esp_dev_unregister(int id)
+{
+    esp_err_t rc = ESP_ERR_NOT_FOUND;
+
+    if (!registry.lock)
+        return rc;
+
+    xSemaphoreTake(registry.lock, portMAX_DELAY);
+    if (id >= 0 && id < registry.capacity && registry.devs[id]) {
+        registry.devs[id] = NULL;
+        registry.count--;
+        rc = ESP_OK;
+    }
+    xSemaphoreGive(registry.lock);
+    return rc;
+}
+
+supla_dev_t *supla_esp_dev_get(int id)
+{
+    supla_dev_t *dev = NULL;
+
+    if (!registry.lock)
+        return NULL;
+
+    xSemaphoreTake(registry.lock, portMAX_DELAY);
+    if (id >= 0 && id < registry.capacity)
+        dev = registry.devs[id];
+    xSemaphoreGive(registry.lock);
+    return dev;
+}
+
+int supla_esp_dev_get_id(const supla_dev_t *dev)
+{
+    int id = -1;
+
+    if (!registry.lock || !dev)
+        return -1;
+
+    xSemaphoreTake(registry.lock, portMAX_DELAY);
+    for (int i = 0; i < registry.capacity; i++) {
+        if (registry.devs[i] == dev) {
+            id = i;
+            break;
+        }
+    }
+    xSemaphoreGive(registry.lock);
+    return id;
+}
+
+int supla_esp_dev_registry_iterate(void)
+{
+    supla_dev_t *dev;
+    bool in_range;
+    int iterated = 0;
+
+    if (!registry.lock)
+        return 0;
+
+    //lock is not held while device is iterated, requests are routed meanwhile
+    for (int id = 0;; id++) {
+        xSemaphoreTake(registry.lock, portMAX_DELAY);
+        in_range = id < registry.capacity;
+        dev = in_range ? registry.devs[id] : NULL;
+        xSemaphoreGive(registry.lock);
+
+        if (!in_range)
+            break;
+        if (dev) {
+            supla_esp_dev_iterate(dev);
+            iterated++;
+        }
+    }
+    return iterated;
+}
+
+esp_err_t supla_esp_dev_registry_get_stats(supla_esp_registry_stats_t *stats)
+{
+    CHECK_ARG(stats);
+
+    memset(stats, 0, sizeof(*stats));
+    if (!registry.lock)
+        return ESP_OK;
+
+    xSemaphoreTake(registry.lock, portMAX_DELAY);
+    stats->devices = registry.count;
+    stats->capacity = registry.capacity;
+    stats->bytes = registry.capacity * sizeof(*registry.devs);
+    xSemaphoreGive(registry.lock);
+    return ESP_OK;
+}
+
+/* URI is SUPLA_ESP_REGISTRY_URI_BASE/<id>[/config][?query] */
+esp_err_t supla_dev_registry_httpd_handler(httpd_req_t *req)
+{
+    CHECK_ARG(req);
+    const char *uri = req->uri + strlen(SUPLA_ESP_REGISTRY_URI_BASE);
+    esp_err_t (*handler)(httpd_req_t *req) = NULL;
+    void *user_ctx = req->user_ctx;
+    supla_dev_t *dev = NULL;
+    char *end;
+    long id;
+    esp_err_t rc;
+
+    if (!strncmp(req->uri, SUPLA_ESP_REGISTRY_URI_BASE "/", strlen(SUPLA_ESP_REGISTRY_URI_BASE) + 1)) {
+        id = strtol(uri + 1, &end, 10);
+        if (end != uri + 1)
+            dev = supla_esp_dev_get(id);
+        if (dev && (*end == '\0' || *end == '?'))
+            handler = supla_dev_httpd_handler;
+        else if (dev && !strncmp(end, "/config", 7) && (end[7] == '\0' || end[7] == '?'))
+            handler = supla_dev_basic_httpd_handler;
+    }
+
+    if (!handler) {
+        ESP_LOGD(TAG, "no device for %s", req->uri);
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+    }
+
+    //device handlers take supla_dev_t ** from user_ctx
+    req->user_ctx = &dev;
+    rc = handler(req);
+    req->user_ctx = user_ctx;
+    return rc;
+}
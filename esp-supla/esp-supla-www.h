@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef ESP_SUPLA_WWW_H_
+#define ESP_SUPLA_WWW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Page template generated at build time by tools/www2c.py. Static part i
+ * spans txt_ofs[i]..txt_ofs[i + 1] of txt and gz_ofs[i]..gz_ofs[i + 1] of
+ * gz (raw deflate, byte aligned, no final block), field i follows it. */
+typedef struct {
+    const char *txt;
+    const uint8_t *gz;
+    const uint16_t *txt_ofs;
+    const uint16_t *gz_ofs;
+    const char *const *fields;
+    size_t nfields;
+} supla_www_page_t;
+
+extern const supla_www_page_t supla_www_config;
+
+#endif /* ESP_SUPLA_WWW_H_ */
@@ -5,27 +5,116 @@
  */
 
 #include "../include/esp-supla.h"
+#include "../include/esp-supla-journal.h"
+#include "../include/esp-supla-mem.h"
+#include "esp-supla-crc.h"
+#include "esp-supla-form.h"
+#include "esp-supla-json.h"
+#include "esp-supla-push.h"
 
 #include <time.h>
 #include <string.h>
 #include <sys/param.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <esp_system.h>
+#include <esp_timer.h>
 #include <esp_log.h>
 #include <esp_err.h>
 #include <nvs_flash.h>
 #include <esp_netif.h>
 #include <esp_wifi.h>
-#include <cJSON.h>
 
 #ifndef CONFIG_IDF_TARGET_ESP8266
-#include <esp_random.h> //ESP-IDF only
-#include <esp_mac.h>    //ESP-IDF only
+#include <esp_random.h>    //ESP-IDF only
+#include <esp_mac.h>       //ESP-IDF only
+#include <esp_heap_caps.h> //largest free block, ESP-IDF only
 #endif
 
 static const char *TAG = "ESP-SUPLA";
 static const char *NVS_STORAGE = "supla_nvs";
 
+#define NVS_CONFIG_KEY "config"
+#define NVS_CONFIG_VERSION 1
+//version, ssl, port, guid, auth_key, email and server length, crc
+#define NVS_CONFIG_MIN_SIZE (4 + SUPLA_GUID_SIZE + SUPLA_AUTHKEY_SIZE + 2 + 4)
+#define NVS_CONFIG_MAX_SIZE \
+    (NVS_CONFIG_MIN_SIZE + SUPLA_EMAIL_MAXSIZE - 1 + SUPLA_SERVER_NAME_MAXSIZE - 1)
+
+#ifndef CONFIG_ESP_LIBSUPLA_NVS_FLUSH_DELAY_MS
+#define CONFIG_ESP_LIBSUPLA_NVS_FLUSH_DELAY_MS 5000
+#endif
+
+/* data holds latest state followed by shadow of the blob stored in NVS.
+ * States are keyed by device and channel number, device is known for
+ * channels added with supla_esp_add_channel() */
+typedef struct nvs_ch_state {
+    struct nvs_ch_state *next;
+    supla_dev_t *dev; //NULL when channel has no esp_channel_t entry
+    int dev_id;       //registry id used in NVS key and journal id
+    int ch_num;
+    bool dirty;  //latest state differs from NVS
+    bool stored; //shadow is valid, blob exists in NVS
+    size_t len;
+    uint8_t data[];
+} nvs_ch_state_t;
+
+#define CH_STATE_SHADOW(entry) ((entry)->data + (entry)->len)
+#define CH_STATE_KEY_SIZE 16        //NVS key length limit with terminator
+#define CH_STATE_JOURNAL_DEVS 0xFF //device id is high byte of journal id, 0xFFFF is free
+
+//channels listed by HTTP API, appended only
+typedef struct esp_channel {
+    struct esp_channel *next;
+    supla_dev_t *dev;
+    supla_channel_t *ch;
+    const supla_channel_config_t *config;
+} esp_channel_t;
+
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+SUPLA_MEM_POOL_DEFINE(ch_state_pool, SUPLA_MEM_CH_STATE,
+                      sizeof(nvs_ch_state_t) + 2 * CONFIG_ESP_LIBSUPLA_STATIC_STATE_SIZE,
+                      CONFIG_ESP_LIBSUPLA_STATIC_CHANNELS);
+SUPLA_MEM_POOL_DEFINE(channel_pool, SUPLA_MEM_CHANNELS, sizeof(esp_channel_t),
+                      CONFIG_ESP_LIBSUPLA_STATIC_CHANNELS);
+#endif
+
+#define CHANNELS_PAGE_MAX 32  //default and max limit of action=channels
+#define CHANNELS_STATE_MAX 64 //longer channel states are not listed
+#define URL_QUERY_MAXSIZE 128 //longer URL query is rejected
+
+#define CMD_BATCH_MAX 16           //channel values in one set_values request
+#define CMD_APPLY_TIMEOUT_MS 2000 //wait for supla_esp_dev_iterate()
+
+typedef struct {
+    esp_channel_t *entry;
+    char value[SUPLA_CHANNELVALUE_SIZE];
+    int result; //on_set_value() result
+} cmd_value_t;
+
+//channel values posted in one request, applied together by device loop
+typedef struct {
+    supla_dev_t *dev;
+    esp_err_t err;
+    int ch_num; //channel of next value
+    int count;
+    cmd_value_t values[CMD_BATCH_MAX];
+} cmd_batch_t;
+
+static esp_channel_t *esp_channels;
+static SemaphoreHandle_t cmd_lock;
+static SemaphoreHandle_t cmd_done;
+static cmd_batch_t *cmd_pending;
+static nvs_ch_state_t *ch_states;
+static SemaphoreHandle_t ch_states_lock;
+static esp_timer_handle_t ch_flush_timer;
+static bool ch_flush_pending;
+static volatile bool ch_flush_due; //set by timer, flushed by supla_esp_dev_iterate()
+static volatile bool dev_iterate_used; //device loop calls supla_esp_dev_iterate()
+static bool ch_journal; //states kept in flash journal instead of NVS
+static supla_esp_nvs_stats_t nvs_stats;
+
 #define CHECK_ARG(VAL)                  \
     do {                                \
         if (!(VAL))                     \
@@ -41,12 +130,125 @@ static char *btox(char *hex, const char *bb, int len)
     return hex;
 }
 
+/* Packed config record: version, ssl, port, guid, auth_key, length prefixed
+ * email and server, CRC-32 of all previous bytes. All fields little endian */
+static size_t config_pack(const struct supla_config *conf, uint8_t *buf)
+{
+    size_t email_len = strnlen(conf->email, SUPLA_EMAIL_MAXSIZE - 1);
+    size_t server_len = strnlen(conf->server, SUPLA_SERVER_NAME_MAXSIZE - 1);
+    uint8_t *p = buf;
+    uint32_t crc;
+
+    *p++ = NVS_CONFIG_VERSION;
+    *p++ = conf->ssl;
+    *p++ = conf->port & 0xFF;
+    *p++ = (conf->port >> 8) & 0xFF;
+    memcpy(p, conf->guid, SUPLA_GUID_SIZE);
+    p += SUPLA_GUID_SIZE;
+    memcpy(p, conf->auth_key, SUPLA_AUTHKEY_SIZE);
+    p += SUPLA_AUTHKEY_SIZE;
+    *p++ = email_len;
+    memcpy(p, conf->email, email_len);
+    p += email_len;
+    *p++ = server_len;
+    memcpy(p, conf->server, server_len);
+    p += server_len;
+
+    crc = supla_crc32(0, buf, p - buf);
+    for (int i = 0; i < 4; i++)
+        *p++ = (crc >> (8 * i)) & 0xFF;
+    return p - buf;
+}
+
+static esp_err_t config_unpack(struct supla_config *conf, const uint8_t *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len - 4;
+    uint32_t crc = 0;
+
+    if (len < NVS_CONFIG_MIN_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+
+    for (int i = 0; i < 4; i++)
+        crc |= (uint32_t)end[i] << (8 * i);
+    if (crc != supla_crc32(0, buf, len - 4))
+        return ESP_ERR_INVALID_CRC;
+    if (*p++ != NVS_CONFIG_VERSION)
+        return ESP_ERR_INVALID_VERSION;
+
+    conf->ssl = *p++;
+    conf->port = p[0] | (p[1] << 8);
+    p += 2;
+    memcpy(conf->guid, p, SUPLA_GUID_SIZE);
+    p += SUPLA_GUID_SIZE;
+    memcpy(conf->auth_key, p, SUPLA_AUTHKEY_SIZE);
+    p += SUPLA_AUTHKEY_SIZE;
+
+    //email length fits u8 and is always below SUPLA_EMAIL_MAXSIZE
+    if (p + 1 + p[0] >= end)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(conf->email, p + 1, p[0]);
+    conf->email[p[0]] = 0;
+    p += 1 + p[0];
+
+    if (p + 1 + p[0] != end || p[0] >= SUPLA_SERVER_NAME_MAXSIZE)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(conf->server, p + 1, p[0]);
+    conf->server[p[0]] = 0;
+    return ESP_OK;
+}
+
+static esp_err_t config_write(nvs_handle nvs, const struct supla_config *conf)
+{
+    uint8_t buf[NVS_CONFIG_MAX_SIZE];
+    esp_err_t rc;
+
+    rc = nvs_set_blob(nvs, NVS_CONFIG_KEY, buf, config_pack(conf, buf));
+    if (rc == ESP_OK)
+        rc = nvs_commit(nvs);
+    return rc;
+}
+
+/* Config stored by older versions, one key per field */
+static bool config_read_legacy(nvs_handle nvs, struct supla_config *supla_conf)
+{
+    size_t required_size;
+    esp_err_t rc;
+
+    required_size = SUPLA_GUID_SIZE;
+    rc = nvs_get_blob(nvs, "guid", supla_conf->guid, &required_size);
+
+    required_size = SUPLA_AUTHKEY_SIZE;
+    nvs_get_blob(nvs, "auth_key", supla_conf->auth_key, &required_size);
+
+    required_size = SUPLA_EMAIL_MAXSIZE;
+    nvs_get_str(nvs, "email", supla_conf->email, &required_size);
+
+    required_size = SUPLA_SERVER_NAME_MAXSIZE;
+    nvs_get_str(nvs, "server", supla_conf->server, &required_size);
+
+    nvs_get_i32(nvs, "port", (int32_t *)&supla_conf->port);
+    nvs_get_i8(nvs, "ssl", (int8_t *)&supla_conf->ssl);
+    return rc == ESP_OK;
+}
+
+static void config_erase_legacy(nvs_handle nvs)
+{
+    static const char *const keys[] = { "guid", "auth_key", "email", "server", "port", "ssl" };
+
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+        nvs_erase_key(nvs, keys[i]);
+}
+
 esp_err_t supla_esp_nvs_config_init(struct supla_config *supla_conf)
 {
     CHECK_ARG(supla_conf);
-    size_t required_size;
+    uint8_t buf[NVS_CONFIG_MAX_SIZE];
+    size_t len = sizeof(buf);
     nvs_handle nvs;
     esp_err_t rc;
+    bool migrate = false;
+    bool update = false;
     const char empty_auth[SUPLA_AUTHKEY_SIZE] = { 0 };
     const char empty_guid[SUPLA_GUID_SIZE] = { 0 };
 
@@ -55,20 +257,14 @@ esp_err_t supla_esp_nvs_config_init(struct supla_config *supla_conf)
 
     rc = nvs_open(NVS_STORAGE, NVS_READONLY, &nvs);
     if (rc == ESP_OK) {
-        required_size = SUPLA_GUID_SIZE;
-        nvs_get_blob(nvs, "guid", supla_conf->guid, &required_size);
-
-        required_size = SUPLA_AUTHKEY_SIZE;
-        nvs_get_blob(nvs, "auth_key", supla_conf->auth_key, &required_size);
-
-        required_size = SUPLA_EMAIL_MAXSIZE;
-        nvs_get_str(nvs, "email", supla_conf->email, &required_size);
-
-        required_size = SUPLA_SERVER_NAME_MAXSIZE;
-        nvs_get_str(nvs, "server", supla_conf->server, &required_size);
-
-        nvs_get_i32(nvs, "port", (int32_t *)&supla_conf->port);
-        nvs_get_i8(nvs, "ssl", (int8_t *)&supla_conf->ssl);
+        rc = nvs_get_blob(nvs, NVS_CONFIG_KEY, buf, &len);
+        if (rc == ESP_OK)
+            rc = config_unpack(supla_conf, buf, len);
+        if (rc != ESP_OK) {
+            if (rc != ESP_ERR_NVS_NOT_FOUND)
+                ESP_LOGW(TAG, "config record invalid %s", esp_err_to_name(rc));
+            migrate = config_read_legacy(nvs, supla_conf);
+        }
         nvs_close(nvs);
     } else {
         ESP_LOGW(TAG, "nvs open error %s", esp_err_to_name(rc));
@@ -76,35 +272,37 @@ esp_err_t supla_esp_nvs_config_init(struct supla_config *supla_conf)
 
     if (!memcmp(supla_conf->auth_key, empty_auth, SUPLA_AUTHKEY_SIZE)) {
         ESP_LOGW(TAG, "AUTHKEY not set, generate now...");
-        rc = nvs_open(NVS_STORAGE, NVS_READWRITE, &nvs);
-        if (rc == ESP_OK) {
-            esp_fill_random(supla_conf->auth_key, SUPLA_AUTHKEY_SIZE);
-            ESP_LOGI(TAG, "generated AUTHKEY");
-            ESP_LOG_BUFFER_HEX(TAG, supla_conf->auth_key, SUPLA_AUTHKEY_SIZE);
-            nvs_set_blob(nvs, "auth_key", supla_conf->auth_key, SUPLA_AUTHKEY_SIZE);
-            nvs_commit(nvs);
-            nvs_close(nvs);
-        } else {
-            ESP_LOGE(TAG, "nvs open error %s", esp_err_to_name(rc));
-        }
+        esp_fill_random(supla_conf->auth_key, SUPLA_AUTHKEY_SIZE);
+        ESP_LOGI(TAG, "generated AUTHKEY");
+        ESP_LOG_BUFFER_HEX(TAG, supla_conf->auth_key, SUPLA_AUTHKEY_SIZE);
+        update = true;
     }
 
     if (!memcmp(supla_conf->guid, empty_guid, SUPLA_GUID_SIZE)) {
         ESP_LOGW(TAG, "GUID not set, generate now...");
-        rc = nvs_open(NVS_STORAGE, NVS_READWRITE, &nvs);
-        if (rc == ESP_OK) {
-            esp_fill_random(supla_conf->guid, SUPLA_GUID_SIZE);
-            ESP_LOGI(TAG, "generated GUID");
-            ESP_LOG_BUFFER_HEX(TAG, supla_conf->guid, SUPLA_GUID_SIZE);
-            nvs_set_blob(nvs, "guid", supla_conf->guid, SUPLA_GUID_SIZE);
+        esp_fill_random(supla_conf->guid, SUPLA_GUID_SIZE);
+        ESP_LOGI(TAG, "generated GUID");
+        ESP_LOG_BUFFER_HEX(TAG, supla_conf->guid, SUPLA_GUID_SIZE);
+        update = true;
+    }
+
+    if (!migrate && !update)
+        return ESP_OK;
+
+    //migrated keys and generated credentials are written as one record
+    rc = nvs_open(NVS_STORAGE, NVS_READWRITE, &nvs);
+    if (rc == ESP_OK) {
+        rc = config_write(nvs, supla_conf);
+        if (rc == ESP_OK && migrate) {
+            config_erase_legacy(nvs);
             nvs_commit(nvs);
-            nvs_close(nvs);
-        } else {
-            ESP_LOGE(TAG, "nvs open error %s", esp_err_to_name(rc));
-            return rc;
+            ESP_LOGI(TAG, "config migrated to packed record");
         }
+        nvs_close(nvs);
     }
-    return ESP_OK;
+    if (rc != ESP_OK)
+        ESP_LOGE(TAG, "nvs config write error %s", esp_err_to_name(rc));
+    return rc;
 }
 
 esp_err_t supla_esp_nvs_config_write(struct supla_config *supla_conf)
@@ -115,18 +313,182 @@ esp_err_t supla_esp_nvs_config_write(struct supla_config *supla_conf)
 
     rc = nvs_open(NVS_STORAGE, NVS_READWRITE, &nvs);
     if (rc == ESP_OK) {
-        nvs_set_blob(nvs, "guid", supla_conf->guid, SUPLA_GUID_SIZE);
-        nvs_set_blob(nvs, "auth_key", supla_conf->auth_key, SUPLA_AUTHKEY_SIZE);
-        nvs_set_str(nvs, "email", supla_conf->email);
-        nvs_set_str(nvs, "server", supla_conf->server);
-        nvs_set_i32(nvs, "port", supla_conf->port);
-        nvs_set_i8(nvs, "ssl", supla_conf->ssl);
-        nvs_commit(nvs);
+        rc = config_write(nvs, supla_conf);
         nvs_close(nvs);
     } else {
         ESP_LOGW(TAG, "nvs open error %s", esp_err_to_name(rc));
+    }
+    return rc;
+}
+
+//like realloc(), contents are not kept
+static nvs_ch_state_t *ch_state_alloc(nvs_ch_state_t *entry, size_t size)
+{
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+    //slot fits the longest state, size change keeps it
+    if (entry)
+        return size <= ch_state_pool.block_size ? entry : NULL;
+    return supla_mem_pool_alloc(&ch_state_pool, size);
+#else
+    return supla_mem_realloc(SUPLA_MEM_CH_STATE, entry, size);
+#endif
+}
+
+static void ch_state_free(nvs_ch_state_t *entry)
+{
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+    supla_mem_pool_free(&ch_state_pool, entry);
+#else
+    supla_mem_free(SUPLA_MEM_CH_STATE, entry);
+#endif
+}
+
+//device of channel added with supla_esp_add_channel(), list is read without lock
+static supla_dev_t *esp_channel_dev(const supla_channel_t *ch)
+{
+    const esp_channel_t *entry;
+
+    for (entry = esp_channels; entry; entry = entry->next) {
+        if (entry->ch == ch)
+            return entry->dev;
+    }
+    return NULL;
+}
+
+/* Channel states are kept in RAM and written to NVS together after
+ * CONFIG_ESP_LIBSUPLA_NVS_FLUSH_DELAY_MS from first change */
+static nvs_ch_state_t *ch_state_get(supla_dev_t *dev, int ch_num, size_t len, bool *created)
+{
+    nvs_ch_state_t **pp, *entry;
+
+    for (pp = &ch_states; *pp; pp = &(*pp)->next) {
+        if ((*pp)->dev == dev && (*pp)->ch_num == ch_num)
+            break;
+    }
+
+    entry = *pp;
+    if (entry && entry->len == len)
+        return entry;
+
+    //new channel or state size changed
+    entry = ch_state_alloc(entry, sizeof(*entry) + 2 * len);
+    if (!entry)
+        return NULL;
+    if (!*pp)
+        entry->next = NULL;
+    *pp = entry;
+
+    entry->dev = dev;
+    entry->dev_id = supla_esp_dev_get_id(dev);
+    if (entry->dev_id < 0)
+        entry->dev_id = 0;
+    entry->ch_num = ch_num;
+    entry->len = len;
+    entry->dirty = false;
+    entry->stored = false;
+    memset(entry->data, 0, 2 * len);
+    *created = true;
+    return entry;
+}
+
+//device 0 keeps keys of single device versions
+static void ch_state_nvs_key(const nvs_ch_state_t *entry, char *key, size_t size)
+{
+    if (entry->dev_id)
+        snprintf(key, size, "d%dch%02d", entry->dev_id, entry->ch_num);
+    else
+        snprintf(key, size, "ch%02d", entry->ch_num);
+}
+
+//states of devices with too high id stay in NVS
+static bool ch_state_in_journal(const nvs_ch_state_t *entry)
+{
+    return ch_journal && entry->dev_id < CH_STATE_JOURNAL_DEVS;
+}
+
+static uint16_t ch_state_journal_id(const nvs_ch_state_t *entry)
+{
+    return entry->dev_id << 8 | (entry->ch_num & 0xFF);
+}
+
+/* Read blob into shadow, done once per channel */
+static void ch_state_load(nvs_ch_state_t *entry)
+{
+    nvs_handle nvs;
+    char nvs_key[CH_STATE_KEY_SIZE];
+    size_t len = entry->len;
+
+    if (ch_state_in_journal(entry) &&
+        supla_journal_restore(ch_state_journal_id(entry), CH_STATE_SHADOW(entry), entry->len) ==
+            0) {
+        nvs_stats.flash_reads++;
+        entry->stored = true;
+        memcpy(entry->data, CH_STATE_SHADOW(entry), entry->len);
+        return;
+    }
+
+    //state stored in NVS is used until channel gets journal record
+    ch_state_nvs_key(entry, nvs_key, sizeof(nvs_key));
+    if (nvs_open(NVS_STORAGE, NVS_READONLY, &nvs) != ESP_OK)
+        return;
+
+    nvs_stats.flash_reads++;
+    entry->stored = nvs_get_blob(nvs, nvs_key, CH_STATE_SHADOW(entry), &len) == ESP_OK &&
+                    len == entry->len;
+    nvs_close(nvs);
+    memcpy(entry->data, CH_STATE_SHADOW(entry), entry->len);
+}
+
+/* Flash write or journal compaction would block other esp_timer callbacks,
+ * flush runs in device task instead. Application iterating with plain
+ * supla_dev_iterate() never flushes, states are written here then */
+static void ch_state_flush_timer_cb(void *arg)
+{
+    if (!dev_iterate_used) {
+        supla_esp_nvs_channel_state_flush();
+        return;
+    }
+    ch_flush_due = true;
+    supla_link_wakeup();
+}
+
+#ifndef CONFIG_IDF_TARGET_ESP8266
+static void ch_state_shutdown_handler(void)
+{
+    supla_esp_nvs_channel_state_flush();
+}
+#endif
+
+static esp_err_t ch_state_cache_init(void)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = ch_state_flush_timer_cb,
+        .name = "supla_nvs_flush" //
+    };
+    esp_err_t rc;
+
+    if (ch_states_lock)
+        return ESP_OK;
+
+    rc = esp_timer_create(&timer_args, &ch_flush_timer);
+    if (rc != ESP_OK)
         return rc;
+
+    ch_states_lock = xSemaphoreCreateMutex();
+    if (!ch_states_lock) {
+        esp_timer_delete(ch_flush_timer);
+        ch_flush_timer = NULL;
+        return ESP_ERR_NO_MEM;
     }
+#ifndef CONFIG_IDF_TARGET_ESP8266
+    //pending states are written on esp_restart()
+    esp_register_shutdown_handler(ch_state_shutdown_handler);
+#endif
+#ifdef CONFIG_ESP_LIBSUPLA_STATE_JOURNAL
+    ch_journal = supla_journal_init() == 0;
+    if (!ch_journal)
+        ESP_LOGW(TAG, "state journal not available, using NVS");
+#endif
     return ESP_OK;
 }
 
@@ -134,32 +496,185 @@ esp_err_t supla_esp_nvs_channel_state_store(supla_channel_t *ch, void *nvs_confi
 {
     CHECK_ARG(ch);
     CHECK_ARG(nvs_config);
-    nvs_handle nvs;
-    char nvs_key[8];
+    nvs_ch_state_t *entry;
+    bool created = false;
+    bool schedule = false;
+    bool changed;
     esp_err_t rc;
-    void *stored;
-    size_t stored_len;
+    supla_dev_t *dev = esp_channel_dev(ch);
     int ch_num = supla_channel_get_assigned_number(ch);
 
-    stored = malloc(len);
-    if (!stored)
+    rc = ch_state_cache_init();
+    if (rc != ESP_OK)
+        return rc;
+
+    xSemaphoreTake(ch_states_lock, portMAX_DELAY);
+    entry = ch_state_get(dev, ch_num, len, &created);
+    if (!entry) {
+        xSemaphoreGive(ch_states_lock);
         return ESP_ERR_NO_MEM;
+    }
+
+    if (created)
+        ch_state_load(entry);
+
+    //state equal to stored one needs no write, even if it changed meanwhile
+    nvs_stats.stores++;
+    if (entry->dirty)
+        nvs_stats.coalesced++;
+    changed = memcmp(entry->data, nvs_config, len) != 0;
+    memcpy(entry->data, nvs_config, len);
+    entry->dirty = !entry->stored || memcmp(entry->data, CH_STATE_SHADOW(entry), len) != 0;
+    if (entry->dirty) {
+        schedule = !ch_flush_pending;
+        ch_flush_pending = true;
+    }
+    xSemaphoreGive(ch_states_lock);
+
+    if (changed)
+        push_channel_state(dev, ch_num, nvs_config, len);
+    if (!schedule)
+        return ESP_OK;
+    if (CONFIG_ESP_LIBSUPLA_NVS_FLUSH_DELAY_MS == 0)
+        return supla_esp_nvs_channel_state_flush();
+    return esp_timer_start_once(ch_flush_timer, CONFIG_ESP_LIBSUPLA_NVS_FLUSH_DELAY_MS * 1000ULL);
+}
+
+//state of channel with unknown device is shown for every device
+static bool ch_state_of(const nvs_ch_state_t *entry, const supla_dev_t *dev)
+{
+    return !entry->dev || entry->dev == dev;
+}
+
+int ch_state_copy(supla_dev_t *dev, int index, int *ch_num, void *buf, size_t size)
+{
+    nvs_ch_state_t *entry;
+    int len = -1;
+
+    if (!ch_states_lock)
+        return -1;
+
+    xSemaphoreTake(ch_states_lock, portMAX_DELAY);
+    for (entry = ch_states; entry; entry = entry->next) {
+        if (ch_state_of(entry, dev) && !index--)
+            break;
+    }
+    if (entry) {
+        *ch_num = entry->ch_num;
+        len = entry->len;
+        if (entry->len <= size)
+            memcpy(buf, entry->data, entry->len);
+    }
+    xSemaphoreGive(ch_states_lock);
+    return len;
+}
+
+//called with lock held
+static bool ch_state_dirty(void)
+{
+    nvs_ch_state_t *entry;
+
+    for (entry = ch_states; entry && !entry->dirty; entry = entry->next) {
+    }
+    return entry != NULL;
+}
+
+static void ch_state_written(nvs_ch_state_t *entry)
+{
+    memcpy(CH_STATE_SHADOW(entry), entry->data, entry->len);
+    entry->stored = true;
+    entry->dirty = false;
+    nvs_stats.blob_writes++;
+}
+
+//all dirty channels go in one NVS transaction
+static esp_err_t ch_state_write_nvs(void)
+{
+    nvs_handle nvs;
+    nvs_ch_state_t *entry;
+    char nvs_key[CH_STATE_KEY_SIZE];
+    esp_err_t rc;
+    int written = 0;
 
-    snprintf(nvs_key, sizeof(nvs_key), "ch%02d", ch_num);
     rc = nvs_open(NVS_STORAGE, NVS_READWRITE, &nvs);
-    if (rc == ESP_OK) {
-        //compare data and store if different
-        nvs_get_blob(nvs, nvs_key, stored, &stored_len);
-        if (memcmp(nvs_config, stored, len) != 0) {
-            nvs_set_blob(nvs, nvs_key, nvs_config, len);
-            nvs_commit(nvs);
-            ESP_LOGI(TAG, "ch[%d] config stored to NVS", ch_num);
-        }
-        nvs_close(nvs);
-    } else {
+    if (rc != ESP_OK) {
         supla_log(LOG_ERR, "nvs open error %s", esp_err_to_name(rc));
+        return rc;
+    }
+
+    for (entry = ch_states; entry; entry = entry->next) {
+        if (!entry->dirty)
+            continue;
+
+        ch_state_nvs_key(entry, nvs_key, sizeof(nvs_key));
+        rc = nvs_set_blob(nvs, nvs_key, entry->data, entry->len);
+        if (rc != ESP_OK) {
+            ESP_LOGE(TAG, "ch[%d] state write ERR:%s", entry->ch_num, esp_err_to_name(rc));
+            break;
+        }
+        ch_state_written(entry);
+        written++;
+    }
+    if (written) {
+        nvs_commit(nvs);
+        nvs_stats.commits++;
+        ESP_LOGI(TAG, "%d channel states stored to NVS", written);
     }
-    free(stored);
+    nvs_close(nvs);
+    return rc;
+}
+
+static esp_err_t ch_state_write_journal(void)
+{
+    nvs_ch_state_t *entry;
+    int written = 0;
+
+    for (entry = ch_states; entry; entry = entry->next) {
+        if (!entry->dirty || !ch_state_in_journal(entry))
+            continue;
+
+        if (supla_journal_store(ch_state_journal_id(entry), entry->data, entry->len) != 0) {
+            ESP_LOGE(TAG, "ch[%d] state journal write failed", entry->ch_num);
+            return ESP_FAIL;
+        }
+        ch_state_written(entry);
+        written++;
+    }
+    ESP_LOGD(TAG, "%d channel states stored to journal", written);
+    return ESP_OK;
+}
+
+esp_err_t supla_esp_nvs_channel_state_flush(void)
+{
+    esp_err_t rc;
+    bool retry = false;
+
+    if (!ch_states_lock)
+        return ESP_OK;
+
+    xSemaphoreTake(ch_states_lock, portMAX_DELAY);
+    esp_timer_stop(ch_flush_timer);
+    ch_flush_pending = false;
+    ch_flush_due = false;
+    if (!ch_state_dirty()) {
+        xSemaphoreGive(ch_states_lock);
+        return ESP_OK;
+    }
+
+    //states that can not be kept in journal go to NVS
+    rc = ch_journal ? ch_state_write_journal() : ESP_OK;
+    if (rc == ESP_OK && ch_state_dirty())
+        rc = ch_state_write_nvs();
+
+    //failed writes are retried after next delay
+    if (rc != ESP_OK && CONFIG_ESP_LIBSUPLA_NVS_FLUSH_DELAY_MS > 0) {
+        ch_flush_pending = true;
+        retry = true;
+    }
+    xSemaphoreGive(ch_states_lock);
+
+    if (retry)
+        esp_timer_start_once(ch_flush_timer, CONFIG_ESP_LIBSUPLA_NVS_FLUSH_DELAY_MS * 1000ULL);
     return rc;
 }
 
@@ -167,21 +682,39 @@ esp_err_t supla_esp_nvs_channel_state_restore(supla_channel_t *ch, void *nvs_con
 {
     CHECK_ARG(ch);
     CHECK_ARG(nvs_config);
-    nvs_handle nvs;
-    char nvs_key[8];
+    nvs_ch_state_t *entry;
+    bool created = false;
     esp_err_t rc;
+    supla_dev_t *dev = esp_channel_dev(ch);
     int ch_num = supla_channel_get_assigned_number(ch);
 
-    snprintf(nvs_key, sizeof(nvs_key), "ch%02d", ch_num);
-    rc = nvs_open(NVS_STORAGE, NVS_READONLY, &nvs);
-    if (rc == ESP_OK) {
-        nvs_get_blob(nvs, nvs_key, nvs_config, &len);
-        nvs_close(nvs);
-    } else {
-        supla_log(LOG_ERR, "nvs open error %s", esp_err_to_name(rc));
+    rc = ch_state_cache_init();
+    if (rc != ESP_OK)
         return rc;
+
+    //blob is read once, later restores and stores use RAM copy
+    xSemaphoreTake(ch_states_lock, portMAX_DELAY);
+    entry = ch_state_get(dev, ch_num, len, &created);
+    if (!entry) {
+        xSemaphoreGive(ch_states_lock);
+        return ESP_ERR_NO_MEM;
     }
-    ESP_LOGI(TAG, "ch[%d] config restored from NVS", ch_num);
+    if (created)
+        ch_state_load(entry);
+    if (entry->stored || entry->dirty)
+        memcpy(nvs_config, entry->data, len);
+    xSemaphoreGive(ch_states_lock);
+
+    if (created)
+        ESP_LOGI(TAG, "ch[%d] config restored from NVS", ch_num);
+    return ESP_OK;
+}
+
+esp_err_t supla_esp_nvs_get_stats(supla_esp_nvs_stats_t *stats)
+{
+    CHECK_ARG(stats);
+
+    *stats = nvs_stats;
     return ESP_OK;
 }
 
@@ -189,6 +722,23 @@ esp_err_t supla_esp_nvs_data_erase(void)
 {
     nvs_handle nvs;
     esp_err_t rc;
+
+    //drop pending channel states so they are not written back
+    if (ch_states_lock) {
+        xSemaphoreTake(ch_states_lock, portMAX_DELAY);
+        esp_timer_stop(ch_flush_timer);
+        while (ch_states) {
+            nvs_ch_state_t *next = ch_states->next;
+            ch_state_free(ch_states);
+            ch_states = next;
+        }
+        ch_flush_pending = false;
+        ch_flush_due = false;
+        if (ch_journal)
+            supla_journal_erase();
+        xSemaphoreGive(ch_states_lock);
+    }
+
     rc = nvs_open(NVS_STORAGE, NVS_READWRITE, &nvs);
     if (rc == ESP_OK) {
         nvs_erase_all(nvs);
@@ -199,6 +749,91 @@ esp_err_t supla_esp_nvs_data_erase(void)
     return rc;
 }
 
+static esp_channel_t *esp_channel_alloc(void)
+{
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+    return supla_mem_pool_alloc(&channel_pool, sizeof(esp_channel_t));
+#else
+    return supla_mem_calloc(SUPLA_MEM_CHANNELS, 1, sizeof(esp_channel_t));
+#endif
+}
+
+static void esp_channel_free(esp_channel_t *entry)
+{
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+    supla_mem_pool_free(&channel_pool, entry);
+#else
+    supla_mem_free(SUPLA_MEM_CHANNELS, entry);
+#endif
+}
+
+esp_err_t supla_esp_add_channel(supla_dev_t *dev, supla_channel_t *ch,
+                                const supla_channel_config_t *config)
+{
+    CHECK_ARG(dev);
+    CHECK_ARG(ch);
+    CHECK_ARG(config);
+    esp_channel_t *entry, **pp;
+
+    entry = esp_channel_alloc();
+    if (!entry)
+        return ESP_ERR_NO_MEM;
+
+    if (supla_dev_add_channel(dev, ch) != SUPLA_RESULT_TRUE) {
+        esp_channel_free(entry);
+        return ESP_FAIL;
+    }
+
+    entry->dev = dev;
+    entry->ch = ch;
+    entry->config = config;
+    //entry is complete before it is linked, list is read without lock
+    for (pp = &esp_channels; *pp; pp = &(*pp)->next)
+        ;
+    *pp = entry;
+    return ESP_OK;
+}
+
+static esp_channel_t *esp_channel_find(supla_dev_t *dev, int ch_num)
+{
+    esp_channel_t *entry;
+
+    for (entry = esp_channels; entry; entry = entry->next) {
+        if (entry->dev == dev && supla_channel_get_assigned_number(entry->ch) == ch_num)
+            return entry;
+    }
+    return NULL;
+}
+
+/* Apply posted channel values before the device iteration, so all changes
+ * are reported to server together */
+int supla_esp_dev_iterate(supla_dev_t *dev)
+{
+    TSD_SuplaChannelNewValue new_value;
+    cmd_value_t *v;
+
+    dev_iterate_used = true;
+    if (ch_flush_due)
+        supla_esp_nvs_channel_state_flush();
+
+    if (cmd_lock) {
+        xSemaphoreTake(cmd_lock, portMAX_DELAY);
+        if (cmd_pending && cmd_pending->dev == dev) {
+            for (int i = 0; i < cmd_pending->count; i++) {
+                v = &cmd_pending->values[i];
+                memset(&new_value, 0, sizeof(new_value));
+                new_value.ChannelNumber = supla_channel_get_assigned_number(v->entry->ch);
+                memcpy(new_value.value, v->value, sizeof(new_value.value));
+                v->result = v->entry->config->on_set_value(v->entry->ch, &new_value);
+            }
+            cmd_pending = NULL;
+            xSemaphoreGive(cmd_done);
+        }
+        xSemaphoreGive(cmd_lock);
+    }
+    return supla_dev_iterate(dev);
+}
+
 esp_err_t supla_esp_generate_hostname(const supla_dev_t *dev, char *buf, size_t len)
 {
     CHECK_ARG(dev);
@@ -283,35 +918,27 @@ int supla_esp_server_time_sync(supla_dev_t *dev, TSDC_UserLocalTimeResult *lt)
 int supla_esp_restart_callback(supla_dev_t *dev)
 {
     CHECK_ARG(dev);
+    supla_esp_nvs_channel_state_flush();
     esp_restart();
     return ESP_OK;
 }
 
-static esp_err_t send_json_response(cJSON *js, httpd_req_t *req)
+static esp_err_t send_json_response(json_writer_t *js)
 {
-    CHECK_ARG(js);
-    CHECK_ARG(req);
-
-    char *js_txt = cJSON_Print(js);
-    cJSON_Delete(js);
-
-    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
-    httpd_resp_send(req, js_txt, -1);
-    free(js_txt);
-    return ESP_OK;
+    json_obj_end(js);
+    return json_writer_finish(js);
 }
 
-static cJSON *json_error(int code, const char *title)
+static void json_error(json_writer_t *js, int code, const char *title)
 {
-    cJSON *js_err = cJSON_CreateObject();
-    cJSON_AddNumberToObject(js_err, "code", code);
-    cJSON_AddItemToObject(js_err, "title", cJSON_CreateString(title));
-    return js_err;
+    json_obj_begin(js, "error");
+    json_int(js, "code", code);
+    json_str(js, "title", title);
+    json_obj_end(js);
 }
 
-static cJSON *supla_dev_state_to_json(supla_dev_t *dev)
+static void supla_dev_state_to_json(json_writer_t *js, const char *key, supla_dev_t *dev)
 {
-    cJSON *js;
     supla_dev_state_t state;
     char guid_hex[SUPLA_GUID_HEXSIZE];
     struct supla_config config;
@@ -321,7 +948,7 @@ static cJSON *supla_dev_state_to_json(supla_dev_t *dev)
     char soft_ver[SUPLA_DEVICE_NAME_MAXSIZE];
 
     if (!dev)
-        return NULL;
+        return;
 
     supla_dev_get_name(dev, name, sizeof(name));
     supla_dev_get_software_version(dev, soft_ver, sizeof(soft_ver));
@@ -331,82 +958,305 @@ static cJSON *supla_dev_state_to_json(supla_dev_t *dev)
     supla_dev_get_uptime(dev, &uptime);
     supla_dev_get_connection_uptime(dev, &conn_uptime);
 
-    js = cJSON_CreateObject();
-    cJSON_AddStringToObject(js, "name", name);
-    cJSON_AddStringToObject(js, "software_ver", soft_ver);
-    cJSON_AddStringToObject(js, "guid", btox(guid_hex, config.guid, sizeof(config.guid)));
-    cJSON_AddStringToObject(js, "state", supla_dev_state_str(state));
-    cJSON_AddNumberToObject(js, "uptime", (int)uptime);
-    cJSON_AddNumberToObject(js, "connection_uptime", (int)conn_uptime);
-    return js;
+    json_obj_begin(js, key);
+    json_str(js, "name", name);
+    json_str(js, "software_ver", soft_ver);
+    json_str(js, "guid", btox(guid_hex, config.guid, sizeof(config.guid)));
+    json_str(js, "state", supla_dev_state_str(state));
+    json_int(js, "uptime", (int)uptime);
+    json_int(js, "connection_uptime", (int)conn_uptime);
+    json_obj_end(js);
 }
 
-static cJSON *supla_dev_config_to_json(supla_dev_t *dev)
+static void supla_channel_to_json(json_writer_t *js, const esp_channel_t *entry)
+{
+    char hex[2 * CHANNELS_STATE_MAX + 1];
+    const char xx[] = "0123456789abcdef";
+    int ch_num = supla_channel_get_assigned_number(entry->ch);
+    nvs_ch_state_t *state;
+    bool has_state = false;
+
+    //channel value as last stored state, copied out so no lock is held while sending
+    if (ch_states_lock) {
+        xSemaphoreTake(ch_states_lock, portMAX_DELAY);
+        for (state = ch_states; state; state = state->next) {
+            if (state->dev != entry->dev || state->ch_num != ch_num ||
+                state->len > CHANNELS_STATE_MAX)
+                continue;
+            for (size_t i = 0; i < state->len; i++) {
+                hex[2 * i] = xx[state->data[i] >> 4];
+                hex[2 * i + 1] = xx[state->data[i] & 0x0F];
+            }
+            hex[2 * state->len] = '\0';
+            has_state = true;
+            break;
+        }
+        xSemaphoreGive(ch_states_lock);
+    }
+
+    json_obj_begin(js, NULL);
+    json_int(js, "number", ch_num);
+    json_int(js, "type", entry->config->type);
+    json_int(js, "default_function", entry->config->default_function);
+    if (has_state)
+        json_str(js, "state", hex);
+    json_obj_end(js);
+}
+
+/* Channels are written one by one, response size is bound by limit and
+ * memory use does not depend on channel count */
+static void supla_channels_to_json(json_writer_t *js, const char *key, supla_dev_t *dev,
+                                   int offset, int limit)
+{
+    const esp_channel_t *entry;
+    int total = 0;
+
+    if (offset < 0)
+        offset = 0;
+    if (limit <= 0 || limit > CHANNELS_PAGE_MAX)
+        limit = CHANNELS_PAGE_MAX;
+
+    for (entry = esp_channels; entry; entry = entry->next)
+        total += entry->dev == dev;
+
+    json_obj_begin(js, key);
+    json_int(js, "total", total);
+    json_int(js, "offset", offset);
+    json_int(js, "limit", limit);
+    json_arr_begin(js, "channels");
+    for (entry = esp_channels; entry && limit > 0; entry = entry->next) {
+        if (entry->dev != dev)
+            continue;
+        if (offset > 0) {
+            offset--;
+            continue;
+        }
+        supla_channel_to_json(js, entry);
+        limit--;
+    }
+    json_arr_end(js);
+    json_obj_end(js);
+}
+
+static void supla_dev_config_to_json(json_writer_t *js, const char *key, supla_dev_t *dev)
 {
-    cJSON *js;
     struct supla_config conf;
     char guid_hex[SUPLA_GUID_HEXSIZE];
     char auth_hex[SUPLA_AUTHKEY_HEXSIZE];
 
     if (!dev)
-        return NULL;
+        return;
 
     supla_dev_get_config(dev, &conf);
 
-    js = cJSON_CreateObject();
-    cJSON_AddStringToObject(js, "email", conf.email);
-    cJSON_AddStringToObject(js, "server", conf.server);
-    cJSON_AddStringToObject(js, "guid", btox(guid_hex, conf.guid, sizeof(conf.guid)));
-    cJSON_AddStringToObject(js, "auth_key", btox(auth_hex, conf.auth_key, sizeof(conf.auth_key)));
-    cJSON_AddNumberToObject(js, "port", conf.port);
+    json_obj_begin(js, key);
+    json_str(js, "email", conf.email);
+    json_str(js, "server", conf.server);
+    json_str(js, "guid", btox(guid_hex, conf.guid, sizeof(conf.guid)));
+    json_str(js, "auth_key", btox(auth_hex, conf.auth_key, sizeof(conf.auth_key)));
+    json_int(js, "port", conf.port);
 #ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
-    cJSON_AddBoolToObject(js, "ssl", conf.ssl);
+    json_bool(js, "ssl", conf.ssl);
 #endif
-    return js;
+    json_obj_end(js);
 }
 
-static esp_err_t supla_dev_post_config(supla_dev_t *dev, httpd_req_t *req)
+static void supla_link_hist_to_json(json_writer_t *js, const char *key,
+                                    const supla_link_hist_t *hist)
 {
-    struct supla_config config;
-    char *req_data;
-    char value[128];
-    int bytes_recv = 0;
-    int rc;
+    json_obj_begin(js, key);
+    json_int(js, "count", hist->count);
+    json_int(js, "sum_ms", hist->sum_ms);
+    json_int(js, "max_ms", hist->max_ms);
+    json_arr_begin(js, "buckets");
+    for (int i = 0; i < SUPLA_LINK_HIST_BUCKETS; i++)
+        json_int(js, NULL, hist->bucket[i]);
+    json_arr_end(js);
+    json_obj_end(js);
+}
 
-    supla_dev_get_config(dev, &config);
-    if (req->content_len) {
-        req_data = calloc(1, req->content_len + 1);
-        if (!req_data)
-            return ESP_ERR_NO_MEM;
-
-        for (int bytes_left = req->content_len; bytes_left > 0;) {
-            if ((rc = httpd_req_recv(req, req_data + bytes_recv, bytes_left)) <= 0) {
-                if (rc == HTTPD_SOCK_ERR_TIMEOUT)
-                    continue;
-                else
-                    return ESP_FAIL;
-            }
-            bytes_recv += rc;
-            bytes_left -= rc;
-        }
+static void supla_link_metrics_to_json(json_writer_t *js)
+{
+    static const int bounds[] = SUPLA_LINK_HIST_BOUNDS_MS;
+    supla_link_stats_t stats;
+    supla_link_metrics_t metrics;
+
+    supla_link_get_stats(&stats);
+
+    json_arr_begin(js, "hist_bounds_ms");
+    for (size_t i = 0; i < sizeof(bounds) / sizeof(bounds[0]); i++)
+        json_int(js, NULL, bounds[i]);
+    json_arr_end(js);
+    json_int(js, "connect_attempts", stats.connect_attempts);
+    json_int(js, "connect_failures", stats.connect_failures);
+    json_int(js, "connect_last_error", stats.connect_last_error);
+    json_int(js, "reconnect_delay_ms", stats.reconnect_delay_ms);
+    json_int(js, "tls_handshakes", stats.tls_handshakes);
+    json_int(js, "tls_resumed", stats.tls_resumed);
+    json_int(js, "dns_lookups", stats.dns_lookups);
+    json_int(js, "dns_cache_hits", stats.dns_cache_hits);
+    supla_link_hist_to_json(js, "connect_ms", &stats.connect_hist);
+
+    json_arr_begin(js, "links");
+    for (int i = 0; supla_link_get_metrics(i, &metrics) == 0; i++) {
+        json_obj_begin(js, NULL);
+        json_str(js, "host", metrics.host);
+        json_int(js, "port", metrics.port);
+        json_bool(js, "tls", metrics.tls);
+        json_bool(js, "ready", metrics.ready);
+        json_int(js, "uptime_ms", metrics.uptime_ms);
+        json_int(js, "connect_attempts", metrics.connect_attempts);
+        json_int(js, "connect_failures", metrics.connect_failures);
+        json_int(js, "connect_last_error", metrics.connect_last_error);
+        json_int(js, "reconnect_delay_ms", metrics.reconnect_delay_ms);
+        json_int(js, "tx_frames", metrics.tx_frames);
+        json_int(js, "tx_bytes", metrics.tx_bytes);
+        json_int(js, "tx_errors", metrics.tx_errors);
+        json_int(js, "tx_stalls", metrics.tx_stalls);
+        json_int(js, "rx_reads", metrics.rx_reads);
+        json_int(js, "rx_bytes", metrics.rx_bytes);
+        json_int(js, "rx_errors", metrics.rx_errors);
+        json_int(js, "tls_want_read", metrics.tls_want_read);
+        json_int(js, "tls_want_write", metrics.tls_want_write);
+        supla_link_hist_to_json(js, "rtt_ms", &metrics.rtt);
+        json_obj_end(js);
+    }
+    json_arr_end(js);
+}
+
+static void supla_nvs_stats_to_json(json_writer_t *js, const char *key)
+{
+    supla_esp_nvs_stats_t stats;
+
+    supla_esp_nvs_get_stats(&stats);
+    json_obj_begin(js, key);
+    json_int(js, "stores", stats.stores);
+    json_int(js, "flash_reads", stats.flash_reads);
+    json_int(js, "coalesced", stats.coalesced);
+    json_int(js, "blob_writes", stats.blob_writes);
+    json_int(js, "commits", stats.commits);
+    json_obj_end(js);
+}
 
-        if (httpd_query_key_value(req_data, "email", value, sizeof(value)) == ESP_OK)
-            strncpy(config.email, value, sizeof(config.email));
+static void supla_registry_stats_to_json(json_writer_t *js, const char *key)
+{
+    supla_esp_registry_stats_t stats;
+
+    supla_esp_dev_registry_get_stats(&stats);
+    json_obj_begin(js, key);
+    json_int(js, "devices", stats.devices);
+    json_int(js, "capacity", stats.capacity);
+    json_int(js, "bytes", stats.bytes);
+    json_obj_end(js);
+}
 
-        if (httpd_query_key_value(req_data, "server", value, sizeof(value)) == ESP_OK)
-            strncpy(config.server, value, sizeof(config.server));
+static void supla_journal_stats_to_json(json_writer_t *js, const char *key)
+{
+    supla_journal_stats_t stats;
+
+    supla_journal_get_stats(&stats);
+    json_obj_begin(js, key);
+    json_int(js, "sectors", stats.sectors);
+    json_int(js, "records", stats.records);
+    json_int(js, "appends", stats.appends);
+    json_int(js, "append_bytes", stats.append_bytes);
+    json_int(js, "relocated", stats.relocated);
+    json_int(js, "erases", stats.erases);
+    json_int(js, "torn", stats.torn);
+    json_int(js, "lost", stats.lost);
+    json_int(js, "recovery_ms", stats.recovery_ms);
+    json_obj_end(js);
+}
 
-        config.ssl = 0;
+static void supla_mem_stats_to_json(json_writer_t *js, const char *key)
+{
+    supla_mem_stats_t stats;
+
+    json_obj_begin(js, key);
+    json_obj_begin(js, "heap");
+    json_int(js, "free", esp_get_free_heap_size());
+    json_int(js, "min_free", esp_get_minimum_free_heap_size());
+#ifndef CONFIG_IDF_TARGET_ESP8266
+    json_int(js, "largest_free_block", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+#endif
+    json_obj_end(js);
+    for (int tag = 0; supla_mem_get_stats(tag, &stats) == 0; tag++) {
+        json_obj_begin(js, supla_mem_tag_str(tag));
+        json_int(js, "bytes", stats.bytes);
+        json_int(js, "peak", stats.peak);
+        json_int(js, "count", stats.count);
+        json_int(js, "allocs", stats.allocs);
+        json_int(js, "failed", stats.failed);
+        json_obj_end(js);
+    }
+    json_obj_end(js);
+}
+
+void supla_esp_mem_log(void)
+{
+    supla_mem_stats_t stats;
+
+    ESP_LOGI(TAG, "heap: free=%u min_free=%u", (unsigned)esp_get_free_heap_size(),
+             (unsigned)esp_get_minimum_free_heap_size());
+    for (int tag = 0; supla_mem_get_stats(tag, &stats) == 0; tag++) {
+        if (!stats.allocs && !stats.failed)
+            continue;
+        ESP_LOGI(TAG, "heap %s: bytes=%u peak=%u count=%u allocs=%u failed=%u",
+                 supla_mem_tag_str(tag), stats.bytes, stats.peak, stats.count, stats.allocs,
+                 stats.failed);
+    }
+}
+
+static void post_email(void *arg, const char *value)
+{
+    struct supla_config *config = arg;
+    strncpy(config->email, value, sizeof(config->email));
+}
+
+static void post_server(void *arg, const char *value)
+{
+    struct supla_config *config = arg;
+    strncpy(config->server, value, sizeof(config->server));
+}
+
+#ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
+static void post_ssl(void *arg, const char *value)
+{
+    struct supla_config *config = arg;
+    config->ssl = !strcmp("on", value);
+}
+#endif
+
+static void post_port(void *arg, const char *value)
+{
+    struct supla_config *config = arg;
+    config->port = atoi(value);
+}
+
+static const form_field_t config_post_fields[] = {
+    { "email", post_email },
+    { "server", post_server },
 #ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
-        config.ssl = false;
-        if (httpd_query_key_value(req_data, "ssl", value, sizeof(value)) == ESP_OK)
-            config.ssl = !strcmp("on", value);
+    { "ssl", post_ssl },
 #endif
+    { "port", post_port },
+};
 
-        if (httpd_query_key_value(req_data, "port", value, sizeof(value)) == ESP_OK)
-            config.port = atoi(value);
+static esp_err_t supla_dev_post_config(supla_dev_t *dev, httpd_req_t *req)
+{
+    struct supla_config config;
+    int rc;
 
-        free(req_data);
+    supla_dev_get_config(dev, &config);
+    if (req->content_len) {
+        //unchecked checkbox is not posted
+        config.ssl = 0;
+        rc = form_parse(req, config_post_fields,
+                        sizeof(config_post_fields) / sizeof(config_post_fields[0]), &config);
+        if (rc != ESP_OK) {
+            ESP_LOGE(TAG, "post req ERR:%s(%d)", esp_err_to_name(rc), rc);
+            return rc;
+        }
     }
 
     rc = supla_esp_nvs_config_write(&config);
@@ -421,6 +1271,138 @@ static esp_err_t supla_dev_post_config(supla_dev_t *dev, httpd_req_t *req)
     }
 }
 
+static void cmd_post_channel(void *arg, const char *value)
+{
+    cmd_batch_t *batch = arg;
+    char *end;
+
+    batch->ch_num = strtol(value, &end, 10);
+    if (end == value || *end)
+        batch->ch_num = -1;
+}
+
+//hex value, shorter than channel value is padded with zeros
+static void cmd_post_value(void *arg, const char *value)
+{
+    cmd_batch_t *batch = arg;
+    size_t len = strlen(value);
+    cmd_value_t *v;
+    int hi, lo;
+
+    if (batch->err != ESP_OK)
+        return;
+    if (batch->count == CMD_BATCH_MAX) {
+        batch->err = ESP_ERR_INVALID_SIZE;
+        return;
+    }
+
+    v = &batch->values[batch->count];
+    v->entry = esp_channel_find(batch->dev, batch->ch_num);
+    if (!v->entry || !v->entry->config->on_set_value) {
+        batch->err = ESP_ERR_NOT_FOUND;
+        return;
+    }
+    if (len % 2 || len > 2 * sizeof(v->value)) {
+        batch->err = ESP_ERR_INVALID_ARG;
+        return;
+    }
+
+    memset(v->value, 0, sizeof(v->value));
+    for (size_t i = 0; i < len / 2; i++) {
+        hi = form_hex_val(value[2 * i]);
+        lo = form_hex_val(value[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            batch->err = ESP_ERR_INVALID_ARG;
+            return;
+        }
+        v->value[i] = (hi << 4) | lo;
+    }
+    batch->ch_num = -1;
+    batch->count++;
+}
+
+static const form_field_t cmd_post_fields[] = {
+    { "ch", cmd_post_channel },
+    { "value", cmd_post_value },
+};
+
+static esp_err_t cmd_init(void)
+{
+    if (cmd_lock)
+        return ESP_OK;
+
+    cmd_done = xSemaphoreCreateBinary();
+    if (!cmd_done)
+        return ESP_ERR_NO_MEM;
+    cmd_lock = xSemaphoreCreateMutex();
+    if (!cmd_lock) {
+        vSemaphoreDelete(cmd_done);
+        cmd_done = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* Whole batch is checked before any value is applied. It is then handed to
+ * the task calling supla_esp_dev_iterate() and applied in one pass */
+static esp_err_t supla_dev_set_values(supla_dev_t *dev, httpd_req_t *req, cmd_batch_t *batch)
+{
+    bool applied;
+    int rc;
+
+    //channels are switched only on POST, never by link prefetch or crawler GET
+    if (req->method != HTTP_POST)
+        return ESP_ERR_NOT_SUPPORTED;
+
+    batch->dev = dev;
+    batch->err = ESP_OK;
+    batch->ch_num = -1;
+    batch->count = 0;
+
+    rc = form_parse(req, cmd_post_fields, sizeof(cmd_post_fields) / sizeof(cmd_post_fields[0]),
+                    batch);
+    if (rc == ESP_OK)
+        rc = batch->err;
+    if (rc != ESP_OK || !batch->count)
+        return rc;
+
+    rc = cmd_init();
+    if (rc != ESP_OK)
+        return rc;
+
+    xSemaphoreTake(cmd_lock, portMAX_DELAY);
+    cmd_pending = batch;
+    xSemaphoreGive(cmd_lock);
+    supla_link_wakeup();
+
+    applied = xSemaphoreTake(cmd_done, pdMS_TO_TICKS(CMD_APPLY_TIMEOUT_MS)) == pdTRUE;
+    if (!applied) {
+        xSemaphoreTake(cmd_lock, portMAX_DELAY);
+        applied = cmd_pending != batch;
+        cmd_pending = NULL;
+        xSemaphoreGive(cmd_lock);
+        //applied just after timeout, consume its signal
+        if (applied)
+            xSemaphoreTake(cmd_done, portMAX_DELAY);
+    }
+    return applied ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static void cmd_batch_to_json(json_writer_t *js, const char *key, const cmd_batch_t *batch)
+{
+    json_obj_begin(js, key);
+    json_int(js, "applied", batch->count);
+    json_arr_begin(js, "results");
+    for (int i = 0; i < batch->count; i++) {
+        json_obj_begin(js, NULL);
+        json_int(js, "number", supla_channel_get_assigned_number(batch->values[i].entry->ch));
+        json_int(js, "result", batch->values[i].result);
+        json_obj_end(js);
+    }
+    json_arr_end(js);
+    json_obj_end(js);
+}
+
 static esp_err_t supla_dev_erase_config(supla_dev_t *dev)
 {
     struct supla_config config = { 0 };
@@ -443,40 +1425,70 @@ static esp_err_t supla_dev_erase_config(supla_dev_t *dev)
 esp_err_t supla_dev_httpd_handler(httpd_req_t *req)
 {
     CHECK_ARG(req);
-    cJSON *js;
-    char *url_query;
-    size_t qlen;
+    json_writer_t js;
+    char url_query[URL_QUERY_MAXSIZE];
     char value[128];
     supla_dev_t *dev;
+    esp_err_t rc;
 
-    js = cJSON_CreateObject();
+    //response is streamed from stack buffer, no heap used
+    json_writer_init(&js, req);
+    json_obj_begin(&js, NULL);
     if (!req->user_ctx) {
-        cJSON_AddItemToObject(js, "error",
-                              json_error(ESP_ERR_NOT_FOUND, esp_err_to_name(ESP_ERR_NOT_FOUND)));
-        return send_json_response(js, req);
+        json_error(&js, ESP_ERR_NOT_FOUND, esp_err_to_name(ESP_ERR_NOT_FOUND));
+        return send_json_response(&js);
     }
 
     dev = *(supla_dev_t **)req->user_ctx;
-    //parse URL query
-    qlen = httpd_req_get_url_query_len(req) + 1;
-    if (qlen > 1) {
-        url_query = malloc(qlen);
-        if (httpd_req_get_url_query_str(req, url_query, qlen) == ESP_OK) {
+    //parse URL query, invalid one is ignored
+    if (httpd_req_get_url_query_len(req)) {
+        rc = httpd_req_get_url_query_str(req, url_query, sizeof(url_query));
+        if (rc == ESP_ERR_HTTPD_RESULT_TRUNC) {
+            json_error(&js, ESP_ERR_INVALID_SIZE, esp_err_to_name(ESP_ERR_INVALID_SIZE));
+            return send_json_response(&js);
+        }
+        if (rc == ESP_OK) {
             if (httpd_query_key_value(url_query, "action", value, sizeof(value)) == ESP_OK) {
                 if (!strcmp(value, "get_config")) {
-                    cJSON_AddItemToObject(js, "data", supla_dev_config_to_json(dev));
+                    supla_dev_config_to_json(&js, "data", dev);
                 } else if (!strcmp(value, "set_config")) {
                     supla_dev_post_config(dev, req);
-                    cJSON_AddItemToObject(js, "data", supla_dev_config_to_json(dev));
+                    supla_dev_config_to_json(&js, "data", dev);
                 } else if (!strcmp(value, "erase_config")) {
                     supla_dev_erase_config(dev);
-                    cJSON_AddItemToObject(js, "data", supla_dev_config_to_json(dev));
+                    supla_dev_config_to_json(&js, "data", dev);
+                } else if (!strcmp(value, "channels")) {
+                    int offset = 0;
+                    int limit = 0;
+
+                    if (httpd_query_key_value(url_query, "offset", value, sizeof(value)) == ESP_OK)
+                        offset = atoi(value);
+                    if (httpd_query_key_value(url_query, "limit", value, sizeof(value)) == ESP_OK)
+                        limit = atoi(value);
+                    supla_channels_to_json(&js, "data", dev, offset, limit);
+                } else if (!strcmp(value, "set_values")) {
+                    cmd_batch_t batch;
+
+                    rc = supla_dev_set_values(dev, req, &batch);
+                    if (rc == ESP_OK)
+                        cmd_batch_to_json(&js, "data", &batch);
+                    else
+                        json_error(&js, rc, esp_err_to_name(rc));
+                } else if (!strcmp(value, "metrics")) {
+                    json_obj_begin(&js, "data");
+                    supla_link_metrics_to_json(&js);
+                    supla_nvs_stats_to_json(&js, "nvs");
+                    supla_registry_stats_to_json(&js, "registry");
+                    if (ch_journal)
+                        supla_journal_stats_to_json(&js, "journal");
+                    json_obj_end(&js);
+                } else if (!strcmp(value, "memory")) {
+                    supla_mem_stats_to_json(&js, "data");
                 }
             }
         }
-        free(url_query);
     } else {
-        cJSON_AddItemToObject(js, "data", supla_dev_state_to_json(dev));
+        supla_dev_state_to_json(&js, "data", dev);
     }
-    return send_json_response(js, req);
+    return send_json_response(&js);
 }
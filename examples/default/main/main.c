@@ -27,7 +27,8 @@
 #define LED_PIN GPIO_NUM_27
 #endif
 
-static const char *TAG = "APP";
+//max sleep between supla_dev_iterate() calls when link is idle
+#define SUPLA_ITERATE_INTERVAL_MS 100
 
 static struct supla_config supla_config = {
     .email = CONFIG_SUPLA_EMAIL,
@@ -84,6 +85,7 @@ static void io_task(void *arg)
 
         if (level == 0 && prev_level == 1) {
             supla_channel_emit_action(at_channel, SUPLA_ACTION_CAP_SHORT_PRESS_x1);
+            supla_link_wakeup();
         }
         prev_level = level;
         vTaskDelay(pdMS_TO_TICKS(100));
@@ -101,8 +103,8 @@ static void supla_task(void *arg)
     relay_channel = supla_channel_create(&relay_channel_config);
     at_channel = supla_channel_create(&at_channel_config);
 
-    supla_dev_add_channel(dev, relay_channel);
-    supla_dev_add_channel(dev, at_channel);
+    supla_esp_add_channel(dev, relay_channel, &relay_channel_config);
+    supla_esp_add_channel(dev, at_channel, &at_channel_config);
 
     supla_dev_set_common_channel_state_callback(dev, supla_esp_get_wifi_state);
     supla_dev_set_server_time_sync_callback(dev, supla_esp_server_time_sync);
@@ -113,8 +115,8 @@ static void supla_task(void *arg)
     }
     supla_dev_start(dev);
     while (1) {
-        supla_dev_iterate(dev);
-        vTaskDelay(pdMS_TO_TICKS(100));
+        supla_esp_dev_iterate(dev);
+        supla_link_wait(SUPLA_ITERATE_INTERVAL_MS);
     }
 }
 
@@ -156,7 +158,7 @@ void app_main()
     xTaskCreate(&io_task, "io", 2048, NULL, 1, NULL);
     xTaskCreate(&supla_task, "supla", 8192, supla_dev, 1, NULL);
     while (1) {
-        ESP_LOGI(TAG, "Free heap size: %" PRIu32, esp_get_free_heap_size());
+        supla_esp_mem_log();
         vTaskDelay(pdMS_TO_TICKS(10000));
     }
 }
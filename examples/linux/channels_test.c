@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* HTTP API action=channels test: pages of channels of one device follow
+ * offset and limit, out of range offset gives empty page, invalid limit is
+ * replaced with the default one and total counts channels of the device
+ * only. Stored channel states are listed as hex. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp-supla.h>
+#include <esp_host.h>
+
+#include "host_test.h"
+
+#define CHANNELS 40
+#define OTHER_CHANNELS 2
+#define PAGE_MAX 32 //default and max limit
+#define STATE_CH 3
+
+typedef struct {
+    uint8_t on;
+    uint8_t level;
+    uint16_t counter;
+} test_state_t;
+
+static int test_set_value(supla_channel_t *ch, TSD_SuplaChannelNewValue *new_value)
+{
+    return 0;
+}
+
+static supla_channel_config_t test_channel_config = {
+    .type = SUPLA_CHANNELTYPE_RELAY,
+    .supported_functions = 0xFF,
+    .default_function = SUPLA_CHANNELFNC_LIGHTSWITCH,
+    .on_set_value = test_set_value //
+};
+
+static const char *get(supla_dev_t **dev, const char *query)
+{
+    httpd_req_t req = { .method = HTTP_GET, .uri = "/", .user_ctx = dev, .query = query };
+
+    CHECK(supla_dev_httpd_handler(&req) == ESP_OK);
+    return esp_host_resp_take(NULL);
+}
+
+//page of channels first to first + count - 1, state is set for one of them
+static void check_page(supla_dev_t **dev, const char *query, int total, int offset, int limit,
+                       int first, int count, const char *state)
+{
+    static char expected[8192];
+    const char *out;
+    size_t n;
+
+    n = snprintf(expected, sizeof(expected),
+                 "{\"data\":{\"total\":%d,\"offset\":%d,\"limit\":%d,\"channels\":[", total, offset,
+                 limit);
+    for (int i = first; i < first + count; i++) {
+        n += snprintf(expected + n, sizeof(expected) - n,
+                      "%s{\"number\":%d,\"type\":%d,\"default_function\":%d", i > first ? "," : "",
+                      i, SUPLA_CHANNELTYPE_RELAY, SUPLA_CHANNELFNC_LIGHTSWITCH);
+        if (state && i == STATE_CH)
+            n += snprintf(expected + n, sizeof(expected) - n, ",\"state\":\"%s\"", state);
+        n += snprintf(expected + n, sizeof(expected) - n, "}");
+    }
+    snprintf(expected + n, sizeof(expected) - n, "]}}");
+
+    out = get(dev, query);
+    if (strcmp(out, expected)) {
+        fprintf(stderr, "query %s got:\n%s\nexpected:\n%s\n", query, out, expected);
+        CHECK(0);
+    }
+}
+
+int main(void)
+{
+    supla_dev_t *dev, *other;
+    supla_channel_t *ch[CHANNELS];
+    supla_channel_t *other_ch;
+    test_state_t state = { .on = 1, .level = 0x40, .counter = 9 };
+    char query[160];
+
+    dev = supla_dev_create("Channels test", NULL);
+    other = supla_dev_create("Channels test 2", NULL);
+    CHECK(dev && other);
+    for (int i = 0; i < CHANNELS; i++) {
+        ch[i] = supla_channel_create(&test_channel_config);
+        CHECK(supla_esp_add_channel(dev, ch[i], &test_channel_config) == ESP_OK);
+        //channels of devices are interleaved in the list
+        if (i < OTHER_CHANNELS) {
+            other_ch = supla_channel_create(&test_channel_config);
+            CHECK(supla_esp_add_channel(other, other_ch, &test_channel_config) == ESP_OK);
+        }
+    }
+
+    //default page, start, middle and end
+    check_page(&dev, "action=channels", CHANNELS, 0, PAGE_MAX, 0, PAGE_MAX, NULL);
+    check_page(&dev, "action=channels&offset=0&limit=5", CHANNELS, 0, 5, 0, 5, NULL);
+    check_page(&dev, "action=channels&offset=30&limit=5", CHANNELS, 30, 5, 30, 5, NULL);
+    check_page(&dev, "action=channels&offset=38&limit=5", CHANNELS, 38, 5, 38, 2, NULL);
+    check_page(&dev, "action=channels&offset=8", CHANNELS, 8, PAGE_MAX, 8, PAGE_MAX, NULL);
+
+    //out of range offset
+    check_page(&dev, "action=channels&offset=40", CHANNELS, 40, PAGE_MAX, 0, 0, NULL);
+    check_page(&dev, "action=channels&offset=1000&limit=1", CHANNELS, 1000, 1, 0, 0, NULL);
+    check_page(&dev, "action=channels&offset=-3&limit=2", CHANNELS, 0, 2, 0, 2, NULL);
+
+    //invalid limit gets default
+    check_page(&dev, "action=channels&limit=0", CHANNELS, 0, PAGE_MAX, 0, PAGE_MAX, NULL);
+    check_page(&dev, "action=channels&limit=-1", CHANNELS, 0, PAGE_MAX, 0, PAGE_MAX, NULL);
+    check_page(&dev, "action=channels&limit=33", CHANNELS, 0, PAGE_MAX, 0, PAGE_MAX, NULL);
+    check_page(&dev, "action=channels&limit=x", CHANNELS, 0, PAGE_MAX, 0, PAGE_MAX, NULL);
+
+    //stored state is listed for its own device only
+    CHECK(supla_esp_nvs_channel_state_store(ch[STATE_CH], &state, sizeof(state)) == ESP_OK);
+    check_page(&dev, "action=channels&limit=5", CHANNELS, 0, 5, 0, 5, "01400900");
+    check_page(&other, "action=channels", OTHER_CHANNELS, 0, PAGE_MAX, 0, OTHER_CHANNELS, NULL);
+
+    //too long query is an error, not a default page
+    snprintf(query, sizeof(query), "action=channels&offset=0&limit=5&pad=%0100d", 0);
+    CHECK(!strcmp(get(&dev, query), "{\"error\":{\"code\":260,\"title\":\"ESP_ERR_INVALID_SIZE\"}}"));
+
+    printf("channels test passed\n");
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Config page test: gzip response built from precompressed parts and stored
+ * field blocks inflates to the plain page, field values are HTML escaped
+ * in full and ETag changes with page content. */
+
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <esp-supla.h>
+#include <esp_host.h>
+
+#include "host_test.h"
+
+#define PAGE_MAXSIZE 16384
+
+typedef struct {
+    char body[PAGE_MAXSIZE];
+    size_t len;
+    char etag[64];
+    char encoding[16];
+} page_t;
+
+static void page_get(supla_dev_t **dev, const char *headers, page_t *page)
+{
+    httpd_req_t req = {
+        .method = HTTP_GET,
+        .uri = "/",
+        .user_ctx = dev,
+        .headers = headers,
+    };
+    const char *body;
+    const char *etag;
+    const char *encoding;
+
+    CHECK(supla_dev_basic_httpd_handler(&req) == ESP_OK);
+    etag = esp_host_resp_hdr("ETag");
+    CHECK(etag && strlen(etag) < sizeof(page->etag));
+    strcpy(page->etag, etag);
+    encoding = esp_host_resp_hdr("Content-Encoding");
+    snprintf(page->encoding, sizeof(page->encoding), "%s", encoding ? encoding : "");
+    CHECK(!strcmp(esp_host_resp_status(), "200 OK"));
+    body = esp_host_resp_take(&page->len);
+    CHECK(page->len < sizeof(page->body));
+    memcpy(page->body, body, page->len);
+    page->body[page->len] = 0;
+}
+
+//gzip response is checked by zlib, including CRC and size trailer
+static void page_check_gzip(supla_dev_t **dev, const page_t *plain)
+{
+    static char out[PAGE_MAXSIZE];
+    page_t gz;
+    z_stream zs = { 0 };
+
+    page_get(dev, "Accept-Encoding: gzip, deflate", &gz);
+    CHECK(!strcmp(gz.encoding, "gzip"));
+    CHECK(strcmp(gz.etag, plain->etag));
+    CHECK(gz.len < plain->len);
+
+    CHECK(inflateInit2(&zs, 16 + MAX_WBITS) == Z_OK);
+    zs.next_in = (Bytef *)gz.body;
+    zs.avail_in = gz.len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = sizeof(out);
+    CHECK(inflate(&zs, Z_FINISH) == Z_STREAM_END);
+    CHECK(zs.avail_in == 0);
+    CHECK(zs.total_out == plain->len && !memcmp(out, plain->body, plain->len));
+    inflateEnd(&zs);
+}
+
+int main(void)
+{
+    struct supla_config config = { .port = 2016, .ssl = 1 };
+    char email[SUPLA_EMAIL_MAXSIZE];
+    char escaped[6 * SUPLA_EMAIL_MAXSIZE];
+    char headers[96];
+    supla_dev_t *dev;
+    page_t plain, again;
+    httpd_req_t req = { .method = HTTP_GET, .uri = "/", .user_ctx = &dev };
+    size_t len;
+
+    dev = supla_dev_create("Page <test>", NULL);
+    CHECK(dev);
+    strcpy(config.email, "a&b<c>\"d\"@example.com");
+    strcpy(config.server, "svr1.supla.org");
+    CHECK(supla_dev_set_config(dev, &config) == SUPLA_RESULT_TRUE);
+
+    //plain page, values escaped
+    page_get(&dev, NULL, &plain);
+    CHECK(!plain.encoding[0]);
+    CHECK(strstr(plain.body, "Page &lt;test&gt;"));
+    CHECK(strstr(plain.body, "a&amp;b&lt;c&gt;&quot;d&quot;@example.com"));
+    CHECK(strstr(plain.body, "svr1.supla.org"));
+    CHECK(!strstr(plain.body, "{{"));
+    page_check_gzip(&dev, &plain);
+
+    //same content, same ETag; matching If-None-Match gets empty 304
+    page_get(&dev, NULL, &again);
+    CHECK(!strcmp(plain.etag, again.etag));
+    CHECK(again.len == plain.len && !memcmp(again.body, plain.body, plain.len));
+    snprintf(headers, sizeof(headers), "If-None-Match: %s", plain.etag);
+    req.headers = headers;
+    CHECK(supla_dev_basic_httpd_handler(&req) == ESP_OK);
+    CHECK(!strcmp(esp_host_resp_status(), "304 Not Modified"));
+    CHECK(esp_host_resp_take(&len) && len == 0);
+
+    //longest email of escaped characters only is shown in full
+    for (size_t i = 0; i < sizeof(email) - 1; i++)
+        email[i] = i % 2 ? '"' : '&';
+    email[sizeof(email) - 1] = 0;
+    len = 0;
+    for (size_t i = 0; email[i]; i++)
+        len += sprintf(escaped + len, "%s", email[i] == '"' ? "&quot;" : "&amp;");
+    strcpy(config.email, email);
+    CHECK(supla_dev_set_config(dev, &config) == SUPLA_RESULT_TRUE);
+
+    page_get(&dev, NULL, &again);
+    CHECK(strcmp(plain.etag, again.etag));
+    CHECK(again.len == plain.len - strlen("a&amp;b&lt;c&gt;&quot;d&quot;@example.com") + len);
+    CHECK(strstr(again.body, escaped));
+    page_check_gzip(&dev, &again);
+
+    printf("config page test passed\n");
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Config page SAVE test: posted values are stored in full, longest ones
+ * too, and form with any value that does not fit its field is rejected
+ * without changing anything. Changed cloud settings are written and
+ * device is restarted, host esp_restart() aborts so that runs in child. */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <esp-supla.h>
+#include <esp_host.h>
+
+#include "host_test.h"
+
+#define SSID_SIZE sizeof(((wifi_config_t *)0)->sta.ssid)
+#define PASSWORD_SIZE sizeof(((wifi_config_t *)0)->sta.password)
+#define EXIT_RESTARTED 3
+
+static supla_dev_t *dev;
+
+//true when page reports data saved
+static bool post(const char *body)
+{
+    httpd_req_t req = {
+        .method = HTTP_POST,
+        .uri = "/",
+        .user_ctx = &dev,
+        .content_len = strlen(body),
+        .body = body,
+        .chunk = 64,
+    };
+
+    CHECK(supla_dev_basic_httpd_handler(&req) == ESP_OK);
+    return strstr(esp_host_resp_take(NULL), "Data saved") != NULL;
+}
+
+static void check_wifi(const char *ssid, const char *password)
+{
+    wifi_config_t wifi_config;
+
+    CHECK(esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_config) == ESP_OK);
+    CHECK(!strncmp((char *)wifi_config.sta.ssid, ssid, SSID_SIZE));
+    CHECK(!strcmp((char *)wifi_config.sta.password, password));
+}
+
+static char *repeat(char *buf, char c, size_t len)
+{
+    memset(buf, c, len);
+    buf[len] = 0;
+    return buf;
+}
+
+//restart after SAVE: new config is applied to device and stored
+static void on_restart(int sig)
+{
+    struct supla_config config = { 0 };
+
+    supla_dev_get_config(dev, &config);
+    CHECK(!strcmp(config.server, "svr2.supla.org") && config.port == 2017);
+    memset(&config, 0, sizeof(config));
+    CHECK(supla_esp_nvs_config_init(&config) == ESP_OK);
+    CHECK(!strcmp(config.server, "svr2.supla.org") && config.port == 2017);
+    _exit(EXIT_RESTARTED);
+}
+
+static int post_restart(const char *body)
+{
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        signal(SIGABRT, on_restart);
+        post(body);
+        exit(0);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(void)
+{
+    char body[512];
+    char ssid[SSID_SIZE + 2];
+    char password[PASSWORD_SIZE + 1];
+    char server[SUPLA_SERVER_NAME_MAXSIZE + 1];
+    struct supla_config config = { .port = 2016, .ssl = 1 };
+    esp_host_nvs_stats_t before, after;
+
+    dev = supla_dev_create("Post test", NULL);
+    CHECK(dev);
+    CHECK(supla_esp_nvs_config_init(&config) == ESP_OK);
+    strcpy(config.email, "user@example.com");
+    strcpy(config.server, "svr1.supla.org");
+    CHECK(supla_dev_set_config(dev, &config) == SUPLA_RESULT_TRUE);
+
+    //unchanged cloud settings: WiFi only, nothing written, no restart
+    esp_host_nvs_get_stats(&before);
+    CHECK(post("sid=Home+Net&wpw=p%26ss&svr=svr1.supla.org&eml=user%40example.com"
+                     "&prt=2016"));
+    check_wifi("Home Net", "p&ss");
+    esp_host_nvs_get_stats(&after);
+    CHECK(after.blob_writes == before.blob_writes);
+
+    //longest values fit, SSID field has no terminator
+    repeat(ssid, 's', SSID_SIZE);
+    repeat(password, 'p', PASSWORD_SIZE - 1);
+    snprintf(body, sizeof(body), "sid=%s&wpw=%s", ssid, password);
+    CHECK(post(body));
+    check_wifi(ssid, password);
+
+    //any value that does not fit rejects the whole form
+    snprintf(body, sizeof(body), "sid=%s&wpw=new", repeat(ssid, 'x', SSID_SIZE + 1));
+    CHECK(!post(body));
+    snprintf(body, sizeof(body), "sid=new&wpw=%s", repeat(password, 'x', PASSWORD_SIZE));
+    CHECK(!post(body));
+    snprintf(body, sizeof(body), "sid=new&wpw=new&svr=%s",
+             repeat(server, 'x', SUPLA_SERVER_NAME_MAXSIZE));
+    CHECK(!post(body));
+    check_wifi(repeat(ssid, 's', SSID_SIZE), repeat(password, 'p', PASSWORD_SIZE - 1));
+
+    //changed cloud settings are applied by restart
+    CHECK(post_restart("sid=Home&wpw=pass&svr=svr2.supla.org&prt=2017") == EXIT_RESTARTED);
+
+    printf("config post test passed\n");
+    return 0;
+}
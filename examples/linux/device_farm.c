@@ -0,0 +1,605 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Device farm benchmark: N libsupla devices in one process connected by
+ * host link layer to a fake SUPLA server running in a child process. Server
+ * registers every device, then toggles all relays in closed loop (one value
+ * in flight per channel) and measures set value to value changed round trip,
+ * devices emit action triggers meanwhile. Both sides report CPU time, device
+ * side reports RSS, so cost of one device can be read from a few runs.
+ * Socket reads per received frame are compared with device_farm_rx_direct,
+ * the same benchmark built without link receive buffer. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <libsupla/device.h>
+#include <esp-supla-link.h>
+
+//supla_link_wait() is select() based
+#define FARM_DEVICES_MAX (FD_SETSIZE - 32)
+#define FARM_CHANNELS_MAX 32
+#define FARM_ITERATE_INTERVAL_MS 100
+#define FARM_REGISTER_TIMEOUT_S 60
+#define FARM_DRAIN_MS 1000 //wait for values in flight after load phase
+#define FARM_ACTIVITY_TIMEOUT 120
+
+#if defined(CONFIG_ESP_LIBSUPLA_LINK_RX_BUF_SIZE) && CONFIG_ESP_LIBSUPLA_LINK_RX_BUF_SIZE == 0
+#define FARM_RX_MODE "direct" //built with supla-host-rx-direct
+#else
+#define FARM_RX_MODE "buffered"
+#endif
+
+#define PACKET_HEADER_SIZE offsetof(TSuplaDataPacket, data)
+#define PACKET_MAX_SIZE (sizeof(TSuplaDataPacket) + SUPLA_TAG_SIZE)
+
+typedef struct {
+    uint32_t registered;
+    uint32_t updates; //completed set value round trips
+    uint32_t actions;
+    uint32_t dropped; //connections closed by server on protocol error
+    uint32_t frames;  //frames sent to devices
+    uint32_t load_ms;
+    uint32_t cpu_ms;
+    uint32_t lat_us[4]; //p50, p90, p99, max
+} farm_result_t;
+
+typedef struct {
+    int fd;
+    int dev; //device index from GUID, -1 until registered
+    uint8_t version;
+    uint32_t rr_id;
+    size_t rx_len;
+    uint8_t *rx;
+    uint8_t hi[FARM_CHANNELS_MAX];
+    uint64_t sent_us[FARM_CHANNELS_MAX]; //0 when nothing in flight
+} farm_conn_t;
+
+typedef struct {
+    uint32_t *samples;
+    size_t count;
+    size_t size;
+} farm_samples_t;
+
+static int devices = 16;
+static int relays = 1;
+static int action_triggers = 1;
+static int seconds = 10;
+static uint32_t server_frames;
+
+static uint64_t time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t cpu_ms(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec * 1000 + ru.ru_utime.tv_usec / 1000 + ru.ru_stime.tv_sec * 1000 +
+           ru.ru_stime.tv_usec / 1000;
+}
+
+static int u32_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+//p50, p90, p99 and max of sorted samples
+static void percentiles(uint32_t *samples, size_t count, uint32_t out[4])
+{
+    static const int pct[3] = { 50, 90, 99 };
+
+    memset(out, 0, 4 * sizeof(*out));
+    if (!count)
+        return;
+    qsort(samples, count, sizeof(*samples), u32_cmp);
+    for (int i = 0; i < 3; i++)
+        out[i] = samples[(count - 1) * pct[i] / 100];
+    out[3] = samples[count - 1];
+}
+
+static void samples_add(farm_samples_t *s, uint32_t value)
+{
+    uint32_t *samples;
+
+    if (s->count == s->size) {
+        s->size = s->size ? 2 * s->size : 4096;
+        samples = realloc(s->samples, s->size * sizeof(*samples));
+        if (!samples)
+            exit(2);
+        s->samples = samples;
+    }
+    s->samples[s->count++] = value;
+}
+
+/* Fake server */
+
+static int server_send(farm_conn_t *conn, unsigned call_id, uint32_t rr_id, const void *data,
+                       size_t len)
+{
+    static TSuplaDataPacket sdp; //server is single threaded
+    size_t size = PACKET_HEADER_SIZE + len + SUPLA_TAG_SIZE;
+
+    memcpy(sdp.tag, "SUPLA", SUPLA_TAG_SIZE);
+    sdp.version = conn->version;
+    sdp.rr_id = rr_id;
+    sdp.call_id = call_id;
+    sdp.data_size = len;
+    memcpy(sdp.data, data, len);
+    memcpy(sdp.data + len, "SUPLA", SUPLA_TAG_SIZE);
+    server_frames++;
+    return send(conn->fd, &sdp, size, MSG_NOSIGNAL) == (ssize_t)size ? 0 : -1;
+}
+
+static int server_set_relay(farm_conn_t *conn, int ch)
+{
+    TSD_SuplaChannelNewValue value = { 0 };
+
+    conn->hi[ch] = !conn->hi[ch];
+    value.ChannelNumber = ch;
+    value.value[0] = conn->hi[ch];
+    conn->sent_us[ch] = time_us();
+    return server_send(conn, SUPLA_SD_CALL_CHANNEL_SET_VALUE, ++conn->rr_id, &value,
+                       sizeof(value));
+}
+
+static int server_register(farm_conn_t *conn, const TSuplaDataPacket *sdp, uint64_t *reg_us)
+{
+    //all register variants start with Email, AuthKey, GUID
+    size_t guid = offsetof(TDS_SuplaRegisterDevice_E, GUID);
+    TSD_SuplaRegisterDeviceResult result = { 0 };
+    const uint8_t *data = (const uint8_t *)sdp->data;
+    uint32_t idx;
+
+    if (sdp->data_size < guid + 4)
+        return -1;
+    idx = data[guid] | data[guid + 1] << 8 | data[guid + 2] << 16 | (uint32_t)data[guid + 3] << 24;
+    if (idx >= (uint32_t)devices || reg_us[idx])
+        return -1;
+
+    result.result_code = SUPLA_RESULTCODE_TRUE;
+    result.activity_timeout = FARM_ACTIVITY_TIMEOUT;
+    result.version = sdp->version;
+    result.version_min = SUPLA_PROTO_VERSION_MIN;
+    if (server_send(conn, SUPLA_SD_CALL_REGISTER_DEVICE_RESULT, sdp->rr_id, &result,
+                    sizeof(result)) != 0)
+        return -1;
+
+    conn->dev = idx;
+    reg_us[idx] = time_us();
+    return 0;
+}
+
+static void server_value_changed(farm_conn_t *conn, int ch, const char *value,
+                                 farm_samples_t *lat, int loading)
+{
+    if (ch < 0 || ch >= relays || !conn->sent_us[ch] || value[0] != conn->hi[ch])
+        return;
+
+    samples_add(lat, time_us() - conn->sent_us[ch]);
+    conn->sent_us[ch] = 0;
+    if (loading)
+        server_set_relay(conn, ch);
+}
+
+static int server_packet(farm_conn_t *conn, const TSuplaDataPacket *sdp, farm_result_t *result,
+                         uint64_t *reg_us, farm_samples_t *lat, int loading)
+{
+    union {
+        TSDC_SuplaPingServerResult ping;
+        TSDC_SuplaSetActivityTimeoutResult timeout;
+    } out = { 0 };
+
+    conn->version = sdp->version;
+    switch (sdp->call_id) {
+    case SUPLA_DS_CALL_REGISTER_DEVICE_E:
+#ifdef SUPLA_DS_CALL_REGISTER_DEVICE_F
+    case SUPLA_DS_CALL_REGISTER_DEVICE_F:
+#endif
+        if (conn->dev >= 0 || server_register(conn, sdp, reg_us) != 0)
+            return -1;
+        result->registered++;
+        break;
+    case SUPLA_DCS_CALL_PING_SERVER:
+        return server_send(conn, SUPLA_SDC_CALL_PING_SERVER_RESULT, sdp->rr_id, &out.ping,
+                           sizeof(out.ping));
+    case SUPLA_DCS_CALL_SET_ACTIVITY_TIMEOUT:
+        out.timeout.activity_timeout = FARM_ACTIVITY_TIMEOUT;
+        out.timeout.min = FARM_ACTIVITY_TIMEOUT;
+        out.timeout.max = FARM_ACTIVITY_TIMEOUT;
+        return server_send(conn, SUPLA_SDC_CALL_SET_ACTIVITY_TIMEOUT_RESULT, sdp->rr_id,
+                           &out.timeout, sizeof(out.timeout));
+    case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED:
+        server_value_changed(conn, ((TDS_SuplaDeviceChannelValue *)sdp->data)->ChannelNumber,
+                             ((TDS_SuplaDeviceChannelValue *)sdp->data)->value, lat, loading);
+        break;
+    case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_B:
+        server_value_changed(conn, ((TDS_SuplaDeviceChannelValue_B *)sdp->data)->ChannelNumber,
+                             ((TDS_SuplaDeviceChannelValue_B *)sdp->data)->value, lat, loading);
+        break;
+    case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_C:
+        server_value_changed(conn, ((TDS_SuplaDeviceChannelValue_C *)sdp->data)->ChannelNumber,
+                             ((TDS_SuplaDeviceChannelValue_C *)sdp->data)->value, lat, loading);
+        break;
+    case SUPLA_DS_CALL_ACTIONTRIGGER:
+        result->actions++;
+        break;
+    default: //results and calls not needed by benchmark
+        break;
+    }
+    return 0;
+}
+
+//handle all complete packets in rx buffer
+static int server_rx(farm_conn_t *conn, farm_result_t *result, uint64_t *reg_us,
+                     farm_samples_t *lat, int loading)
+{
+    TSuplaDataPacket *sdp;
+    size_t size, off = 0;
+    ssize_t rc;
+
+    rc = recv(conn->fd, conn->rx + conn->rx_len, PACKET_MAX_SIZE - conn->rx_len, MSG_DONTWAIT);
+    if (rc <= 0)
+        return rc < 0 && errno == EAGAIN ? 0 : -1;
+    conn->rx_len += rc;
+
+    while (conn->rx_len - off >= PACKET_HEADER_SIZE) {
+        sdp = (TSuplaDataPacket *)(conn->rx + off);
+        if (memcmp(sdp->tag, "SUPLA", SUPLA_TAG_SIZE) || sdp->data_size > SUPLA_MAX_DATA_SIZE)
+            return -1;
+        size = PACKET_HEADER_SIZE + sdp->data_size + SUPLA_TAG_SIZE;
+        if (conn->rx_len - off < size)
+            break;
+        if (memcmp(conn->rx + off + size - SUPLA_TAG_SIZE, "SUPLA", SUPLA_TAG_SIZE) ||
+            server_packet(conn, sdp, result, reg_us, lat, loading) != 0)
+            return -1;
+        off += size;
+    }
+    memmove(conn->rx, conn->rx + off, conn->rx_len - off);
+    conn->rx_len -= off;
+    return 0;
+}
+
+static void server_close(farm_conn_t *conn, struct pollfd *pfd)
+{
+    close(conn->fd);
+    free(conn->rx);
+    conn->fd = -1;
+    conn->rx = NULL;
+    pfd->fd = -1;
+}
+
+static void server_accept(int lfd, farm_conn_t *conns, struct pollfd *pfds, int nconns)
+{
+    int one = 1;
+    int fd;
+
+    while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+        int i;
+
+        for (i = 0; i < nconns && conns[i].fd >= 0; i++)
+            ;
+        if (i == nconns) {
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        memset(&conns[i], 0, sizeof(conns[i]));
+        conns[i].fd = fd;
+        conns[i].dev = -1;
+        conns[i].rx = malloc(PACKET_MAX_SIZE);
+        if (!conns[i].rx)
+            exit(2);
+        pfds[i + 1].fd = fd;
+    }
+}
+
+/* Server runs until load phase is over, then writes result and register
+ * times to fd and exits */
+static void server_run(int lfd, int fd)
+{
+    //some devices may reconnect, keep room for their new connections
+    int nconns = 2 * devices;
+    farm_conn_t *conns = calloc(nconns, sizeof(*conns));
+    struct pollfd *pfds = calloc(nconns + 1, sizeof(*pfds));
+    uint64_t *reg_us = calloc(devices, sizeof(*reg_us));
+    uint64_t start = time_us(), load_start = 0, load_end = 0;
+    farm_samples_t lat = { 0 };
+    farm_result_t result = { 0 };
+
+    if (!conns || !pfds || !reg_us)
+        exit(2);
+
+    fcntl(lfd, F_SETFL, O_NONBLOCK);
+    pfds[0].fd = lfd;
+    pfds[0].events = POLLIN;
+    for (int i = 0; i < nconns; i++) {
+        conns[i].fd = -1;
+        pfds[i + 1].fd = -1;
+        pfds[i + 1].events = POLLIN;
+    }
+
+    while (1) {
+        uint64_t now = time_us();
+        int loading = load_start && now < load_end;
+
+        //load starts when all devices are in or registration timed out
+        if (!load_start && (result.registered == (uint32_t)devices ||
+                            now - start > FARM_REGISTER_TIMEOUT_S * 1000000ULL)) {
+            load_start = now;
+            load_end = now + seconds * 1000000ULL;
+            for (int i = 0; i < nconns; i++) {
+                for (int ch = 0; conns[i].fd >= 0 && conns[i].dev >= 0 && ch < relays; ch++)
+                    server_set_relay(&conns[i], ch);
+            }
+        }
+        if (load_start && now >= load_end + FARM_DRAIN_MS * 1000ULL)
+            break;
+
+        if (poll(pfds, nconns + 1, 10) < 0 && errno != EINTR)
+            exit(2);
+        if (pfds[0].revents & POLLIN)
+            server_accept(lfd, conns, pfds, nconns);
+        for (int i = 0; i < nconns; i++) {
+            if (conns[i].fd < 0 || !pfds[i + 1].revents)
+                continue;
+            if (server_rx(&conns[i], &result, reg_us, &lat, loading) != 0) {
+                result.dropped++;
+                server_close(&conns[i], &pfds[i + 1]);
+            }
+        }
+    }
+
+    result.updates = lat.count;
+    result.frames = server_frames;
+    result.load_ms = (load_end - load_start) / 1000;
+    result.cpu_ms = cpu_ms();
+    percentiles(lat.samples, lat.count, result.lat_us);
+    if (write(fd, &result, sizeof(result)) != sizeof(result) ||
+        write(fd, reg_us, devices * sizeof(*reg_us)) != (ssize_t)(devices * sizeof(*reg_us)))
+        exit(2);
+    exit(0);
+}
+
+/* Devices */
+
+static int farm_relay_set_value(supla_channel_t *ch, TSD_SuplaChannelNewValue *new_value)
+{
+    TRelayChannel_Value *relay_val = (TRelayChannel_Value *)new_value->value;
+
+    return supla_channel_set_relay_value(ch, relay_val);
+}
+
+static supla_channel_config_t relay_channel_config = {
+    .type = SUPLA_CHANNELTYPE_RELAY,
+    .supported_functions = 0xFF,
+    .default_function = SUPLA_CHANNELFNC_LIGHTSWITCH,
+    .flags = SUPLA_CHANNEL_FLAG_CHANNELSTATE,
+    .on_set_value = farm_relay_set_value //
+};
+
+static supla_channel_config_t at_channel_config = {
+    .type = SUPLA_CHANNELTYPE_ACTIONTRIGGER,
+    .supported_functions = 0xFF,
+    .default_function = SUPLA_CHANNELFNC_ACTIONTRIGGER,
+    .action_trigger_caps = SUPLA_ACTION_CAP_SHORT_PRESS_x1 //
+};
+
+static long rss_kb(void)
+{
+    char line[128];
+    long kb = 0;
+    FILE *f = fopen("/proc/self/status", "r");
+
+    if (!f)
+        return 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+    return kb;
+}
+
+//device index goes to GUID so server can tell devices apart
+static supla_dev_t *farm_dev_create(int idx, struct supla_config *config, supla_channel_t **ats)
+{
+    char name[SUPLA_DEVICE_NAME_MAXSIZE];
+    supla_dev_t *dev;
+
+    for (size_t i = 0; i < SUPLA_GUID_SIZE; i++)
+        config->guid[i] = i < 4 ? idx >> (8 * i) : random();
+    for (size_t i = 0; i < SUPLA_AUTHKEY_SIZE; i++)
+        config->auth_key[i] = random();
+
+    snprintf(name, sizeof(name), "FARM-%d", idx);
+    dev = supla_dev_create(name, NULL);
+    if (!dev)
+        return NULL;
+    for (int ch = 0; ch < relays; ch++)
+        supla_dev_add_channel(dev, supla_channel_create(&relay_channel_config));
+    for (int ch = 0; ch < action_triggers; ch++) {
+        ats[ch] = supla_channel_create(&at_channel_config);
+        supla_dev_add_channel(dev, ats[ch]);
+    }
+    if (supla_dev_set_config(dev, config) != SUPLA_RESULT_TRUE)
+        return NULL;
+    return dev;
+}
+
+static int server_start(int *port, int *result_fd, pid_t *pid)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t len = sizeof(addr);
+    int fds[2];
+    int lfd;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(lfd, SOMAXCONN) != 0 || getsockname(lfd, (struct sockaddr *)&addr, &len) != 0 ||
+        pipe(fds) != 0)
+        return -1;
+
+    *pid = fork();
+    if (*pid == 0) {
+        close(fds[0]);
+        server_run(lfd, fds[1]);
+    }
+    close(lfd);
+    close(fds[1]);
+    if (*pid < 0)
+        return -1;
+    *port = ntohs(addr.sin_port);
+    *result_fd = fds[0];
+    return 0;
+}
+
+//raise descriptor limit, select() limit is checked against FARM_DEVICES_MAX
+static void nofile_raise(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct supla_config config = { .email = "farm@localhost", .server = "127.0.0.1", .ssl = 0 };
+    supla_dev_t **devs;
+    supla_channel_t **ats;
+    uint64_t *start_us, *reg_us;
+    uint32_t *reg_ms, reg_pct[4], reg_all_ms = 0;
+    farm_result_t result;
+    supla_link_stats_t stats;
+    struct pollfd pfd;
+    long rss_base, rss_peak;
+    uint64_t wall_start, last_action = 0;
+    uint32_t cpu_start, cpu, registered = 0;
+    struct rusage ru;
+    int result_fd;
+    pid_t pid;
+
+    devices = argc > 1 ? atoi(argv[1]) : devices;
+    relays = argc > 2 ? atoi(argv[2]) : relays;
+    action_triggers = argc > 3 ? atoi(argv[3]) : action_triggers;
+    seconds = argc > 4 ? atoi(argv[4]) : seconds;
+    if (argc > 5 || devices <= 0 || devices > FARM_DEVICES_MAX || relays < 0 ||
+        action_triggers < 0 || relays + action_triggers == 0 ||
+        relays + action_triggers > FARM_CHANNELS_MAX || seconds <= 0) {
+        fprintf(stderr, "usage: %s [devices<=%d] [relays] [action_triggers] [seconds]\n",
+                argv[0], FARM_DEVICES_MAX);
+        return 1;
+    }
+
+    nofile_raise();
+    srandom(time(NULL));
+    if (server_start(&config.port, &result_fd, &pid) != 0) {
+        perror("server");
+        return 1;
+    }
+
+    devs = calloc(devices, sizeof(*devs));
+    ats = calloc((size_t)devices * (action_triggers ? action_triggers : 1), sizeof(*ats));
+    start_us = calloc(devices, sizeof(*start_us));
+    reg_us = calloc(devices, sizeof(*reg_us));
+    reg_ms = calloc(devices, sizeof(*reg_ms));
+    if (!devs || !ats || !start_us || !reg_us || !reg_ms)
+        return 2;
+
+    rss_base = rss_kb();
+    cpu_start = cpu_ms();
+    wall_start = time_us();
+    for (int i = 0; i < devices; i++) {
+        devs[i] = farm_dev_create(i, &config, ats + (size_t)i * action_triggers);
+        if (!devs[i]) {
+            fprintf(stderr, "device %d create failed\n", i);
+            kill(pid, SIGKILL);
+            return 2;
+        }
+        start_us[i] = time_us();
+        supla_dev_start(devs[i]);
+    }
+
+    //run devices until server reports
+    pfd.fd = result_fd;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, 0) == 0) {
+        for (int i = 0; i < devices; i++)
+            supla_dev_iterate(devs[i]);
+        if (action_triggers && time_us() - last_action >= 1000000) {
+            for (int i = 0; i < devices * action_triggers; i++)
+                supla_channel_emit_action(ats[i], SUPLA_ACTION_CAP_SHORT_PRESS_x1);
+            last_action = time_us();
+        }
+        supla_link_wait(FARM_ITERATE_INTERVAL_MS);
+    }
+    cpu = cpu_ms() - cpu_start;
+    getrusage(RUSAGE_SELF, &ru);
+    rss_peak = ru.ru_maxrss;
+
+    if (read(result_fd, &result, sizeof(result)) != sizeof(result) ||
+        read(result_fd, reg_us, devices * sizeof(*reg_us)) != (ssize_t)(devices * sizeof(*reg_us)))
+        return 2;
+    waitpid(pid, NULL, 0);
+
+    for (int i = 0; i < devices; i++) {
+        if (!reg_us[i])
+            continue;
+        reg_ms[registered++] = (reg_us[i] - start_us[i]) / 1000;
+        if ((reg_us[i] - wall_start) / 1000 > reg_all_ms)
+            reg_all_ms = (reg_us[i] - wall_start) / 1000;
+    }
+    percentiles(reg_ms, registered, reg_pct);
+
+    printf("farm: devices=%d relays=%d action_triggers=%d load=%us\n", devices, relays,
+           action_triggers, result.load_ms / 1000);
+    printf("register: %u/%d in %ums, per device p50=%ums p90=%ums p99=%ums max=%ums\n",
+           registered, devices, reg_all_ms, reg_pct[0], reg_pct[1], reg_pct[2], reg_pct[3]);
+    printf("updates: %u round trips, %.0f/s, actions=%u %.0f/s, dropped=%u\n", result.updates,
+           result.load_ms ? result.updates * 1000.0 / result.load_ms : 0.0, result.actions,
+           result.load_ms ? result.actions * 1000.0 / result.load_ms : 0.0, result.dropped);
+    printf("latency: p50=%uus p90=%uus p99=%uus max=%uus\n", result.lat_us[0], result.lat_us[1],
+           result.lat_us[2], result.lat_us[3]);
+    printf("devices: rss base=%ldkB peak=%ldkB per device=%.1fkB cpu=%ums (%.1f%%) per update=%.1fus\n",
+           rss_base, rss_peak, (double)(rss_peak - rss_base) / devices, cpu,
+           100.0 * cpu / ((time_us() - wall_start) / 1000),
+           result.updates ? cpu * 1000.0 / result.updates : 0.0);
+    printf("server: cpu=%ums per update=%.1fus\n", result.cpu_ms,
+           result.updates ? result.cpu_ms * 1000.0 / result.updates : 0.0);
+    //reads include the ones that found no data, SRPC tries one per iteration
+    supla_link_get_stats(&stats);
+    printf("rx %s: frames=%u recv calls=%u socket reads=%u per frame: calls=%.2f reads=%.2f\n",
+           FARM_RX_MODE, result.frames, stats.rx_calls, stats.rx_reads,
+           result.frames ? (double)stats.rx_calls / result.frames : 0.0,
+           result.frames ? (double)stats.rx_reads / result.frames : 0.0);
+    return registered == (uint32_t)devices && !result.dropped ? 0 : 1;
+}
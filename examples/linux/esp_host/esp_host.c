@@ -0,0 +1,660 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "esp_host.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define NVS_KEY_SIZE 16
+#define NVS_VALUE_MAX 512
+#define NVS_ENTRIES 64
+#define HOST_TIMERS 8
+#define RESP_MAXSIZE 16384
+#define RESP_HEADERS 8
+#define HOST_WORKS 8
+#define WS_SOCKETS 16
+#define WS_FRAMES_SIZE 4096
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_INVALID_CRC:
+        return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION:
+        return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    default:
+        return "ESP_ERR";
+    }
+}
+
+//semaphore is a counter limited to one, mutex is a semaphore given at start
+struct host_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int count;
+};
+
+static SemaphoreHandle_t sem_create(int count)
+{
+    SemaphoreHandle_t sem = calloc(1, sizeof(*sem));
+
+    if (!sem)
+        return NULL;
+    pthread_mutex_init(&sem->lock, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    sem->count = count;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return sem_create(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return sem_create(0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    struct timespec deadline;
+    int rc = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ticks / 1000;
+    deadline.tv_nsec += (ticks % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&sem->lock);
+    while (!sem->count && rc != ETIMEDOUT) {
+        if (ticks == portMAX_DELAY)
+            pthread_cond_wait(&sem->cond, &sem->lock);
+        else
+            rc = pthread_cond_timedwait(&sem->cond, &sem->lock, &deadline);
+    }
+    rc = sem->count ? pdTRUE : pdFALSE;
+    if (sem->count)
+        sem->count--;
+    pthread_mutex_unlock(&sem->lock);
+    return rc;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    BaseType_t rc;
+
+    pthread_mutex_lock(&sem->lock);
+    rc = sem->count ? pdFALSE : pdTRUE;
+    sem->count = 1;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+    return rc;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_mutex_destroy(&sem->lock);
+    pthread_cond_destroy(&sem->cond);
+    free(sem);
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    return ESP_OK;
+}
+
+//no test expects a restart, make it fail
+void esp_restart(void)
+{
+    fprintf(stderr, "esp_restart()\n");
+    abort();
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        ((uint8_t *)buf)[i] = rand();
+}
+
+esp_err_t esp_efuse_mac_get_default(uint8_t *mac)
+{
+    static const uint8_t host_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+    memcpy(mac, host_mac, sizeof(host_mac));
+    return ESP_OK;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 0;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return 0;
+}
+
+struct host_timer {
+    esp_timer_create_args_t args;
+    bool used;
+    bool started;
+    bool periodic;
+};
+
+static struct host_timer timers[HOST_TIMERS];
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timer)
+{
+    for (int i = 0; i < HOST_TIMERS; i++) {
+        if (!timers[i].used) {
+            timers[i].used = true;
+            timers[i].started = false;
+            timers[i].args = *args;
+            *timer = &timers[i];
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (timer->started)
+        return ESP_ERR_INVALID_STATE;
+    timer->started = true;
+    timer->periodic = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    if (timer->started)
+        return ESP_ERR_INVALID_STATE;
+    timer->started = true;
+    timer->periodic = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->started)
+        return ESP_ERR_INVALID_STATE;
+    timer->started = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    timer->used = false;
+    return ESP_OK;
+}
+
+int esp_host_timers_fire(void)
+{
+    int fired = 0;
+
+    for (int i = 0; i < HOST_TIMERS; i++) {
+        if (timers[i].used && timers[i].started) {
+            timers[i].started = timers[i].periodic;
+            timers[i].args.callback(timers[i].args.arg);
+            fired++;
+        }
+    }
+    return fired;
+}
+
+//one namespace is enough for esp-supla, changes are visible before commit
+typedef struct {
+    char key[NVS_KEY_SIZE];
+    size_t len;
+    uint8_t value[NVS_VALUE_MAX];
+} nvs_entry_t;
+
+static nvs_entry_t nvs_entries[NVS_ENTRIES];
+static esp_host_nvs_stats_t nvs_stats;
+
+static nvs_entry_t *nvs_find(const char *key)
+{
+    for (int i = 0; i < NVS_ENTRIES; i++) {
+        if (nvs_entries[i].key[0] && !strcmp(nvs_entries[i].key, key))
+            return &nvs_entries[i];
+    }
+    return NULL;
+}
+
+static esp_err_t nvs_get(const char *key, void *value, size_t *len)
+{
+    nvs_entry_t *entry = nvs_find(key);
+
+    if (!entry)
+        return ESP_ERR_NVS_NOT_FOUND;
+    if (*len < entry->len)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(value, entry->value, entry->len);
+    *len = entry->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    nvs_stats.opens++;
+    *handle = mode == NVS_READWRITE ? 2 : 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    nvs_stats.commits++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *len)
+{
+    nvs_stats.blob_reads++;
+    return nvs_get(key, value, len);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t len)
+{
+    nvs_entry_t *entry = nvs_find(key);
+
+    if (handle != 2)
+        return ESP_ERR_INVALID_STATE;
+    if (len > NVS_VALUE_MAX || strlen(key) >= NVS_KEY_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+    for (int i = 0; !entry && i < NVS_ENTRIES; i++) {
+        if (!nvs_entries[i].key[0])
+            entry = &nvs_entries[i];
+    }
+    if (!entry)
+        return ESP_ERR_NO_MEM;
+
+    nvs_stats.blob_writes++;
+    strcpy(entry->key, key);
+    memcpy(entry->value, value, len);
+    entry->len = len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *len)
+{
+    return nvs_get(key, value, len);
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *value)
+{
+    size_t len = sizeof(*value);
+
+    return nvs_get(key, value, &len);
+}
+
+esp_err_t nvs_get_i8(nvs_handle_t handle, const char *key, int8_t *value)
+{
+    size_t len = sizeof(*value);
+
+    return nvs_get(key, value, &len);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    nvs_entry_t *entry = nvs_find(key);
+
+    if (!entry)
+        return ESP_ERR_NVS_NOT_FOUND;
+    memset(entry, 0, sizeof(*entry));
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    memset(nvs_entries, 0, sizeof(nvs_entries));
+    return ESP_OK;
+}
+
+void esp_host_nvs_get_stats(esp_host_nvs_stats_t *stats)
+{
+    *stats = nvs_stats;
+}
+
+uint8_t *esp_host_nvs_blob(const char *key, size_t *len)
+{
+    nvs_entry_t *entry = nvs_find(key);
+
+    if (!entry)
+        return NULL;
+    *len = entry->len;
+    return entry->value;
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *key)
+{
+    return NULL;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *netif, esp_netif_ip_info_t *info)
+{
+    return ESP_FAIL;
+}
+
+//station config kept in RAM
+static wifi_config_t wifi_sta_config;
+
+esp_err_t esp_wifi_get_config(wifi_interface_t iface, wifi_config_t *config)
+{
+    *config = wifi_sta_config;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t iface, wifi_config_t *config)
+{
+    wifi_sta_config = *config;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *info)
+{
+    return ESP_FAIL;
+}
+
+static char resp[RESP_MAXSIZE];
+static size_t resp_len;
+static const char *resp_status = "200 OK";
+static struct {
+    const char *field;
+    char value[64];
+} resp_hdrs[RESP_HEADERS];
+
+int httpd_req_recv(httpd_req_t *req, char *buf, size_t len)
+{
+    size_t left = req->content_len - req->received;
+
+    if (req->timeouts > 0) {
+        req->timeouts--;
+        return HTTPD_SOCK_ERR_TIMEOUT;
+    }
+    if (len > req->chunk)
+        len = req->chunk;
+    if (len > left)
+        len = left;
+    memcpy(buf, req->body + req->received, len);
+    req->received += len;
+    return len;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *req)
+{
+    return req->query ? strlen(req->query) : 0;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf, size_t len)
+{
+    if (!req->query)
+        return ESP_ERR_NOT_FOUND;
+    snprintf(buf, len, "%s", req->query);
+    return strlen(req->query) < len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_query_key_value(const char *query, const char *key, char *val, size_t len)
+{
+    size_t key_len = strlen(key);
+    const char *p = query;
+
+    while (p && *p) {
+        const char *end = strchr(p, '&');
+        size_t field_len = end ? (size_t)(end - p) : strlen(p);
+
+        if (field_len > key_len && !strncmp(p, key, key_len) && p[key_len] == '=') {
+            size_t val_len = field_len - key_len - 1;
+
+            snprintf(val, len, "%.*s", (int)val_len, p + key_len + 1);
+            return val_len < len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+        p = end ? end + 1 : NULL;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+bool httpd_uri_match_wildcard(const char *tpl, const char *uri, size_t len)
+{
+    size_t tpl_len = strlen(tpl);
+
+    if (tpl_len && tpl[tpl_len - 1] == '*')
+        return len >= tpl_len - 1 && !strncmp(tpl, uri, tpl_len - 1);
+    return len == tpl_len && !strncmp(tpl, uri, len);
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *val, size_t len)
+{
+    size_t field_len = strlen(field);
+    const char *p = req->headers;
+
+    while (p && *p) {
+        const char *end = strchr(p, '\n');
+        size_t line_len = end ? (size_t)(end - p) : strlen(p);
+
+        if (line_len > field_len && !strncasecmp(p, field, field_len) && p[field_len] == ':') {
+            const char *value = p + field_len + 1;
+            size_t val_len;
+
+            while (*value == ' ')
+                value++;
+            val_len = line_len - (value - p);
+            snprintf(val, len, "%.*s", (int)val_len, value);
+            return val_len < len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+        p = end ? end + 1 : NULL;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status)
+{
+    resp_status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type)
+{
+    return ESP_OK;
+}
+
+//value is copied, handlers may pass buffers on their stack
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field, const char *value)
+{
+    for (int i = 0; i < RESP_HEADERS; i++) {
+        if (!resp_hdrs[i].field || !strcasecmp(resp_hdrs[i].field, field)) {
+            resp_hdrs[i].field = field;
+            snprintf(resp_hdrs[i].value, sizeof(resp_hdrs[i].value), "%s", value);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len)
+{
+    resp_len = 0;
+    resp[0] = 0;
+    return httpd_resp_send_chunk(req, buf, len);
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t len)
+{
+    if (!buf)
+        return ESP_OK;
+    if (len < 0)
+        len = strlen(buf);
+    if (resp_len + len >= sizeof(resp))
+        return ESP_FAIL;
+    memcpy(resp + resp_len, buf, len);
+    resp_len += len;
+    resp[resp_len] = 0;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t err, const char *msg)
+{
+    resp_len = snprintf(resp, sizeof(resp), "%d %s", err, msg ? msg : "");
+    return ESP_OK;
+}
+
+const char *esp_host_resp_take(size_t *len)
+{
+    static char taken[RESP_MAXSIZE];
+
+    memcpy(taken, resp, resp_len + 1);
+    if (len)
+        *len = resp_len;
+    resp_len = 0;
+    resp[0] = 0;
+    resp_status = "200 OK";
+    memset(resp_hdrs, 0, sizeof(resp_hdrs));
+    return taken;
+}
+
+const char *esp_host_resp_status(void)
+{
+    return resp_status;
+}
+
+const char *esp_host_resp_hdr(const char *field)
+{
+    for (int i = 0; i < RESP_HEADERS && resp_hdrs[i].field; i++) {
+        if (!strcasecmp(resp_hdrs[i].field, field))
+            return resp_hdrs[i].value;
+    }
+    return NULL;
+}
+
+static struct {
+    httpd_work_fn_t work;
+    void *arg;
+} works[HOST_WORKS];
+static int works_queued;
+
+static struct {
+    bool open;
+    size_t len;
+    char frames[WS_FRAMES_SIZE];
+} ws_socks[WS_SOCKETS];
+
+int httpd_req_to_sockfd(httpd_req_t *req)
+{
+    return req->sockfd;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t hd, httpd_work_fn_t work, void *arg)
+{
+    if (works_queued == HOST_WORKS)
+        return ESP_FAIL;
+    works[works_queued].work = work;
+    works[works_queued].arg = arg;
+    works_queued++;
+    return ESP_OK;
+}
+
+int esp_host_work_run(void)
+{
+    int run = 0;
+
+    //work may queue more work, it is run on next call
+    for (int n = works_queued; run < n; run++)
+        works[run].work(works[run].arg);
+    memmove(works, works + run, (works_queued - run) * sizeof(works[0]));
+    works_queued -= run;
+    return run;
+}
+
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd)
+{
+    if (fd < 0 || fd >= WS_SOCKETS)
+        return HTTPD_WS_CLIENT_INVALID;
+    return ws_socks[fd].open ? HTTPD_WS_CLIENT_WEBSOCKET : HTTPD_WS_CLIENT_INVALID;
+}
+
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t hd, int fd, httpd_ws_frame_t *frame)
+{
+    if (httpd_ws_get_fd_info(hd, fd) != HTTPD_WS_CLIENT_WEBSOCKET)
+        return ESP_FAIL;
+    if (ws_socks[fd].len + frame->len + 1 >= sizeof(ws_socks[fd].frames))
+        return ESP_FAIL;
+    memcpy(ws_socks[fd].frames + ws_socks[fd].len, frame->payload, frame->len);
+    ws_socks[fd].len += frame->len;
+    ws_socks[fd].frames[ws_socks[fd].len++] = '\n';
+    ws_socks[fd].frames[ws_socks[fd].len] = 0;
+    return ESP_OK;
+}
+
+//client frame is the request body
+esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *frame, size_t max_len)
+{
+    frame->type = HTTPD_WS_TYPE_TEXT;
+    frame->final = true;
+    frame->len = req->content_len;
+    if (!max_len)
+        return ESP_OK;
+    if (max_len < frame->len)
+        return ESP_FAIL;
+    memcpy(frame->payload, req->body, frame->len);
+    return ESP_OK;
+}
+
+void esp_host_ws_open(int fd)
+{
+    ws_socks[fd].open = true;
+    ws_socks[fd].len = 0;
+    ws_socks[fd].frames[0] = 0;
+}
+
+void esp_host_ws_close(int fd)
+{
+    ws_socks[fd].open = false;
+}
+
+const char *esp_host_ws_take(int fd)
+{
+    static char taken[WS_FRAMES_SIZE];
+
+    memcpy(taken, ws_socks[fd].frames, ws_socks[fd].len + 1);
+    ws_socks[fd].len = 0;
+    ws_socks[fd].frames[0] = 0;
+    return taken;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef ESP_HOST_H_
+#define ESP_HOST_H_
+
+/* Minimal ESP-IDF API used by esp-supla, so its sources can be built and
+ * tested on Linux host. Headers named like ESP-IDF ones only include this
+ * file. NVS is kept in RAM, timers are fired by the test, HTTP requests
+ * are fed from memory and WebSocket frames are collected per socket. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+//esp_err.h
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_INVALID_VERSION 0x10A
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_HTTPD_RESULT_TRUNC 0xB004
+
+const char *esp_err_to_name(esp_err_t code);
+
+//esp_log.h
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) ((void)(tag))
+#define ESP_LOG_BUFFER_HEX(tag, buf, len) ((void)(buf), (void)(len))
+
+//freertos, one tick is one millisecond
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef struct host_sem *SemaphoreHandle_t;
+
+#define portMAX_DELAY UINT32_MAX
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define pdTRUE 1
+#define pdFALSE 0
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+//esp_system.h, esp_random.h, esp_mac.h, esp_heap_caps.h
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+typedef void (*shutdown_handler_t)(void);
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
+void esp_restart(void) __attribute__((noreturn));
+void esp_fill_random(void *buf, size_t len);
+esp_err_t esp_efuse_mac_get_default(uint8_t *mac);
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+//esp_timer.h
+typedef struct host_timer *esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+} esp_timer_create_args_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timer);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+
+//nvs.h, nvs_flash.h
+typedef uint32_t nvs_handle_t;
+typedef nvs_handle_t nvs_handle;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_commit(nvs_handle_t handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *len);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t len);
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *len);
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *value);
+esp_err_t nvs_get_i8(nvs_handle_t handle, const char *key, int8_t *value);
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key);
+esp_err_t nvs_erase_all(nvs_handle_t handle);
+
+//esp_netif.h, esp_wifi.h
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct {
+    struct {
+        uint32_t addr;
+    } ip, netmask, gw;
+} esp_netif_ip_info_t;
+
+typedef enum { ESP_IF_WIFI_STA, ESP_IF_WIFI_AP } wifi_interface_t;
+
+typedef union {
+    struct {
+        uint8_t ssid[32];
+        uint8_t password[64];
+    } sta;
+} wifi_config_t;
+
+typedef struct {
+    int8_t rssi;
+} wifi_ap_record_t;
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *key);
+esp_err_t esp_netif_get_ip_info(esp_netif_t *netif, esp_netif_ip_info_t *info);
+esp_err_t esp_wifi_get_config(wifi_interface_t iface, wifi_config_t *config);
+esp_err_t esp_wifi_set_config(wifi_interface_t iface, wifi_config_t *config);
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *info);
+
+//esp_http_server.h
+typedef void *httpd_handle_t;
+typedef enum { HTTP_GET = 1, HTTP_POST = 3 } httpd_method_t;
+typedef enum { HTTPD_400_BAD_REQUEST = 400, HTTPD_404_NOT_FOUND = 404 } httpd_err_code_t;
+
+#define HTTPD_TYPE_JSON "application/json"
+#define HTTPD_TYPE_TEXT "text/html"
+#define HTTPD_SOCK_ERR_FAIL -1
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+
+//request body is received from body in chunks of at most chunk bytes
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    int method;
+    const char *uri;
+    size_t content_len;
+    void *user_ctx;
+    const char *query;
+    const char *headers; //"Name: value" lines separated by '\n'
+    const char *body;
+    size_t chunk;
+    size_t received;
+    int timeouts; //HTTPD_SOCK_ERR_TIMEOUT results before body
+    int sockfd;
+} httpd_req_t;
+
+typedef enum { HTTPD_WS_TYPE_TEXT = 1 } httpd_ws_type_t;
+typedef enum {
+    HTTPD_WS_CLIENT_INVALID,
+    HTTPD_WS_CLIENT_HTTP,
+    HTTPD_WS_CLIENT_WEBSOCKET
+} httpd_ws_client_info_t;
+
+typedef struct {
+    bool final;
+    bool fragmented;
+    httpd_ws_type_t type;
+    uint8_t *payload;
+    size_t len;
+} httpd_ws_frame_t;
+
+typedef void (*httpd_work_fn_t)(void *arg);
+
+int httpd_req_recv(httpd_req_t *req, char *buf, size_t len);
+size_t httpd_req_get_url_query_len(httpd_req_t *req);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf, size_t len);
+esp_err_t httpd_query_key_value(const char *query, const char *key, char *val, size_t len);
+bool httpd_uri_match_wildcard(const char *tpl, const char *uri, size_t len);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *val, size_t len);
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field, const char *value);
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t len);
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t err, const char *msg);
+int httpd_req_to_sockfd(httpd_req_t *req);
+esp_err_t httpd_queue_work(httpd_handle_t hd, httpd_work_fn_t work, void *arg);
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd);
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t hd, int fd, httpd_ws_frame_t *frame);
+esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *frame, size_t max_len);
+
+//host test controls
+typedef struct {
+    uint32_t opens;
+    uint32_t blob_reads;  //nvs_get_blob() calls
+    uint32_t blob_writes; //nvs_set_blob() calls
+    uint32_t commits;
+} esp_host_nvs_stats_t;
+
+void esp_host_nvs_get_stats(esp_host_nvs_stats_t *stats);
+
+/* Stored blob, can be modified in place. NULL when key is not stored */
+uint8_t *esp_host_nvs_blob(const char *key, size_t *len);
+
+/* Run callbacks of started timers as if their timeouts expired, returns
+ * number of callbacks run. Periodic timers stay started */
+int esp_host_timers_fire(void);
+
+/* Response body sent by httpd_resp_send_chunk() since last call, len is set
+ * when given as body may be binary */
+const char *esp_host_resp_take(size_t *len);
+
+/* Status and header of last response, headers are kept until
+ * esp_host_resp_take(). NULL when header was not set */
+const char *esp_host_resp_status(void);
+const char *esp_host_resp_hdr(const char *field);
+
+/* Run work queued by httpd_queue_work() as httpd task would, returns
+ * number of work callbacks run */
+int esp_host_work_run(void);
+
+/* WebSocket connection on socket fd, from open until close. Frames sent
+ * to it are kept as text lines until taken */
+void esp_host_ws_open(int fd);
+void esp_host_ws_close(int fd);
+const char *esp_host_ws_take(int fd);
+
+#endif /* ESP_HOST_H_ */
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* form_parse() test: every body is received in chunks of every size from
+ * one byte up, so keys, values and % escapes are split at all positions. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_host.h>
+#include <esp-supla-form.h>
+
+#include "host_test.h"
+
+#define FIELDS 3
+
+typedef struct {
+    char value[FIELDS][FORM_VALUE_SIZE];
+    int calls[FIELDS];
+} form_result_t;
+
+static void field_set(form_result_t *result, int n, const char *value)
+{
+    CHECK(strlen(value) < FORM_VALUE_SIZE);
+    strcpy(result->value[n], value);
+    result->calls[n]++;
+}
+
+static void set_ssid(void *arg, const char *value)
+{
+    field_set(arg, 0, value);
+}
+
+static void set_password(void *arg, const char *value)
+{
+    field_set(arg, 1, value);
+}
+
+static void set_email(void *arg, const char *value)
+{
+    field_set(arg, 2, value);
+}
+
+static const form_field_t fields[FIELDS] = {
+    { "ssid", set_ssid },
+    { "password", set_password },
+    { "email", set_email },
+};
+
+static esp_err_t parse(const char *body, size_t chunk, int timeouts, form_result_t *result)
+{
+    httpd_req_t req = {
+        .method = HTTP_POST,
+        .content_len = strlen(body),
+        .body = body,
+        .chunk = chunk,
+        .timeouts = timeouts,
+    };
+
+    memset(result, 0, sizeof(*result));
+    return form_parse(&req, fields, FIELDS, result);
+}
+
+/* Parse body split in every chunk size, expected values are NULL for
+ * fields that must not be set */
+static void check_form(const char *body, esp_err_t err, const char *ssid, const char *password,
+                       const char *email)
+{
+    const char *expected[FIELDS] = { ssid, password, email };
+    form_result_t result;
+    size_t len = strlen(body);
+
+    for (size_t chunk = 1; chunk <= (len ? len : 1); chunk++) {
+        CHECK(parse(body, chunk, 0, &result) == err);
+        for (int i = 0; i < FIELDS; i++) {
+            if (!expected[i]) {
+                CHECK(result.calls[i] == 0);
+                continue;
+            }
+            if (result.calls[i] != 1 || strcmp(result.value[i], expected[i])) {
+                fprintf(stderr, "body '%.60s' chunk %zu field %s: '%s'\n", body, chunk,
+                        fields[i].key, result.value[i]);
+                CHECK(0);
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    char body[FORM_MAX_SIZE + 2];
+    char value[FORM_VALUE_SIZE + 1];
+    form_result_t result;
+    int n;
+
+    //escapes, '+' as space, '=' and '&' in escaped value
+    check_form("ssid=My+Net%21&password=a%3Db%26c%25&email=x%40y.z", ESP_OK, "My Net!", "a=b&c%",
+               "x@y.z");
+    check_form("email=%2f%2F%7e", ESP_OK, NULL, NULL, "//~");
+    check_form("ssid=a=b&&password=", ESP_OK, "a=b", "", NULL);
+    check_form("", ESP_OK, NULL, NULL, NULL);
+
+    //escaped key, unknown keys and key without value
+    check_form("%73sid=x&foo=bar&ssidx=y&password&email=e", ESP_OK, "x", "", "e");
+
+    //broken escape ends parsing, earlier fields are passed
+    check_form("ssid=x&password=%4g&email=e", ESP_ERR_INVALID_ARG, "x", NULL, NULL);
+    check_form("ssid=x&password=%4", ESP_ERR_INVALID_ARG, "x", NULL, NULL);
+    check_form("ssid=x&password=%", ESP_ERR_INVALID_ARG, "x", NULL, NULL);
+
+    //longest value fits, longer one is skipped with next field kept
+    memset(value, 'v', FORM_VALUE_SIZE - 1);
+    value[FORM_VALUE_SIZE - 1] = 0;
+    snprintf(body, sizeof(body), "ssid=%s&email=e", value);
+    check_form(body, ESP_OK, value, NULL, "e");
+    snprintf(body, sizeof(body), "ssid=%sv&email=e", value);
+    check_form(body, ESP_OK, NULL, NULL, "e");
+
+    //value length counts decoded characters
+    n = snprintf(body, sizeof(body), "password=");
+    for (int i = 0; i < FORM_VALUE_SIZE - 1; i++)
+        n += snprintf(body + n, sizeof(body) - n, "%%%02X", 'v');
+    check_form(body, ESP_OK, NULL, value, NULL);
+    snprintf(body + n, sizeof(body) - n, "%%41&ssid=s");
+    check_form(body, ESP_OK, "s", NULL, NULL);
+
+    //too long key is skipped even if its prefix is known
+    memset(value, 'k', FORM_KEY_SIZE);
+    memcpy(value, "ssid", 4);
+    value[FORM_KEY_SIZE] = 0;
+    snprintf(body, sizeof(body), "%s=x&email=e", value);
+    check_form(body, ESP_OK, NULL, NULL, "e");
+
+    //body size limit
+    memset(body, 'x', FORM_MAX_SIZE);
+    memcpy(body, "ssid=", 5);
+    body[FORM_MAX_SIZE] = 0;
+    CHECK(parse(body, FORM_RECV_SIZE, 0, &result) == ESP_OK);
+    body[FORM_MAX_SIZE] = 'x';
+    body[FORM_MAX_SIZE + 1] = 0;
+    CHECK(parse(body, FORM_RECV_SIZE, 0, &result) == ESP_ERR_INVALID_SIZE);
+    CHECK(result.calls[0] == 0);
+
+    //receive timeouts are retried
+    CHECK(parse("ssid=x", 1, FORM_RECV_RETRIES - 1, &result) == ESP_OK);
+    CHECK(result.calls[0] == 1 && !strcmp(result.value[0], "x"));
+    CHECK(parse("ssid=x", 1, FORM_RECV_RETRIES, &result) == ESP_ERR_TIMEOUT);
+    CHECK(result.calls[0] == 0);
+
+    printf("form test passed\n");
+    return 0;
+}
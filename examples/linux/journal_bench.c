@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Channel state journal benchmark: append rate on file backed journal and
+ * recovery after simulated power loss. Journal is a process wide singleton,
+ * every run is done in a child process that opens it from scratch. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include <esp-supla-journal.h>
+
+#define STATE_SIZE_MAX 256
+
+typedef struct {
+    int ok;
+    uint32_t recovery_us;
+    uint32_t torn;
+    uint32_t last;
+} recovery_result_t;
+
+static int channels = 8;
+static size_t state_size = 16;
+
+static uint64_t time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//state carries its counter repeated over the whole record
+static void state_fill(uint8_t *buf, uint32_t counter)
+{
+    for (size_t i = 0; i < state_size; i++)
+        buf[i] = counter >> (8 * (i % 4));
+}
+
+static int state_check(const uint8_t *buf, uint32_t *counter)
+{
+    *counter = buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+    for (size_t i = 4; i < state_size; i++) {
+        if (buf[i] != buf[i % 4])
+            return -1;
+    }
+    return 0;
+}
+
+/* Channels are written round robin so the latest counters of all channels
+ * must be consecutive, anything older means a lost record */
+static int journal_verify(uint32_t *last)
+{
+    uint8_t buf[STATE_SIZE_MAX];
+    uint32_t counter, min = UINT32_MAX, max = 0;
+
+    for (int ch = 0; ch < channels; ch++) {
+        if (supla_journal_restore(ch, buf, state_size) != 0) {
+            *last = 0;
+            return ch == 0 ? 0 : -1; //empty journal
+        }
+        if (state_check(buf, &counter) != 0 || counter % channels != (uint32_t)ch)
+            return -1;
+        min = counter < min ? counter : min;
+        max = counter > max ? counter : max;
+    }
+    *last = max;
+    return max - min < (uint32_t)channels ? 0 : -1;
+}
+
+static void journal_append(uint32_t first, uint32_t count)
+{
+    uint8_t buf[STATE_SIZE_MAX];
+
+    for (uint32_t counter = first; counter < first + count; counter++) {
+        state_fill(buf, counter);
+        if (supla_journal_store(counter % channels, buf, state_size) != 0) {
+            fprintf(stderr, "append %u failed\n", counter);
+            exit(2);
+        }
+    }
+}
+
+static void bench_append(uint32_t count)
+{
+    supla_journal_stats_t stats;
+    uint32_t record = 8 + ((state_size + 3) & ~3u);
+    uint64_t start;
+    double secs;
+
+    if (supla_journal_init() != 0)
+        exit(2);
+
+    start = time_us();
+    journal_append(0, count);
+    secs = (time_us() - start) / 1e6;
+
+    supla_journal_get_stats(&stats);
+    printf("append: %u records of %zu bytes in %.3f s, %.0f appends/s\n", count, state_size, secs,
+           count / secs);
+    printf("flash: sectors=%u erases=%u relocated=%u bytes/append=%.1f amplification=%.2f\n",
+           stats.sectors, stats.erases, stats.relocated,
+           (double)(stats.append_bytes + stats.relocated * record) / count,
+           (double)(stats.append_bytes + stats.relocated * record) / ((double)count * state_size));
+    exit(0);
+}
+
+//appends until SUPLA_JOURNAL_CUT_AFTER ends the process
+static void run_until_cut(uint32_t cut_after)
+{
+    char env[16];
+    uint32_t last;
+
+    snprintf(env, sizeof(env), "%u", cut_after);
+    setenv("SUPLA_JOURNAL_CUT_AFTER", env, 1);
+    if (supla_journal_init() != 0 || journal_verify(&last) != 0)
+        exit(2);
+    journal_append(last + 1, UINT32_MAX - last - 1);
+    exit(0);
+}
+
+static void run_recovery(int fd)
+{
+    recovery_result_t result = { 0 };
+    supla_journal_stats_t stats;
+    uint64_t start = time_us();
+
+    if (supla_journal_init() == 0) {
+        result.recovery_us = time_us() - start;
+        result.ok = journal_verify(&result.last) == 0;
+    }
+    supla_journal_get_stats(&stats);
+    result.torn = stats.torn;
+    if (write(fd, &result, sizeof(result)) != sizeof(result))
+        exit(2);
+    exit(0);
+}
+
+static int run_child(void (*fn)(uint32_t), uint32_t arg)
+{
+    pid_t pid = fork();
+    int status;
+
+    if (pid == 0)
+        fn(arg);
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int recover(recovery_result_t *result)
+{
+    int fds[2];
+    pid_t pid;
+    int rc;
+
+    if (pipe(fds) != 0)
+        return -1;
+    pid = fork();
+    if (pid == 0)
+        run_recovery(fds[1]);
+    rc = read(fds[0], result, sizeof(*result)) == sizeof(*result) ? 0 : -1;
+    waitpid(pid, NULL, 0);
+    close(fds[0]);
+    close(fds[1]);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = getenv("SUPLA_JOURNAL_FILE");
+    uint32_t appends = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+    int cuts = argc > 4 ? atoi(argv[4]) : 20;
+    recovery_result_t result;
+    uint64_t total_us = 0;
+    uint32_t max_us = 0, torn = 0;
+    int failed = 0;
+
+    channels = argc > 2 ? atoi(argv[2]) : channels;
+    state_size = argc > 3 ? strtoul(argv[3], NULL, 0) : state_size;
+    if (argc > 5 || channels <= 0 || state_size < 4 || state_size > STATE_SIZE_MAX) {
+        fprintf(stderr, "usage: %s [appends] [channels] [state_size] [power_cuts]\n", argv[0]);
+        return 1;
+    }
+
+    if (!path) {
+        path = "journal_bench.bin";
+        setenv("SUPLA_JOURNAL_FILE", path, 1);
+    }
+    unlink(path);
+    srandom(time(NULL));
+
+    if (run_child(bench_append, appends) != 0)
+        return 1;
+
+    for (int i = 0; i < cuts; i++) {
+        //cut somewhere within a few sector switches
+        if (run_child(run_until_cut, 1 + random() % 2000) != 1 || recover(&result) != 0)
+            return 1;
+        failed += !result.ok;
+        torn += result.torn;
+        total_us += result.recovery_us;
+        max_us = result.recovery_us > max_us ? result.recovery_us : max_us;
+    }
+    if (cuts > 0) {
+        printf("power cut: runs=%d failed=%d torn=%u recovery avg=%uus max=%uus\n", cuts, failed,
+               torn, (uint32_t)(total_us / cuts), max_us);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Channel state journal test on 2 and 4 sector file backed areas: latest
+ * states survive compaction and reopening, record cut by power loss is
+ * skipped as torn and cuts at any point leave consistent states. Journal is
+ * a process wide singleton, every step runs in a child process. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <esp-supla-journal.h>
+
+#include "host_test.h"
+
+#define SECTOR_SIZE 4096
+#define CHANNELS 8
+#define COLD_ID CHANNELS //written once, moved forward by compaction
+#define STATE_SIZE 16
+#define FILL_APPENDS 3000 //about 17 sector switches
+#define CUT_STEP 97       //power cut points spread over sector switch phases
+#define CUT_MAX 3000
+#define CUT_HEADER 1      //writes before first record: sector header
+#define CUT_RECORD 2      //writes per record: header and data
+
+static const char *journal_file = "journal_test.bin";
+
+//state carries its counter repeated over the whole record
+static void state_fill(uint8_t *buf, uint32_t counter)
+{
+    for (size_t i = 0; i < STATE_SIZE; i++)
+        buf[i] = counter >> (8 * (i % 4));
+}
+
+static void journal_append(uint32_t first, uint32_t count)
+{
+    uint8_t buf[STATE_SIZE];
+
+    for (uint32_t counter = first; counter - first < count; counter++) {
+        state_fill(buf, counter);
+        if (supla_journal_store(counter % CHANNELS, buf, sizeof(buf)) != 0)
+            exit(2); //not a power cut
+    }
+}
+
+/* Channels are written round robin so the latest counters of all channels
+ * must be consecutive, returns the highest one */
+static uint32_t journal_verify(void)
+{
+    uint8_t buf[STATE_SIZE], expected[STATE_SIZE];
+    uint32_t counter, min = UINT32_MAX, max = 0;
+
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        CHECK(supla_journal_restore(ch, buf, sizeof(buf)) == 0);
+        counter = buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+        state_fill(expected, counter);
+        CHECK(!memcmp(buf, expected, sizeof(buf)));
+        CHECK(counter % CHANNELS == (uint32_t)ch);
+        min = counter < min ? counter : min;
+        max = counter > max ? counter : max;
+    }
+    CHECK(max - min == CHANNELS - 1);
+    return max;
+}
+
+static void cold_check(void)
+{
+    uint8_t buf[STATE_SIZE], expected[STATE_SIZE];
+
+    state_fill(expected, COLD_ID);
+    CHECK(supla_journal_restore(COLD_ID, buf, sizeof(buf)) == 0);
+    CHECK(!memcmp(buf, expected, sizeof(buf)));
+}
+
+//exit status of fn run in child, fn exits itself
+static int run_child(void (*fn)(long), long arg)
+{
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        fn(arg);
+        exit(0);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void step_fill(long sectors)
+{
+    supla_journal_stats_t stats;
+    uint8_t buf[STATE_SIZE];
+
+    CHECK(supla_journal_init() == 0);
+    state_fill(buf, COLD_ID);
+    CHECK(supla_journal_store(COLD_ID, buf, sizeof(buf)) == 0);
+    journal_append(0, FILL_APPENDS);
+    CHECK(journal_verify() == FILL_APPENDS - 1);
+    cold_check();
+
+    supla_journal_get_stats(&stats);
+    printf("fill: sectors=%u appends=%u relocated=%u erases=%u lost=%u\n", stats.sectors,
+           stats.appends, stats.relocated, stats.erases, stats.lost);
+    CHECK(stats.sectors == (uint32_t)sectors);
+    CHECK(stats.records == CHANNELS + 1);
+    CHECK(stats.erases > FILL_APPENDS / (SECTOR_SIZE / (8 + STATE_SIZE)) - 1);
+    CHECK(stats.relocated > 0 && stats.lost == 0);
+}
+
+//reopened filled journal has latest states, torn count checked unless -1
+static void step_reopen(long torn)
+{
+    supla_journal_stats_t stats;
+
+    CHECK(supla_journal_init() == 0);
+    supla_journal_get_stats(&stats);
+    CHECK(stats.records == CHANNELS + 1 && stats.lost == 0);
+    CHECK(torn < 0 || stats.torn == (uint32_t)torn);
+    journal_verify();
+    cold_check();
+}
+
+//appends to fresh journal until cut, nth record write is cut
+static void step_cut(long cut_after)
+{
+    char env[16];
+
+    snprintf(env, sizeof(env), "%ld", cut_after);
+    setenv("SUPLA_JOURNAL_CUT_AFTER", env, 1);
+    CHECK(supla_journal_init() == 0);
+    journal_append(0, UINT32_MAX);
+}
+
+//continues states of previous run until cut, also recovery writes can be cut
+static void step_cut_continue(long cut_after)
+{
+    supla_journal_stats_t stats;
+    char env[16];
+
+    snprintf(env, sizeof(env), "%ld", cut_after);
+    setenv("SUPLA_JOURNAL_CUT_AFTER", env, 1);
+    CHECK(supla_journal_init() == 0);
+    supla_journal_get_stats(&stats);
+    CHECK(stats.lost == 0);
+    cold_check();
+    journal_append(journal_verify() + 1, UINT32_MAX);
+}
+
+//torn record is skipped, the one before it is the latest
+static void step_torn(long last)
+{
+    uint8_t buf[STATE_SIZE], expected[STATE_SIZE];
+    supla_journal_stats_t stats;
+
+    CHECK(supla_journal_init() == 0);
+    supla_journal_get_stats(&stats);
+    CHECK(stats.torn == 1);
+    CHECK(journal_verify() == (uint32_t)last);
+    CHECK(supla_journal_restore(last % CHANNELS, buf, sizeof(buf)) == 0);
+    state_fill(expected, last);
+    CHECK(!memcmp(buf, expected, sizeof(buf)));
+
+    //space of torn record is not reused, new records follow it
+    journal_append(last + 1, CHANNELS);
+    CHECK(journal_verify() == (uint32_t)last + CHANNELS);
+}
+
+static void test_area(int sectors)
+{
+    char env[16];
+    int n = 2 * CHANNELS; //records before the cut one
+
+    snprintf(env, sizeof(env), "%d", sectors * SECTOR_SIZE);
+    setenv("SUPLA_JOURNAL_SIZE", env, 1);
+
+    //compaction keeps the latest states, reopen finds them
+    unlink(journal_file);
+    CHECK(run_child(step_fill, sectors) == 0);
+    CHECK(run_child(step_reopen, 0) == 0);
+
+    //cut in record data and in record header
+    for (int part = CUT_RECORD; part > 0; part--) {
+        unlink(journal_file);
+        CHECK(run_child(step_cut, CUT_HEADER + CUT_RECORD * n + part) == 1);
+        CHECK(run_child(step_torn, n - 1) == 0);
+    }
+
+    //cuts in appends, sector switches and compaction
+    unlink(journal_file);
+    CHECK(run_child(step_fill, sectors) == 0);
+    for (int cut = 1; cut < CUT_MAX; cut += CUT_STEP)
+        CHECK(run_child(step_cut_continue, cut) == 1);
+    CHECK(run_child(step_reopen, -1) == 0);
+    printf("%d sectors passed\n", sectors);
+}
+
+int main(void)
+{
+    setenv("SUPLA_JOURNAL_FILE", journal_file, 1);
+    test_area(2);
+    test_area(4);
+    unlink(journal_file);
+    printf("journal test passed\n");
+    return 0;
+}
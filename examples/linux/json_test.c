@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Streaming JSON writer test: output matches the cJSON printer, compact or
+ * formatted as with CONFIG_ESP_LIBSUPLA_HTTPD_JSON_PRETTY, strings are
+ * escaped, values longer than the stack buffer are sent in chunks and
+ * errors are kept until json_writer_finish(). */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <esp_host.h>
+#include <esp-supla-json.h>
+
+#include "host_test.h"
+
+#define LONG_SIZE (3 * JSON_WRITER_BUF_SIZE + 7)
+#define RESP_LIMIT 20000 //more than esp_host response buffer
+
+#ifdef CONFIG_ESP_LIBSUPLA_HTTPD_JSON_PRETTY
+#define ARRAY_SEP ", "
+static const char expected[] = "{\n"
+                               "\t\"int\":\t0,\n"
+                               "\t\"min\":\t-9223372036854775808,\n"
+                               "\t\"max\":\t9223372036854775807,\n"
+                               "\t\"str\":\t\"q\\\"b\\\\ \\b\\f\\n\\r\\t\\u0001\\u001f\x7f\",\n"
+                               "\t\"k\\\"ey\":\tfalse,\n"
+                               "\t\"arr\":\t[1, -2, {\n"
+                               "\t\t\t\"ok\":\ttrue\n"
+                               "\t\t}, []],\n"
+                               "\t\"obj\":\t{\n"
+                               "\t},\n"
+                               "\t\"arr0\":\t[]\n"
+                               "}";
+#else
+#define ARRAY_SEP ","
+static const char expected[] = "{\"int\":0,"
+                               "\"min\":-9223372036854775808,"
+                               "\"max\":9223372036854775807,"
+                               "\"str\":\"q\\\"b\\\\ \\b\\f\\n\\r\\t\\u0001\\u001f\x7f\","
+                               "\"k\\\"ey\":false,"
+                               "\"arr\":[1,-2,{\"ok\":true},[]],"
+                               "\"obj\":{},"
+                               "\"arr0\":[]}";
+#endif
+
+static void check_values(void)
+{
+    httpd_req_t req = { 0 };
+    json_writer_t js;
+    const char *out;
+
+    json_writer_init(&js, &req);
+    json_obj_begin(&js, NULL);
+    json_int(&js, "int", 0);
+    json_int(&js, "min", INT64_MIN);
+    json_int(&js, "max", INT64_MAX);
+    json_str(&js, "str", "q\"b\\ \b\f\n\r\t\x01\x1f\x7f");
+    json_bool(&js, "k\"ey", false);
+    json_arr_begin(&js, "arr");
+    json_int(&js, NULL, 1);
+    json_int(&js, NULL, -2);
+    json_obj_begin(&js, NULL);
+    json_bool(&js, "ok", true);
+    json_obj_end(&js);
+    json_arr_begin(&js, NULL);
+    json_arr_end(&js);
+    json_arr_end(&js);
+    json_obj_begin(&js, "obj");
+    json_obj_end(&js);
+    json_arr_begin(&js, "arr0");
+    json_arr_end(&js);
+    json_obj_end(&js);
+    CHECK(json_writer_finish(&js) == ESP_OK);
+
+    out = esp_host_resp_take(NULL);
+    if (strcmp(out, expected)) {
+        fprintf(stderr, "got:\n%s\nexpected:\n%s\n", out, expected);
+        CHECK(0);
+    }
+}
+
+static size_t escape(char *out, const char *value)
+{
+    size_t len = 0;
+
+    for (; *value; value++) {
+        if (*value == '\n') {
+            out[len++] = '\\';
+            out[len++] = 'n';
+        } else {
+            out[len++] = *value;
+        }
+    }
+    return len;
+}
+
+//values longer than buffer, escapes split at every position of its boundary
+static void check_chunks(void)
+{
+    static char value[LONG_SIZE + 1];
+    static char out[4 * LONG_SIZE];
+    httpd_req_t req = { 0 };
+    json_writer_t js;
+    size_t len;
+
+    for (size_t i = 0; i < LONG_SIZE; i++)
+        value[i] = i % 3 ? 'v' : '\n';
+
+    for (size_t pad = 0; pad < 8; pad++) {
+        const char *head = value + LONG_SIZE - pad;
+
+        len = 0;
+        out[len++] = '[';
+        out[len++] = '"';
+        len += escape(out + len, head);
+        len += sprintf(out + len, "\"%s\"", ARRAY_SEP);
+        len += escape(out + len, value);
+        len += sprintf(out + len, "\"]");
+
+        json_writer_init(&js, &req);
+        json_arr_begin(&js, NULL);
+        json_str(&js, NULL, head);
+        json_str(&js, NULL, value);
+        json_arr_end(&js);
+        CHECK(json_writer_finish(&js) == ESP_OK);
+        CHECK(!strcmp(esp_host_resp_take(NULL), out));
+    }
+}
+
+//nesting limit and send failure fail the response, later output is dropped
+static void check_errors(void)
+{
+    static char value[RESP_LIMIT];
+    httpd_req_t req = { 0 };
+    json_writer_t js;
+
+    json_writer_init(&js, &req);
+    for (int i = 0; i < JSON_WRITER_MAX_DEPTH + 2; i++)
+        json_arr_begin(&js, NULL);
+    for (int i = 0; i < JSON_WRITER_MAX_DEPTH + 2; i++)
+        json_arr_end(&js);
+    CHECK(json_writer_finish(&js) == ESP_ERR_INVALID_STATE);
+    esp_host_resp_take(NULL);
+
+    memset(value, 'v', sizeof(value) - 1);
+    json_writer_init(&js, &req);
+    json_arr_begin(&js, NULL);
+    json_str(&js, NULL, value);
+    json_str(&js, NULL, "tail");
+    json_arr_end(&js);
+    CHECK(json_writer_finish(&js) == ESP_FAIL);
+    CHECK(!strstr(esp_host_resp_take(NULL), "tail"));
+}
+
+int main(void)
+{
+    check_values();
+    check_chunks();
+    check_errors();
+    printf("json test passed\n");
+    return 0;
+}
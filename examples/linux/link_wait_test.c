@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* supla_link_wait() test over loopback TCP: wait has to return as soon as
+ * the peer sends data or another thread calls supla_link_wakeup(), not when
+ * timeout expires, and has to keep the full timeout when nothing happens. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <port/net.h>
+#include <esp-supla-link.h>
+
+#include "host_test.h"
+
+#define WAIT_TIMEOUT_MS 5000
+#define EVENT_DELAY_MS 50
+#define EVENT_LATENCY_MAX_MS 500 //wait must end well before WAIT_TIMEOUT_MS
+#define CONNECT_TIMEOUT_MS 2000
+
+static int peer_fd = -1;
+
+static uint64_t time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int listen_loopback(int *port)
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addrlen = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &addrlen) != 0)
+        return -1;
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void *peer_send(void *arg)
+{
+    usleep(EVENT_DELAY_MS * 1000);
+    if (send(peer_fd, "x", 1, 0) != 1)
+        fprintf(stderr, "peer send failed: %d\n", errno);
+    return NULL;
+}
+
+static void *peer_wakeup(void *arg)
+{
+    usleep(EVENT_DELAY_MS * 1000);
+    supla_link_wakeup();
+    return NULL;
+}
+
+//run supla_link_wait() while fn triggers an event, returns wait time
+static uint32_t wait_for(void *(*fn)(void *), int *rc)
+{
+    pthread_t thread;
+    uint64_t start;
+
+    CHECK(pthread_create(&thread, NULL, fn, NULL) == 0);
+    start = time_ms();
+    *rc = supla_link_wait(WAIT_TIMEOUT_MS);
+    start = time_ms() - start;
+    pthread_join(thread, NULL);
+    return start;
+}
+
+int main(void)
+{
+    supla_link_metrics_t metrics;
+    supla_link_t link = NULL;
+    uint32_t elapsed;
+    uint64_t start;
+    char buf[8];
+    int listen_fd, port, rc;
+
+    listen_fd = listen_loopback(&port);
+    CHECK(listen_fd >= 0);
+    CHECK(supla_cloud_connect(&link, "127.0.0.1", port, 0) == SUPLA_RESULT_TRUE);
+    peer_fd = accept(listen_fd, NULL, NULL);
+    CHECK(peer_fd >= 0);
+
+    //connect completes in steps driven by wait and recv
+    start = time_ms();
+    do {
+        supla_link_wait(10);
+        rc = supla_cloud_recv(link, buf, sizeof(buf));
+        CHECK(rc < 0 && errno == EAGAIN);
+        CHECK(supla_link_get_metrics(0, &metrics) == 0);
+    } while (!metrics.ready && time_ms() - start < CONNECT_TIMEOUT_MS);
+    CHECK(metrics.ready);
+
+    //nothing happens: full timeout
+    start = time_ms();
+    rc = supla_link_wait(200);
+    elapsed = time_ms() - start;
+    printf("idle: rc=%d %u ms\n", rc, elapsed);
+    CHECK(rc == 0 && elapsed >= 190);
+
+    //incoming data
+    elapsed = wait_for(peer_send, &rc);
+    printf("data: rc=%d %u ms\n", rc, elapsed);
+    CHECK(rc > 0 && elapsed < EVENT_LATENCY_MAX_MS);
+    CHECK(supla_cloud_recv(link, buf, sizeof(buf)) == 1 && buf[0] == 'x');
+
+    //wakeup from other thread
+    elapsed = wait_for(peer_wakeup, &rc);
+    printf("wakeup: rc=%d %u ms\n", rc, elapsed);
+    CHECK(rc > 0 && elapsed < EVENT_LATENCY_MAX_MS);
+
+    //pending wakeup is consumed, next wait sleeps again
+    start = time_ms();
+    rc = supla_link_wait(100);
+    elapsed = time_ms() - start;
+    CHECK(rc == 0 && elapsed >= 90);
+
+    //closed link is no longer watched, timeout above one second still holds
+    CHECK(supla_cloud_disconnect(&link) == SUPLA_RESULT_TRUE);
+    start = time_ms();
+    rc = supla_link_wait(1200);
+    elapsed = time_ms() - start;
+    printf("no links: rc=%d %u ms\n", rc, elapsed);
+    CHECK(rc == 0 && elapsed >= 1190 && elapsed < 1200 + EVENT_LATENCY_MAX_MS);
+
+    close(peer_fd);
+    close(listen_fd);
+    printf("link wait test passed\n");
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <libsupla/device.h>
+#include <esp-supla-link.h>
+
+#define SUPLA_ITERATE_INTERVAL_MS 100
+#define STATS_INTERVAL_S 10
+
+static struct supla_config supla_config = {
+    .port = 2016,
+    .ssl = 1 //
+};
+
+//RELAY
+static int relay_set_value(supla_channel_t *ch, TSD_SuplaChannelNewValue *new_value)
+{
+    TRelayChannel_Value *relay_val = (TRelayChannel_Value *)new_value->value;
+
+    supla_log(LOG_INFO, "Relay set value %d", relay_val->hi);
+    return supla_channel_set_relay_value(ch, relay_val);
+}
+
+static supla_channel_config_t relay_channel_config = {
+    .type = SUPLA_CHANNELTYPE_RELAY,
+    .supported_functions = 0xFF,
+    .default_function = SUPLA_CHANNELFNC_LIGHTSWITCH,
+    .on_set_value = relay_set_value //
+};
+
+static int random_fill(void *buf, size_t len)
+{
+    int fd = open("/dev/urandom", O_RDONLY);
+    int rc;
+
+    if (fd < 0)
+        return -1;
+    rc = read(fd, buf, len) == (ssize_t)len ? 0 : -1;
+    close(fd);
+    return rc;
+}
+
+//monotonic time at start, first_ready_ms is counted from boot
+static uint64_t start_ms;
+
+static void print_link_stats(void)
+{
+    supla_link_stats_t stats;
+
+    supla_link_get_stats(&stats);
+    printf("tx: frames=%u writes=%u bytes=%u records_saved=%u overhead_saved=%u\n",
+           stats.tx_frames, stats.tx_writes, stats.tx_bytes, stats.tx_records_saved,
+           stats.tx_overhead_saved);
+    printf("rx: calls=%u reads=%u bytes=%u reads/call=%.2f\n", stats.rx_calls, stats.rx_reads,
+           stats.rx_bytes, stats.rx_calls ? (double)stats.rx_reads / stats.rx_calls : 0.0);
+    printf("tls: handshakes=%u offered=%u resumed=%u last=%ums avg=%ums\n", stats.tls_handshakes,
+           stats.tls_resume_offered, stats.tls_resumed, stats.tls_handshake_ms,
+           stats.tls_handshakes ? stats.tls_handshake_ms_total / stats.tls_handshakes : 0);
+    printf("dns: lookups=%u cache_hits=%u fallbacks=%u connect=%ums start_to_ready=%ums\n",
+           stats.dns_lookups, stats.dns_cache_hits, stats.dns_fallbacks, stats.connect_ms,
+           stats.first_ready_ms ? (uint32_t)(stats.first_ready_ms - start_ms) : 0);
+}
+
+int main(int argc, char *argv[])
+{
+    supla_dev_t *dev;
+    time_t last_stats = time(NULL);
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <server> <email> [port] [ssl]\n", argv[0]);
+        return 1;
+    }
+
+    strncpy(supla_config.server, argv[1], sizeof(supla_config.server) - 1);
+    strncpy(supla_config.email, argv[2], sizeof(supla_config.email) - 1);
+    if (argc > 3)
+        supla_config.port = atoi(argv[3]);
+    if (argc > 4)
+        supla_config.ssl = atoi(argv[4]);
+
+    random_fill(supla_config.guid, SUPLA_GUID_SIZE);
+    random_fill(supla_config.auth_key, SUPLA_AUTHKEY_SIZE);
+
+    dev = supla_dev_create("LINUX", NULL);
+    if (!dev)
+        return 1;
+
+    supla_dev_add_channel(dev, supla_channel_create(&relay_channel_config));
+    if (supla_dev_set_config(dev, &supla_config) != SUPLA_RESULT_TRUE)
+        return 1;
+
+    supla_dev_start(dev);
+    while (1) {
+        supla_dev_iterate(dev);
+        supla_link_wait(SUPLA_ITERATE_INTERVAL_MS);
+        if (time(NULL) - last_stats >= STATS_INTERVAL_S) {
+            print_link_stats();
+            last_stats = time(NULL);
+        }
+    }
+    return 0;
+}
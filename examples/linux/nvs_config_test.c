@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Packed config record test on RAM backed NVS: record written by
+ * supla_esp_nvs_config_write() is read back unchanged, any damaged or
+ * truncated record is rejected and legacy keys are migrated. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp-supla.h>
+#include <esp_host.h>
+
+#include "host_test.h"
+
+#define CONFIG_KEY "config"
+#define RECORD_MAXSIZE 512
+
+static void config_set(const char *key, const void *value, size_t len)
+{
+    nvs_handle_t nvs;
+
+    CHECK(nvs_open("supla_nvs", NVS_READWRITE, &nvs) == ESP_OK);
+    CHECK(nvs_set_blob(nvs, key, value, len) == ESP_OK);
+    nvs_close(nvs);
+}
+
+static int config_equal(const struct supla_config *a, const struct supla_config *b)
+{
+    return !strcmp(a->email, b->email) && !strcmp(a->server, b->server) &&
+           a->port == b->port && a->ssl == b->ssl &&
+           !memcmp(a->guid, b->guid, SUPLA_GUID_SIZE) &&
+           !memcmp(a->auth_key, b->auth_key, SUPLA_AUTHKEY_SIZE);
+}
+
+int main(void)
+{
+    struct supla_config config = { 0 };
+    struct supla_config read;
+    uint8_t record[RECORD_MAXSIZE];
+    size_t len;
+    int32_t port = 2015;
+    int8_t ssl = 1;
+
+    //empty NVS: credentials generated and stored as one record
+    CHECK(supla_esp_nvs_config_init(&config) == ESP_OK);
+    CHECK(esp_host_nvs_blob(CONFIG_KEY, &len));
+    memset(&read, 0, sizeof(read));
+    CHECK(supla_esp_nvs_config_init(&read) == ESP_OK);
+    CHECK(config_equal(&config, &read));
+
+    //all fields survive pack and unpack, longest strings too
+    memset(config.email, 'e', SUPLA_EMAIL_MAXSIZE - 1);
+    config.email[SUPLA_EMAIL_MAXSIZE - 1] = 0;
+    memset(config.server, 's', SUPLA_SERVER_NAME_MAXSIZE - 1);
+    config.server[SUPLA_SERVER_NAME_MAXSIZE - 1] = 0;
+    config.port = 2016;
+    config.ssl = 1;
+    CHECK(supla_esp_nvs_config_write(&config) == ESP_OK);
+    memset(&read, 0, sizeof(read));
+    CHECK(supla_esp_nvs_config_init(&read) == ESP_OK);
+    CHECK(config_equal(&config, &read));
+
+    strcpy(config.email, "user@example.com");
+    strcpy(config.server, "svr1.supla.org");
+    CHECK(supla_esp_nvs_config_write(&config) == ESP_OK);
+    memcpy(record, esp_host_nvs_blob(CONFIG_KEY, &len), len);
+    CHECK(len <= sizeof(record));
+    memset(&read, 0, sizeof(read));
+    CHECK(supla_esp_nvs_config_init(&read) == ESP_OK);
+    CHECK(config_equal(&config, &read));
+
+    //any damaged byte fails CRC, record is then written again from scratch
+    for (size_t i = 0; i < len; i++) {
+        for (int bit = 0; bit < 8; bit++) {
+            record[i] ^= 1 << bit;
+            config_set(CONFIG_KEY, record, len);
+            record[i] ^= 1 << bit;
+
+            memset(&read, 0, sizeof(read));
+            CHECK(supla_esp_nvs_config_init(&read) == ESP_OK);
+            CHECK(!config_equal(&config, &read));
+            CHECK(read.email[0] == 0 && read.server[0] == 0);
+        }
+    }
+
+    //truncated and extended records
+    for (size_t i = 0; i < len + 4; i++) {
+        if (i == len)
+            continue;
+        config_set(CONFIG_KEY, record, i);
+        memset(&read, 0, sizeof(read));
+        CHECK(supla_esp_nvs_config_init(&read) == ESP_OK);
+        CHECK(!config_equal(&config, &read));
+    }
+
+    //keys of older versions are moved to record
+    CHECK(supla_esp_nvs_data_erase() == ESP_OK);
+    config_set("guid", config.guid, SUPLA_GUID_SIZE);
+    config_set("auth_key", config.auth_key, SUPLA_AUTHKEY_SIZE);
+    config_set("email", config.email, strlen(config.email) + 1);
+    config_set("server", config.server, strlen(config.server) + 1);
+    config_set("port", &port, sizeof(port));
+    config_set("ssl", &ssl, sizeof(ssl));
+    memset(&read, 0, sizeof(read));
+    CHECK(supla_esp_nvs_config_init(&read) == ESP_OK);
+    config.port = port;
+    CHECK(config_equal(&config, &read));
+    CHECK(esp_host_nvs_blob(CONFIG_KEY, &len));
+    CHECK(!esp_host_nvs_blob("guid", &len) && !esp_host_nvs_blob("port", &len));
+    memset(&read, 0, sizeof(read));
+    CHECK(supla_esp_nvs_config_init(&read) == ESP_OK);
+    CHECK(config_equal(&config, &read));
+
+    printf("nvs config test passed\n");
+    return 0;
+}
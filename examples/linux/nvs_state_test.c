@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Channel state cache test on RAM backed NVS: blob is read once per channel,
+ * written only when state differs from stored one and only by delayed flush,
+ * run by timer until supla_esp_dev_iterate() is used and by it later.
+ * Devices in registry keep states of equal channel numbers apart. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp-supla.h>
+#include <esp_host.h>
+
+#include "host_test.h"
+
+typedef struct {
+    uint8_t on;
+    uint8_t level;
+    uint16_t counter;
+} test_state_t;
+
+static int test_set_value(supla_channel_t *ch, TSD_SuplaChannelNewValue *new_value)
+{
+    return 0;
+}
+
+static supla_channel_config_t test_channel_config = {
+    .type = SUPLA_CHANNELTYPE_RELAY,
+    .supported_functions = 0xFF,
+    .default_function = SUPLA_CHANNELFNC_LIGHTSWITCH,
+    .on_set_value = test_set_value //
+};
+
+static void check_stats(uint32_t flash_reads, uint32_t blob_writes, uint32_t commits)
+{
+    supla_esp_nvs_stats_t stats;
+
+    CHECK(supla_esp_nvs_get_stats(&stats) == ESP_OK);
+    printf("stores=%u flash_reads=%u coalesced=%u blob_writes=%u commits=%u\n",
+           (unsigned)stats.stores, (unsigned)stats.flash_reads, (unsigned)stats.coalesced,
+           (unsigned)stats.blob_writes, (unsigned)stats.commits);
+    CHECK(stats.flash_reads == flash_reads);
+    CHECK(stats.blob_writes == blob_writes);
+    CHECK(stats.commits == commits);
+}
+
+//delay expires, flush is done by device loop
+static void flush_delayed(supla_dev_t *dev, int timers)
+{
+    CHECK(esp_host_timers_fire() == timers);
+    supla_esp_dev_iterate(dev);
+}
+
+int main(void)
+{
+    supla_channel_t *ch0, *ch1, *other_ch0;
+    supla_dev_t *dev, *other;
+    test_state_t state, saved = { .on = 1, .level = 40, .counter = 7 };
+    test_state_t first = { .on = 1, .level = 100, .counter = 1 };
+    test_state_t second = { .on = 0, .level = 100, .counter = 2 };
+    esp_host_nvs_stats_t host;
+    nvs_handle_t nvs;
+    size_t len;
+    int id;
+
+    dev = supla_dev_create("NVS TEST", NULL);
+    CHECK(dev);
+    ch0 = supla_channel_create(&test_channel_config);
+    ch1 = supla_channel_create(&test_channel_config);
+    CHECK(supla_dev_add_channel(dev, ch0) == SUPLA_RESULT_TRUE);
+    CHECK(supla_dev_add_channel(dev, ch1) == SUPLA_RESULT_TRUE);
+
+    //state of ch1 stored before boot
+    CHECK(nvs_open("supla_nvs", NVS_READWRITE, &nvs) == ESP_OK);
+    CHECK(nvs_set_blob(nvs, "ch01", &saved, sizeof(saved)) == ESP_OK);
+    nvs_close(nvs);
+
+    //restored: one read, later restores come from RAM
+    memset(&state, 0, sizeof(state));
+    CHECK(supla_esp_nvs_channel_state_restore(ch1, &state, sizeof(state)) == ESP_OK);
+    CHECK(!memcmp(&state, &saved, sizeof(state)));
+    check_stats(1, 0, 0);
+    memset(&state, 0, sizeof(state));
+    CHECK(supla_esp_nvs_channel_state_restore(ch1, &state, sizeof(state)) == ESP_OK);
+    CHECK(!memcmp(&state, &saved, sizeof(state)));
+    check_stats(1, 0, 0);
+
+    //device loop without supla_esp_dev_iterate(): timer writes
+    CHECK(supla_esp_nvs_channel_state_store(ch1, &second, sizeof(second)) == ESP_OK);
+    check_stats(1, 0, 0);
+    CHECK(esp_host_timers_fire() == 1);
+    check_stats(1, 1, 1);
+    CHECK(!memcmp(esp_host_nvs_blob("ch01", &len), &second, sizeof(second)));
+    CHECK(supla_esp_nvs_channel_state_store(ch1, &saved, sizeof(saved)) == ESP_OK);
+    CHECK(esp_host_timers_fire() == 1);
+    check_stats(1, 2, 2);
+
+    //unchanged: store of restored state is not written
+    CHECK(supla_esp_nvs_channel_state_store(ch1, &saved, sizeof(saved)) == ESP_OK);
+    flush_delayed(dev, 0);
+    check_stats(1, 2, 2);
+
+    //channel without blob keeps caller defaults
+    state = first;
+    CHECK(supla_esp_nvs_channel_state_restore(ch0, &state, sizeof(state)) == ESP_OK);
+    CHECK(!memcmp(&state, &first, sizeof(state)));
+    check_stats(2, 2, 2);
+
+    //changed: written once by delayed flush, not by store
+    CHECK(supla_esp_nvs_channel_state_store(ch0, &first, sizeof(first)) == ESP_OK);
+    CHECK(supla_esp_nvs_channel_state_store(ch0, &second, sizeof(second)) == ESP_OK);
+    CHECK(supla_esp_nvs_channel_state_store(ch0, &first, sizeof(first)) == ESP_OK);
+    check_stats(2, 2, 2);
+    flush_delayed(dev, 1);
+    check_stats(2, 3, 3);
+    len = 0;
+    CHECK(esp_host_nvs_blob("ch00", &len) && len == sizeof(first));
+    CHECK(!memcmp(esp_host_nvs_blob("ch00", &len), &first, sizeof(first)));
+
+    //timer alone does not write, flush waits for device loop
+    CHECK(supla_esp_nvs_channel_state_store(ch0, &second, sizeof(second)) == ESP_OK);
+    CHECK(esp_host_timers_fire() == 1);
+    check_stats(2, 3, 3);
+    supla_esp_dev_iterate(dev);
+    check_stats(2, 4, 4);
+
+    //changed and changed back before flush: nothing to write
+    CHECK(supla_esp_nvs_channel_state_store(ch0, &first, sizeof(first)) == ESP_OK);
+    CHECK(supla_esp_nvs_channel_state_store(ch0, &second, sizeof(second)) == ESP_OK);
+    flush_delayed(dev, 1);
+    check_stats(2, 4, 4);
+
+    //both channels changed: one commit
+    CHECK(supla_esp_nvs_channel_state_store(ch0, &first, sizeof(first)) == ESP_OK);
+    CHECK(supla_esp_nvs_channel_state_store(ch1, &second, sizeof(second)) == ESP_OK);
+    CHECK(supla_esp_nvs_channel_state_flush() == ESP_OK);
+    check_stats(2, 6, 5);
+    CHECK(esp_host_timers_fire() == 0);
+
+    //restore after writes reads nothing
+    CHECK(supla_esp_nvs_channel_state_restore(ch1, &state, sizeof(state)) == ESP_OK);
+    CHECK(!memcmp(&state, &second, sizeof(state)));
+    check_stats(2, 6, 5);
+
+    esp_host_nvs_get_stats(&host);
+    CHECK(host.blob_reads == 2 && host.blob_writes == 7 && host.commits == 5);
+
+    //registered devices: channel 0 of second one has own state and key
+    CHECK(supla_esp_dev_register(dev, &id) == ESP_OK && id == 0);
+    other = supla_dev_create("NVS TEST 2", NULL);
+    CHECK(other);
+    CHECK(supla_esp_dev_register(other, &id) == ESP_OK && id == 1);
+    other_ch0 = supla_channel_create(&test_channel_config);
+    CHECK(supla_esp_add_channel(other, other_ch0, &test_channel_config) == ESP_OK);
+    CHECK(supla_channel_get_assigned_number(other_ch0) == 0);
+    state = saved;
+    CHECK(supla_esp_nvs_channel_state_restore(other_ch0, &state, sizeof(state)) == ESP_OK);
+    CHECK(!memcmp(&state, &saved, sizeof(state)));
+    CHECK(supla_esp_nvs_channel_state_store(other_ch0, &second, sizeof(second)) == ESP_OK);
+    CHECK(supla_esp_nvs_channel_state_flush() == ESP_OK);
+    CHECK(!memcmp(esp_host_nvs_blob("d1ch00", &len), &second, sizeof(second)));
+    CHECK(!memcmp(esp_host_nvs_blob("ch00", &len), &first, sizeof(first)));
+    CHECK(supla_esp_nvs_channel_state_restore(ch0, &state, sizeof(state)) == ESP_OK);
+    CHECK(!memcmp(&state, &first, sizeof(state)));
+
+    printf("nvs state test passed\n");
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* WebSocket push test: new client gets device and channel states of its
+ * own device, then only changes of them. Client whose queue overflows gets
+ * full state again, closed clients are removed and others over the limit
+ * are rejected. Frames are sent by queued httpd work run by the test. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp-supla.h>
+#include <esp_host.h>
+
+#include "host_test.h"
+
+#define FD_DEV 3
+#define FD_OTHER 4
+#define FD_NEXT 5
+#define LONG_STATE 65 //longer than pushed states
+
+typedef struct {
+    uint8_t on;
+    uint8_t level;
+    uint16_t counter;
+} test_state_t;
+
+static int test_set_value(supla_channel_t *ch, TSD_SuplaChannelNewValue *new_value)
+{
+    return 0;
+}
+
+static supla_channel_config_t test_channel_config = {
+    .type = SUPLA_CHANNELTYPE_RELAY,
+    .supported_functions = 0xFF,
+    .default_function = SUPLA_CHANNELFNC_LIGHTSWITCH,
+    .on_set_value = test_set_value //
+};
+
+static esp_err_t subscribe(supla_dev_t **dev, int fd)
+{
+    httpd_req_t req = { .method = HTTP_GET, .uri = "/ws", .user_ctx = dev, .sockfd = fd };
+
+    esp_host_ws_open(fd);
+    return supla_dev_ws_handler(&req);
+}
+
+static void store(supla_channel_t *ch, uint8_t level, uint16_t counter)
+{
+    test_state_t state = { .on = 1, .level = level, .counter = counter };
+
+    CHECK(supla_esp_nvs_channel_state_store(ch, &state, sizeof(state)) == ESP_OK);
+}
+
+//frames sent to fd are exactly the expected lines
+static void check_frames(int fd, const char *expected)
+{
+    const char *frames = esp_host_ws_take(fd);
+
+    if (strcmp(frames, expected)) {
+        fprintf(stderr, "fd %d got:\n%sexpected:\n%s", fd, frames, expected);
+        CHECK(0);
+    }
+}
+
+//full state: device event followed by channel events
+static void check_snapshot(int fd, const char *channels)
+{
+    const char *frames = esp_host_ws_take(fd);
+    const char *dev_end = strchr(frames, '\n');
+
+    CHECK(!strncmp(frames, "{\"dev\":{\"state\":\"", 17));
+    CHECK(dev_end && !strcmp(dev_end + 1, channels));
+}
+
+int main(void)
+{
+    supla_dev_t *dev, *other;
+    supla_channel_t *ch0, *ch1, *ch2, *other_ch0;
+    uint8_t long_state[LONG_STATE] = { 0 };
+    httpd_req_t req = { .method = 0, .user_ctx = &dev, .sockfd = FD_DEV };
+
+    dev = supla_dev_create("Push test", NULL);
+    other = supla_dev_create("Push test 2", NULL);
+    CHECK(dev && other);
+    ch0 = supla_channel_create(&test_channel_config);
+    ch1 = supla_channel_create(&test_channel_config);
+    ch2 = supla_channel_create(&test_channel_config);
+    other_ch0 = supla_channel_create(&test_channel_config);
+    CHECK(supla_esp_add_channel(dev, ch0, &test_channel_config) == ESP_OK);
+    CHECK(supla_esp_add_channel(dev, ch1, &test_channel_config) == ESP_OK);
+    CHECK(supla_esp_add_channel(dev, ch2, &test_channel_config) == ESP_OK);
+    CHECK(supla_esp_add_channel(other, other_ch0, &test_channel_config) == ESP_OK);
+
+    //no clients, nothing queued
+    store(ch0, 0x28, 7);
+    store(other_ch0, 0x64, 1);
+    CHECK(esp_host_work_run() == 0);
+
+    //snapshot of own device only
+    CHECK(subscribe(&dev, FD_DEV) == ESP_OK);
+    CHECK(subscribe(&other, FD_OTHER) == ESP_OK);
+    CHECK(esp_host_work_run() == 1);
+    check_snapshot(FD_DEV, "{\"ch\":0,\"state\":\"01280700\"}\n");
+    check_snapshot(FD_OTHER, "{\"ch\":0,\"state\":\"01640100\"}\n");
+
+    //changes go to clients of their device, unchanged state is not pushed
+    store(ch0, 0x28, 8);
+    store(ch1, 0x10, 1);
+    store(ch1, 0x10, 1);
+    store(other_ch0, 0x64, 2);
+    CHECK(esp_host_work_run() == 1);
+    check_frames(FD_DEV, "{\"ch\":0,\"state\":\"01280800\"}\n"
+                         "{\"ch\":1,\"state\":\"01100100\"}\n");
+    check_frames(FD_OTHER, "{\"ch\":0,\"state\":\"01640200\"}\n");
+    CHECK(esp_host_work_run() == 0);
+
+    //too long state is not pushed, nor sent in full state
+    CHECK(supla_esp_nvs_channel_state_store(ch2, long_state, sizeof(long_state)) == ESP_OK);
+    CHECK(esp_host_work_run() == 0);
+    check_frames(FD_DEV, "");
+
+    //unchanged device state is not reported by poll
+    CHECK(esp_host_timers_fire() >= 1);
+    CHECK(esp_host_work_run() == 0);
+
+    //queue overflow drops events, full state is sent instead
+    for (int i = 0; i < 64; i++)
+        store(ch0, 0x30, i);
+    CHECK(esp_host_work_run() == 1);
+    check_snapshot(FD_DEV, "{\"ch\":0,\"state\":\"01303f00\"}\n"
+                           "{\"ch\":1,\"state\":\"01100100\"}\n");
+    check_frames(FD_OTHER, "");
+
+    //client limit, closed client is reclaimed by next one
+    CHECK(subscribe(&dev, FD_NEXT) == ESP_ERR_NO_MEM);
+    esp_host_ws_close(FD_OTHER);
+    CHECK(subscribe(&other, FD_NEXT) == ESP_OK);
+    CHECK(esp_host_work_run() == 1);
+    check_snapshot(FD_NEXT, "{\"ch\":0,\"state\":\"01640200\"}\n");
+
+    //client closed meanwhile is dropped, its slot goes to next client
+    esp_host_ws_close(FD_DEV);
+    store(ch0, 0x40, 1);
+    CHECK(esp_host_work_run() == 1);
+    CHECK(subscribe(&dev, FD_OTHER) == ESP_OK);
+    CHECK(esp_host_work_run() == 1);
+    check_snapshot(FD_OTHER, "{\"ch\":0,\"state\":\"01400100\"}\n"
+                             "{\"ch\":1,\"state\":\"01100100\"}\n");
+
+    //client messages are read and dropped, too long ones rejected
+    req.body = "ping";
+    req.content_len = strlen(req.body);
+    CHECK(supla_dev_ws_handler(&req) == ESP_OK);
+    req.body = "0123456789012345678901234567890123456789";
+    req.content_len = strlen(req.body);
+    CHECK(supla_dev_ws_handler(&req) == ESP_ERR_INVALID_SIZE);
+
+    printf("push test passed\n");
+    return 0;
+}
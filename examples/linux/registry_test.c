@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Device registry test: lowest free id is assigned, array grows past its
+ * initial capacity and freed ids are reused. Requests to /supla/<id> and
+ * /supla/<id>/config reach handlers of that device, any other URI or id
+ * gets 404. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp-supla.h>
+#include <esp_host.h>
+
+#include "host_test.h"
+
+#define DEVICES 10
+#define CAPACITY 16 //grown 4, 8, 16
+
+static supla_dev_t *dev[DEVICES];
+
+static const char *route(const char *uri, const char *query)
+{
+    int user_ctx;
+    httpd_req_t req = { .method = HTTP_GET, .uri = uri, .query = query, .user_ctx = &user_ctx };
+
+    CHECK(supla_dev_registry_httpd_handler(&req) == ESP_OK);
+    CHECK(req.user_ctx == &user_ctx);
+    return esp_host_resp_take(NULL);
+}
+
+//API request reaches device n, checked by its email
+static void check_api(const char *uri, int n)
+{
+    char email[32];
+
+    snprintf(email, sizeof(email), "\"email\":\"dev%d@example.com\"", n);
+    CHECK(strstr(route(uri, "action=get_config"), email));
+}
+
+static void check_not_found(const char *uri)
+{
+    const char *out = route(uri, NULL);
+
+    if (strncmp(out, "404", 3)) {
+        fprintf(stderr, "%s: %.60s\n", uri, out);
+        CHECK(0);
+    }
+}
+
+static void check_stats(int devices, int capacity)
+{
+    supla_esp_registry_stats_t stats;
+
+    CHECK(supla_esp_dev_registry_get_stats(&stats) == ESP_OK);
+    CHECK(stats.devices == devices && stats.capacity == capacity);
+    CHECK(stats.bytes == capacity * sizeof(supla_dev_t *));
+}
+
+int main(void)
+{
+    struct supla_config config = { .port = 2016 };
+    supla_dev_t *extra;
+    char name[32];
+    int id;
+
+    //nothing registered yet
+    CHECK(supla_esp_dev_get(0) == NULL);
+    CHECK(supla_esp_dev_unregister(0) == ESP_ERR_NOT_FOUND);
+    check_stats(0, 0);
+    check_not_found("/supla/0");
+
+    for (int i = 0; i < DEVICES; i++) {
+        snprintf(name, sizeof(name), "Registry %d", i);
+        dev[i] = supla_dev_create(name, NULL);
+        CHECK(dev[i]);
+        snprintf(config.email, sizeof(config.email), "dev%d@example.com", i);
+        CHECK(supla_dev_set_config(dev[i], &config) == SUPLA_RESULT_TRUE);
+        CHECK(supla_esp_dev_register(dev[i], &id) == ESP_OK && id == i);
+    }
+    CHECK(supla_esp_dev_register(NULL, &id) == ESP_ERR_INVALID_ARG);
+    check_stats(DEVICES, CAPACITY);
+    for (int i = 0; i < DEVICES; i++) {
+        CHECK(supla_esp_dev_get(i) == dev[i]);
+        CHECK(supla_esp_dev_get_id(dev[i]) == i);
+    }
+    CHECK(supla_esp_dev_get(DEVICES) == NULL && supla_esp_dev_get(-1) == NULL);
+    CHECK(supla_esp_dev_registry_iterate() == DEVICES);
+
+    //routing by id, with and without query, config page of device
+    check_api("/supla/0", 0);
+    check_api("/supla/9", 9);
+    check_api("/supla/3?action=get_config", 3);
+    CHECK(strstr(route("/supla/7/config", NULL), "Registry 7"));
+    CHECK(strstr(route("/supla/7/config?x=1", NULL), "Registry 7"));
+
+    //unknown URIs and ids
+    check_not_found("/supla");
+    check_not_found("/supla/");
+    check_not_found("/supla/x");
+    check_not_found("/supla/10");
+    check_not_found("/supla/-1");
+    check_not_found("/supla/1x");
+    check_not_found("/supla/1/configx");
+    check_not_found("/supla/1/state");
+    check_not_found("/suplax/1");
+
+    //freed ids are reused lowest first, capacity is kept
+    CHECK(supla_esp_dev_unregister(7) == ESP_OK);
+    CHECK(supla_esp_dev_unregister(3) == ESP_OK);
+    CHECK(supla_esp_dev_unregister(3) == ESP_ERR_NOT_FOUND);
+    check_stats(DEVICES - 2, CAPACITY);
+    CHECK(supla_esp_dev_get(3) == NULL && supla_esp_dev_get_id(dev[3]) == -1);
+    check_not_found("/supla/3");
+    CHECK(supla_esp_dev_registry_iterate() == DEVICES - 2);
+
+    extra = supla_dev_create("Registry extra", NULL);
+    CHECK(extra);
+    CHECK(supla_esp_dev_register(extra, &id) == ESP_OK && id == 3);
+    CHECK(strstr(route("/supla/3/config", NULL), "Registry extra"));
+    CHECK(supla_esp_dev_register(dev[3], &id) == ESP_OK && id == 7);
+    check_api("/supla/7", 3);
+    check_stats(DEVICES, CAPACITY);
+
+    printf("registry test passed\n");
+    return 0;
+}
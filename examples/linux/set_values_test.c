@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* HTTP API action=set_values test: posted values are applied together by
+ * the thread calling supla_esp_dev_iterate() and their results returned.
+ * Batch with any invalid value is rejected as whole, GET is refused and
+ * without device loop request times out, its values are never applied. */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <esp-supla.h>
+#include <esp_host.h>
+
+#include "host_test.h"
+
+#define CHANNELS 3
+#define BATCH_MAX 16 //values in one request
+
+static supla_dev_t *dev;
+static pthread_t loop_thread;
+static volatile bool loop_run;
+static volatile int loop_pass;
+
+static struct {
+    int calls;
+    int pass; //device loop pass of last call
+    bool in_loop;
+    char value[SUPLA_CHANNELVALUE_SIZE];
+} applied[CHANNELS];
+
+static int test_set_value(supla_channel_t *ch, TSD_SuplaChannelNewValue *new_value)
+{
+    int n = new_value->ChannelNumber;
+
+    CHECK(n >= 0 && n < CHANNELS && n == supla_channel_get_assigned_number(ch));
+    applied[n].calls++;
+    applied[n].pass = loop_pass;
+    applied[n].in_loop = pthread_equal(pthread_self(), loop_thread);
+    memcpy(applied[n].value, new_value->value, sizeof(applied[n].value));
+    return 10 + n;
+}
+
+static supla_channel_config_t test_channel_config = {
+    .type = SUPLA_CHANNELTYPE_RELAY,
+    .supported_functions = 0xFF,
+    .default_function = SUPLA_CHANNELFNC_LIGHTSWITCH,
+    .on_set_value = test_set_value //
+};
+
+static void *device_loop(void *arg)
+{
+    while (loop_run) {
+        supla_esp_dev_iterate(dev);
+        loop_pass++;
+        usleep(1000);
+    }
+    return NULL;
+}
+
+static void loop_start(void)
+{
+    loop_run = true;
+    CHECK(pthread_create(&loop_thread, NULL, device_loop, NULL) == 0);
+}
+
+static void loop_stop(void)
+{
+    loop_run = false;
+    pthread_join(loop_thread, NULL);
+}
+
+static const char *request(int method, const char *body)
+{
+    httpd_req_t req = {
+        .method = method,
+        .uri = "/",
+        .user_ctx = &dev,
+        .query = "action=set_values",
+        .content_len = strlen(body),
+        .body = body,
+        .chunk = 64,
+    };
+
+    CHECK(supla_dev_httpd_handler(&req) == ESP_OK);
+    return esp_host_resp_take(NULL);
+}
+
+static void check_error(int method, const char *body, esp_err_t err)
+{
+    char expected[96];
+    int calls[CHANNELS];
+    const char *out;
+
+    for (int i = 0; i < CHANNELS; i++)
+        calls[i] = applied[i].calls;
+    snprintf(expected, sizeof(expected), "{\"error\":{\"code\":%d,\"title\":\"%s\"}}", err,
+             esp_err_to_name(err));
+    out = request(method, body);
+    if (strcmp(out, expected)) {
+        fprintf(stderr, "body %s got:\n%s\nexpected:\n%s\n", body, out, expected);
+        CHECK(0);
+    }
+    for (int i = 0; i < CHANNELS; i++)
+        CHECK(applied[i].calls == calls[i]);
+}
+
+int main(void)
+{
+    const char value0[SUPLA_CHANNELVALUE_SIZE] = { 0x01 };
+    const char value2[SUPLA_CHANNELVALUE_SIZE] = { 0x12, 0x34, 0, 0, 0, 0, 0, (char)0xab };
+    supla_channel_t *ch;
+    char body[512];
+    int n;
+
+    dev = supla_dev_create("Set values test", NULL);
+    CHECK(dev);
+    for (int i = 0; i < CHANNELS; i++) {
+        ch = supla_channel_create(&test_channel_config);
+        CHECK(supla_esp_add_channel(dev, ch, &test_channel_config) == ESP_OK);
+    }
+
+    loop_start();
+
+    //values applied in one pass of device loop, results in request order
+    CHECK(!strcmp(request(HTTP_POST, "ch=2&value=12340000000000ab&ch=0&value=01"),
+                  "{\"data\":{\"applied\":2,\"results\":[{\"number\":2,\"result\":12},"
+                  "{\"number\":0,\"result\":10}]}}"));
+    CHECK(applied[0].calls == 1 && applied[2].calls == 1 && applied[1].calls == 0);
+    CHECK(applied[0].in_loop && applied[2].in_loop);
+    CHECK(applied[0].pass == applied[2].pass);
+    CHECK(!memcmp(applied[0].value, value0, sizeof(value0)));
+    CHECK(!memcmp(applied[2].value, value2, sizeof(value2)));
+
+    //nothing posted, nothing applied
+    CHECK(!strcmp(request(HTTP_POST, ""), "{\"data\":{\"applied\":0,\"results\":[]}}"));
+
+    //any invalid value rejects whole batch
+    check_error(HTTP_GET, "", ESP_ERR_NOT_SUPPORTED);
+    check_error(HTTP_POST, "ch=0&value=01&ch=3&value=01", ESP_ERR_NOT_FOUND);
+    check_error(HTTP_POST, "ch=0&value=01&value=01", ESP_ERR_NOT_FOUND);
+    check_error(HTTP_POST, "ch=x&value=01", ESP_ERR_NOT_FOUND);
+    check_error(HTTP_POST, "ch=0&value=01&ch=1&value=0g", ESP_ERR_INVALID_ARG);
+    check_error(HTTP_POST, "ch=0&value=012", ESP_ERR_INVALID_ARG);
+    check_error(HTTP_POST, "ch=0&value=000000000000000000", ESP_ERR_INVALID_ARG);
+    n = 0;
+    for (int i = 0; i <= BATCH_MAX; i++)
+        n += snprintf(body + n, sizeof(body) - n, "%sch=%d&value=01", i ? "&" : "", i % CHANNELS);
+    check_error(HTTP_POST, body, ESP_ERR_INVALID_SIZE);
+
+    //longest batch
+    body[n - strlen("&ch=1&value=01")] = 0;
+    CHECK(strstr(request(HTTP_POST, body), "\"applied\":16"));
+
+    //without device loop request times out and is dropped
+    loop_stop();
+    n = applied[1].calls;
+    check_error(HTTP_POST, "ch=1&value=01", ESP_ERR_TIMEOUT);
+    supla_esp_dev_iterate(dev);
+    CHECK(applied[1].calls == n);
+
+    printf("set values test passed\n");
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef ESP_SUPLA_JOURNAL_H_
+#define ESP_SUPLA_JOURNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t sectors;      //sectors in journal area
+    uint32_t sector_size;  //bytes per sector
+    uint32_t records;      //live records, one per id
+    uint32_t appends;      //records written by supla_journal_store()
+    uint32_t append_bytes; //bytes written by appends, including headers
+    uint32_t relocated;    //live records copied forward by compaction
+    uint32_t erases;       //sector erases
+    uint32_t torn;         //incomplete records found by supla_journal_init()
+    uint32_t lost;         //records dropped when compaction had no room
+    uint32_t recovery_ms;  //duration of supla_journal_init() scan
+} supla_journal_stats_t;
+
+/**
+ * @brief Open journal area and rebuild record index. Incomplete record left
+ * by power loss is skipped, compaction interrupted by power loss is finished.
+ * Empty or unformatted area is formatted.
+ *
+ * Journal functions are not thread safe, callers serialize access.
+ *
+ * @return
+ *     - 0 success
+ *     - -1 journal area not available
+ */
+int supla_journal_init(void);
+
+/**
+ * @brief Append record, replaces previous record with the same id
+ *
+ * @param[in] id record id, 0xFFFF is reserved
+ * @param[in] data record data
+ * @param[in] len record data size
+ * @return
+ *     - 0 success
+ *     - -1 write failed or live records do not fit in a sector
+ */
+int supla_journal_store(uint16_t id, const void *data, size_t len);
+
+/**
+ * @brief Read latest record with given id
+ *
+ * @param[in] id record id
+ * @param[out] data record data
+ * @param[in] len expected record data size
+ * @return
+ *     - 0 success
+ *     - -1 no record or record size differs
+ */
+int supla_journal_restore(uint16_t id, void *data, size_t len);
+
+/**
+ * @brief Erase all records
+ *
+ * @return
+ *     - 0 success
+ *     - -1 erase failed
+ */
+int supla_journal_erase(void);
+
+/**
+ * @brief Get journal counters
+ *
+ * @param[out] stats journal counters
+ * @return 0 success
+ */
+int supla_journal_get_stats(supla_journal_stats_t *stats);
+
+#endif /* ESP_SUPLA_JOURNAL_H_ */
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef ESP_SUPLA_LINK_H_
+#define ESP_SUPLA_LINK_H_
+
+#include <stdint.h>
+
+#define SUPLA_LINK_HIST_BUCKETS 9
+//upper bounds of latency histogram buckets, last bucket counts slower ones
+#define SUPLA_LINK_HIST_BOUNDS_MS { 10, 25, 50, 100, 250, 500, 1000, 2500 }
+
+typedef struct {
+    uint32_t count;
+    uint32_t sum_ms;
+    uint32_t max_ms;
+    uint32_t bucket[SUPLA_LINK_HIST_BUCKETS];
+} supla_link_hist_t;
+
+typedef struct {
+    uint32_t tx_frames;          //frames accepted by supla_cloud_send()
+    uint32_t tx_writes;          //socket/TLS writes, one TLS record each
+    uint32_t tx_bytes;           //bytes written
+    uint32_t tx_records_saved;   //frames merged into other records
+    uint32_t tx_overhead_saved;  //estimated TLS record overhead saved in bytes
+    uint32_t rx_calls;           //supla_cloud_recv() calls
+    uint32_t rx_reads;           //socket/TLS reads
+    uint32_t rx_bytes;           //bytes read
+    uint32_t tls_handshakes;     //successful TLS connects
+    uint32_t tls_resume_offered; //handshakes with stored session offered
+    uint32_t tls_resumed;        //handshakes resumed, TLS 1.2 only on ESP
+    uint32_t tls_handshake_ms;   //last TCP connect + handshake time
+    uint32_t tls_handshake_ms_total;
+    uint32_t dns_lookups;        //name lookups started
+    uint32_t dns_cache_hits;     //connects started with cached address
+    uint32_t dns_fallbacks;      //cached address abandoned for fresh one
+    uint32_t connect_ms;         //last connect time including name lookup
+    uint32_t first_ready_ms;     //monotonic time when first link was ready
+    uint32_t connect_attempts;   //connects started, deferred ones count once started
+    uint32_t connect_failures;   //failed connects and links closed shortly after connect
+    int32_t connect_last_error;  //errno of last failure
+    uint32_t reconnect_delay_ms; //last backoff delay of any link
+    supla_link_hist_t connect_hist;
+} supla_link_stats_t;
+
+typedef struct {
+    char host[65];
+    int port;
+    uint8_t tls;
+    uint8_t ready;
+    uint32_t uptime_ms;          //time since link is ready
+    uint32_t connect_attempts;   //connects started by link owner
+    uint32_t connect_failures;   //failed connects and links closed shortly after connect
+    int32_t connect_last_error;  //errno of last failure
+    uint32_t reconnect_delay_ms; //current backoff delay of link owner
+    uint32_t tx_frames;          //frames accepted
+    uint32_t tx_bytes;           //bytes written
+    uint32_t tx_errors;          //failed writes
+    uint32_t tx_stalls;          //writes that would block
+    uint32_t rx_reads;           //socket/TLS reads
+    uint32_t rx_bytes;           //bytes read
+    uint32_t rx_errors;          //failed reads
+    uint32_t tls_want_read;      //TLS write waiting for incoming data
+    uint32_t tls_want_write;     //TLS read or write waiting for socket space
+    supla_link_hist_t rtt;       //time from request to first response data
+} supla_link_metrics_t;
+
+/**
+ * @brief Block until any open cloud link has data to read, supla_link_wakeup()
+ * is called or timeout expires. Use it instead of fixed delay between
+ * supla_dev_iterate() calls. Links may be opened and closed by other tasks
+ * meanwhile, but each link must be used only by the task that waits for it.
+ *
+ * @param[in] timeout_ms maximum time to wait
+ * @return
+ *     - >0 link or wakeup event ready
+ *     - 0 timeout
+ *     - -1 error
+ */
+int supla_link_wait(uint32_t timeout_ms);
+
+/**
+ * @brief Wake up task blocked in supla_link_wait(). Can be called from any
+ * task (not from ISR) e.g. after local event that should be reported to cloud
+ *
+ * @return
+ *     - 0 success
+ *     - -1 wakeup handle not ready
+ */
+int supla_link_wakeup(void);
+
+/**
+ * @brief Get number of bytes queued in transmit buffers of all open links.
+ * Can be called from any task.
+ *
+ * @return queued bytes
+ */
+int supla_link_tx_pending(void);
+
+/**
+ * @brief Send data queued in transmit buffers of all open links. With
+ * CONFIG_ESP_LIBSUPLA_LINK_COALESCE enabled frames are sent only here or by
+ * supla_link_wait() so call it after supla_dev_iterate()
+ *
+ * @return
+ *     - 0 success
+ *     - -1 link error
+ */
+int supla_link_flush(void);
+
+/**
+ * @brief Get link statistics collected since boot
+ *
+ * @param[out] stats statistics
+ * @return
+ *     - 0 success
+ *     - -1 invalid argument
+ */
+int supla_link_get_stats(supla_link_stats_t *stats);
+
+/**
+ * @brief Get metrics of open link. Can be called from other task than the
+ * one running supla_dev_iterate()
+ *
+ * @param[in] index link number starting from 0
+ * @param[out] metrics link metrics
+ * @return
+ *     - 0 success
+ *     - -1 no link with given index or invalid argument
+ */
+int supla_link_get_metrics(int index, supla_link_metrics_t *metrics);
+
+/**
+ * @brief Allow next cloud connect of all links immediately, e.g. after
+ * network interface got IP address. Failed connects are otherwise retried
+ * with exponential backoff kept separately for each device.
+ *
+ * @return 0 success
+ */
+int supla_link_reset_backoff(void);
+
+/**
+ * @brief Free parsed CA certificate store. Store is built on first TLS
+ * connect and shared by all links, it is not needed by established
+ * connections. Next connect parses certificate again.
+ *
+ * @return
+ *     - 0 success
+ *     - -1 TLS handshake in progress, store still in use
+ */
+int supla_link_free_ca_store(void);
+
+#endif /* ESP_SUPLA_LINK_H_ */
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef ESP_SUPLA_MEM_H_
+#define ESP_SUPLA_MEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef enum {
+    SUPLA_MEM_LINK = 0, //cloud link contexts with their buffers
+    SUPLA_MEM_TLS,      //TLS connections, estimated from free heap change
+    SUPLA_MEM_CH_STATE, //cached channel states
+    SUPLA_MEM_CHANNELS, //channels added by supla_esp_add_channel()
+    SUPLA_MEM_REGISTRY, //device registry
+    SUPLA_MEM_JOURNAL,  //state journal index
+    SUPLA_MEM_TAG_COUNT
+} supla_mem_tag_t;
+
+typedef struct {
+    uint32_t bytes;  //currently allocated
+    uint32_t peak;   //highest value of bytes
+    uint32_t count;  //live allocations
+    uint32_t allocs; //allocations since boot
+    uint32_t failed; //failed allocations since boot
+} supla_mem_stats_t;
+
+#ifdef CONFIG_ESP_LIBSUPLA_MEM_STATS
+/* Tagged allocations used by esp-supla and platform code. Size is kept in
+ * a header in front of the block, pointers must be freed with the same tag. */
+void *supla_mem_calloc(supla_mem_tag_t tag, size_t n, size_t size);
+void *supla_mem_realloc(supla_mem_tag_t tag, void *ptr, size_t size);
+void supla_mem_free(supla_mem_tag_t tag, void *ptr);
+
+/* Account memory allocated by other components on our behalf */
+void supla_mem_account_alloc(supla_mem_tag_t tag, uint32_t bytes);
+void supla_mem_account_free(supla_mem_tag_t tag, uint32_t bytes);
+void supla_mem_account_failed(supla_mem_tag_t tag);
+#else
+#define supla_mem_calloc(tag, n, size) calloc(n, size)
+#define supla_mem_realloc(tag, ptr, size) realloc(ptr, size)
+#define supla_mem_free(tag, ptr) free(ptr)
+#define supla_mem_account_alloc(tag, bytes) ((void)(bytes))
+#define supla_mem_account_free(tag, bytes) ((void)(bytes))
+#define supla_mem_account_failed(tag) ((void)(tag))
+#endif
+
+/* Fixed block pool in static storage, used instead of the heap with
+ * CONFIG_ESP_LIBSUPLA_STATIC_ALLOC. Blocks are accounted under pool tag. */
+typedef struct {
+    supla_mem_tag_t tag;
+    uint16_t block_size; //rounded up to max_align_t
+    uint16_t count;
+    uint8_t *used; //one flag per block
+    max_align_t *blocks;
+} supla_mem_pool_t;
+
+#define SUPLA_MEM_POOL_WORDS(size) (((size) + sizeof(max_align_t) - 1) / sizeof(max_align_t))
+
+#define SUPLA_MEM_POOL_DEFINE(name, pool_tag, size, pool_count)                          \
+    static uint8_t name##_used[pool_count];                                              \
+    static max_align_t name##_blocks[(pool_count) * SUPLA_MEM_POOL_WORDS(size)];         \
+    static supla_mem_pool_t name = { .tag = (pool_tag),                                  \
+                                     .block_size = SUPLA_MEM_POOL_WORDS(size) *          \
+                                                   sizeof(max_align_t),                  \
+                                     .count = (pool_count),                              \
+                                     .used = name##_used,                                \
+                                     .blocks = name##_blocks }
+
+/* Take zeroed block, NULL when size does not fit a block or pool is empty */
+void *supla_mem_pool_alloc(supla_mem_pool_t *pool, size_t size);
+void supla_mem_pool_free(supla_mem_pool_t *pool, void *ptr);
+
+/**
+ * @brief Get allocation statistics of one subsystem. Can be called from any
+ * task.
+ *
+ * @param[in] tag subsystem
+ * @param[out] stats statistics
+ * @return
+ *     - 0 success
+ *     - -1 invalid argument or accounting disabled
+ *       (CONFIG_ESP_LIBSUPLA_MEM_STATS)
+ */
+int supla_mem_get_stats(supla_mem_tag_t tag, supla_mem_stats_t *stats);
+
+/**
+ * @brief Get subsystem name used in reports
+ *
+ * @param[in] tag subsystem
+ * @return name, "unknown" for invalid tag
+ */
+const char *supla_mem_tag_str(supla_mem_tag_t tag);
+
+#endif /* ESP_SUPLA_MEM_H_ */
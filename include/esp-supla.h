@@ -8,12 +8,31 @@
 #define ESP_SUPLA_H_
 
 #include <libsupla/device.h>
+#include "esp-supla-link.h"
 #include <esp_http_server.h>
 #include <esp_err.h>
 
+typedef struct {
+    uint32_t stores;      //supla_esp_nvs_channel_state_store() calls
+    uint32_t flash_reads; //channel states read from NVS or journal
+    uint32_t coalesced;   //changes merged into state waiting for write
+    uint32_t blob_writes; //channel states written to NVS or journal
+    uint32_t commits;     //NVS commits
+} supla_esp_nvs_stats_t;
+
+typedef struct {
+    uint16_t devices;  //registered devices
+    uint16_t capacity; //device slots allocated
+    uint32_t bytes;    //heap used by registry
+} supla_esp_registry_stats_t;
+
+//base of URIs routed by supla_dev_registry_httpd_handler()
+#define SUPLA_ESP_REGISTRY_URI_BASE "/supla"
+
 /**
  * @brief Initialize SUPLA config in NVS memory. GUID and AUTHKEY
- * will be generated automatically if not set
+ * will be generated automatically if not set. Config stored by older
+ * versions as separate keys is migrated to single packed record
  *
  * @param[in] supla_conf SUPLA connection config
  * @return
@@ -31,7 +50,11 @@ esp_err_t supla_esp_nvs_config_init(struct supla_config *supla_conf);
 esp_err_t supla_esp_nvs_config_write(struct supla_config *supla_conf);
 
 /**
- * @brief Write SUPLA channel state to NVS memory
+ * @brief Write SUPLA channel state to NVS memory. State is kept in RAM and
+ * written together with other changed channels
+ * CONFIG_ESP_LIBSUPLA_NVS_FLUSH_DELAY_MS after first change or on
+ * supla_esp_nvs_channel_state_flush(). Write is done by supla_esp_dev_iterate()
+ * once device loop uses it, by esp_timer task otherwise
  *
  * @param[in] ch SUPLA channel
  * @param[in] nvs_state SUPLA channel data
@@ -42,7 +65,17 @@ esp_err_t supla_esp_nvs_config_write(struct supla_config *supla_conf);
 esp_err_t supla_esp_nvs_channel_state_store(supla_channel_t *ch, void *nvs_state, size_t len);
 
 /**
- * @brief Read SUPLA channel state from NVS memory
+ * @brief Write all pending channel states to NVS memory now. Called on
+ * esp_restart(), call it also before power is cut e.g. on low supply voltage
+ *
+ * @return
+ *     - ESP_OK success
+ */
+esp_err_t supla_esp_nvs_channel_state_flush(void);
+
+/**
+ * @brief Read SUPLA channel state from NVS memory. Blob is read once and
+ * kept in RAM to detect unchanged states on store
  *
  * @param[in] ch SUPLA channel
  * @param[out] nvs_state SUPLA channel data
@@ -52,6 +85,16 @@ esp_err_t supla_esp_nvs_channel_state_store(supla_channel_t *ch, void *nvs_state
  */
 esp_err_t supla_esp_nvs_channel_state_restore(supla_channel_t *ch, void *nvs_state, size_t len);
 
+/**
+ * @brief Get channel state write statistics
+ *
+ * @param[out] stats statistics
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_INVALID_ARG null stats
+ */
+esp_err_t supla_esp_nvs_get_stats(supla_esp_nvs_stats_t *stats);
+
 /**
  * @brief Erase SUPLA data from NVS memory
  *
@@ -60,6 +103,96 @@ esp_err_t supla_esp_nvs_channel_state_restore(supla_channel_t *ch, void *nvs_sta
  */
 esp_err_t supla_esp_nvs_data_erase(void);
 
+/**
+ * @brief Add channel to device like supla_dev_add_channel() and list it in
+ * HTTP API response of action=channels. States of channels added so are
+ * stored per device, other channels share states of device id 0
+ *
+ * @param[in] dev SUPLA device instance
+ * @param[in] ch SUPLA channel
+ * @param[in] config channel config used to create it, must stay valid
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_NO_MEM no memory for channel list entry
+ *     - ESP_FAIL supla_dev_add_channel() failed
+ */
+esp_err_t supla_esp_add_channel(supla_dev_t *dev, supla_channel_t *ch,
+                                const supla_channel_config_t *config);
+
+/**
+ * @brief Iterate device like supla_dev_iterate(). Channel values posted to
+ * HTTP API action=set_values are applied first, all in one pass, so they
+ * are reported to server together. Channel states delayed by
+ * supla_esp_nvs_channel_state_store() are written here, in device task
+ * instead of esp_timer task. Use it in device loop instead of
+ * supla_dev_iterate() to enable set_values, plain supla_dev_iterate() never
+ * applies set_values batches and they fail with ESP_ERR_TIMEOUT
+ *
+ * @param[in] dev SUPLA device instance
+ * @return supla_dev_iterate() result
+ */
+int supla_esp_dev_iterate(supla_dev_t *dev);
+
+/**
+ * @brief Register device for supla_dev_registry_httpd_handler() and
+ * supla_esp_dev_registry_iterate(). Lowest free id is assigned. Channel
+ * states are stored per device id, so register devices in the same order on
+ * every boot and before their channel states are restored. Device with id 0
+ * and device that is not registered use keys of single device versions
+ *
+ * @param[in] dev SUPLA device instance
+ * @param[out] id device id used in URI
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_NO_MEM no memory or 65535 devices registered
+ */
+esp_err_t supla_esp_dev_register(supla_dev_t *dev, int *id);
+
+/**
+ * @brief Remove device from registry, id may be given to next registered
+ * device. Call it before device is freed
+ *
+ * @param[in] id device id
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_NOT_FOUND no device with this id
+ */
+esp_err_t supla_esp_dev_unregister(int id);
+
+/**
+ * @brief Get registered device
+ *
+ * @param[in] id device id
+ * @return device or NULL
+ */
+supla_dev_t *supla_esp_dev_get(int id);
+
+/**
+ * @brief Get id of registered device
+ *
+ * @param[in] dev SUPLA device instance
+ * @return device id or -1 when device is not registered
+ */
+int supla_esp_dev_get_id(const supla_dev_t *dev);
+
+/**
+ * @brief Call supla_esp_dev_iterate() for every registered device. One task
+ * can drive all devices of a gateway with this and supla_link_wait()
+ *
+ * @return number of devices iterated
+ */
+int supla_esp_dev_registry_iterate(void);
+
+/**
+ * @brief Get device registry memory use
+ *
+ * @param[out] stats statistics
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_INVALID_ARG null stats
+ */
+esp_err_t supla_esp_dev_registry_get_stats(supla_esp_registry_stats_t *stats);
+
 /**
  * @brief generate SUPLA device hostname from device name and last two bytes
  * of MAC address like DEVNAME-XXXX
@@ -106,10 +239,47 @@ int supla_esp_server_time_sync(supla_dev_t *dev, TSDC_UserLocalTimeResult *lt);
  */
 int supla_esp_restart_callback(supla_dev_t *dev);
 
+/**
+ * @brief Log free heap and heap use of esp-supla subsystems that allocated
+ * anything since boot. Call it periodically to follow fragmentation and
+ * leaks, per subsystem numbers need CONFIG_ESP_LIBSUPLA_MEM_STATS.
+ */
+void supla_esp_mem_log(void);
+
 //httpd device state handler GET/POST
-//TODO documentation
+//actions: get_config, set_config, erase_config, metrics (cloud link counters),
+//memory (free heap and heap use per subsystem, see esp-supla-mem.h),
+//channels (channels added with supla_esp_add_channel(), offset and limit paging),
+//set_values (POST only, ch=N&value=HEX pairs, applied by supla_esp_dev_iterate()
+//or supla_esp_dev_registry_iterate() - with plain supla_dev_iterate() in device
+//loop every request fails with ESP_ERR_TIMEOUT)
+//URL query longer than 127 bytes is answered with ESP_ERR_INVALID_SIZE error
 esp_err_t supla_dev_httpd_handler(httpd_req_t *req);
 
 esp_err_t supla_dev_basic_httpd_handler(httpd_req_t *req);
 
+//httpd handler routing SUPLA_ESP_REGISTRY_URI_BASE/<id> to supla_dev_httpd_handler()
+//and SUPLA_ESP_REGISTRY_URI_BASE/<id>/config to supla_dev_basic_httpd_handler()
+//of registered device. Register it as "/supla/*" with httpd_uri_match_wildcard
+esp_err_t supla_dev_registry_httpd_handler(httpd_req_t *req);
+
+/**
+ * @brief WebSocket handler pushing device and channel state changes.
+ * Register it with is_websocket set and user_ctx like
+ * supla_dev_httpd_handler(), handlers of several devices may share one
+ * server. Each client gets full state after connecting, then events:
+ * {"dev":{"state","uptime","connection_uptime"}} when its device state
+ * changes or connection is made again and {"ch":N,"state":"hex"} when
+ * channel state is stored. States longer than 64 bytes, or
+ * CONFIG_ESP_LIBSUPLA_STATIC_STATE_SIZE in static builds, are not pushed
+ * and logged once per channel
+ *
+ * @param[in] req HTTP request
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_NO_MEM CONFIG_ESP_LIBSUPLA_HTTPD_PUSH_MAX_CLIENTS connected
+ *     - ESP_ERR_NOT_SUPPORTED CONFIG_ESP_LIBSUPLA_HTTPD_PUSH disabled
+ */
+esp_err_t supla_dev_ws_handler(httpd_req_t *req);
+
 #endif /* ESP_SUPLA_H_ */
@@ -5,19 +5,34 @@
  */
 
 #include "port/util.h"
-#include "port/net.h"
+#include "supla-common/log.h"
+#include "link.h"
+#include "journal.h"
+#include "esp-supla-mem.h"
 
 #include <string.h>
 #include <fcntl.h>
-#include <unistd.h>
 #include <errno.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netinet/tcp.h>
-#include <esp_log.h>
+#include <time.h>
+#include <lwip/dns.h>
+#include <lwip/inet.h>
+#include <lwip/sockets.h>
+#include <lwip/priv/tcpip_priv.h>
+#include <nvs.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#ifndef CONFIG_IDF_TARGET_ESP8266
+#include <esp_random.h>
+#endif
 
 #ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
 #include <esp_tls.h>
+#include <mbedtls/ssl.h>
+
+#ifndef MBEDTLS_PRIVATE
+//mbedTLS 2.x session fields are public
+#define MBEDTLS_PRIVATE(member) member
+#endif
 
 #ifdef CONFIG_IDF_TARGET_ESP8266
 // delete name variant is deprecated in ESP-IDF, however ESP8266 RTOS still
@@ -33,19 +48,48 @@ void esp_tls_get_error_handle(esp_tls_t *client, esp_tls_error_handle_t *errorHa
 }
 #endif
 
-extern const uint8_t server_cert_pem_start[] asm("_binary_supla_org_cert_pem_start");
-extern const uint8_t server_cert_pem_end[] asm("_binary_supla_org_cert_pem_end");
+#ifdef SUPLA_CA_CERT_DER
+//converted at build time by tools/pem2der.py, no base64 decoding on device
+extern const uint8_t server_cert_start[] asm("_binary_supla_org_cert_der_start");
+extern const uint8_t server_cert_end[] asm("_binary_supla_org_cert_der_end");
+#else
+extern const uint8_t server_cert_start[] asm("_binary_supla_org_cert_pem_start");
+extern const uint8_t server_cert_end[] asm("_binary_supla_org_cert_pem_end");
+#endif
 
-typedef struct {
-    int sockfd;
-    uint8_t is_tls;
-#ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
-    struct esp_tls *tls;
+//CA certificate is parsed once into esp-tls global store and shared by links
+static bool ca_store_ready;
+
+#ifdef CONFIG_ESP_LIBSUPLA_TLS_SESSION_RESUMPTION
+//last negotiated session, offered on next connect to the same host
+static esp_tls_client_session_t *tls_session;
+static char tls_session_host[LINK_HOST_MAXSIZE];
+#ifdef MBEDTLS_SSL_PROTO_TLS1_2
+//master secret of saved session, kept by server that resumes it
+static unsigned char tls_session_master[48];
 #endif
-} link_ctx_t;
 #endif
+#endif
+
+#define DNS_SLOTS 4
+#define DNS_NVS_STORAGE "supla_nvs"
+#define DNS_NVS_KEY "cloud_addr"
 
-static const char *TAG = "SUPLA-LINK";
+typedef struct {
+    link_ctx_t *owner;
+    uint8_t busy;  //query in flight, owned by lwIP until callback
+    int8_t result; //0 pending, 1 resolved, -1 failed
+    ip_addr_t addr;
+} dns_slot_t;
+
+typedef struct {
+    struct tcpip_api_call_data call;
+    link_ctx_t *ctx;
+    ip_addr_t addr;
+    int rc;
+} dns_call_t;
+
+static dns_slot_t dns_slots[DNS_SLOTS];
 
 uint64_t supla_time_getmonotonictime_milliseconds(void)
 {
@@ -54,181 +98,426 @@ uint64_t supla_time_getmonotonictime_milliseconds(void)
     return (uint64_t)((current_time.tv_sec * 1000) + (current_time.tv_nsec / 1000000));
 }
 
-static void set_keepalive(int sockfd)
+uint32_t arch_random(void)
 {
-    int keepalive = 1;
-    int idle = 60;
-    int interval = 10;
-    int count = 3;
+    return esp_random();
+}
 
-    setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
-    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
-    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
-    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+static void dns_found_cb(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    dns_slot_t *slot = arg;
+
+    slot->busy = 0;
+    if (ipaddr) {
+        slot->addr = *ipaddr;
+        slot->result = 1;
+    } else {
+        slot->result = -1;
+    }
 }
 
-static int link_write(link_ctx_t *ctx, const void *buf, int len)
+/* lwIP DNS API must be called from tcpip thread, all slot changes are
+ * serialized there by tcpip_api_call() */
+static err_t dns_start_fn(struct tcpip_api_call_data *data)
 {
-#ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
-    if (ctx->is_tls) {
-        int ret = esp_tls_conn_write(ctx->tls, buf, len);
-        if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE)
-            return -1;
-        return ret;
+    dns_call_t *call = (dns_call_t *)data;
+    dns_slot_t *slot = NULL;
+    err_t err;
+
+    call->rc = -1;
+    for (int i = 0; i < DNS_SLOTS; i++) {
+        if (!dns_slots[i].owner && !dns_slots[i].busy) {
+            slot = &dns_slots[i];
+            break;
+        }
+    }
+    if (!slot)
+        return ERR_OK;
+
+    slot->owner = call->ctx;
+    slot->result = 0;
+    err = dns_gethostbyname(call->ctx->host, &slot->addr, dns_found_cb, slot);
+    if (err == ERR_OK)
+        slot->result = 1;
+    else if (err == ERR_INPROGRESS)
+        slot->busy = 1;
+    else
+        slot->result = -1;
+
+    call->rc = 0;
+    return ERR_OK;
+}
+
+static err_t dns_poll_fn(struct tcpip_api_call_data *data)
+{
+    dns_call_t *call = (dns_call_t *)data;
+
+    call->rc = -1;
+    for (int i = 0; i < DNS_SLOTS; i++) {
+        dns_slot_t *slot = &dns_slots[i];
+        if (slot->owner != call->ctx)
+            continue;
+
+        call->rc = slot->result;
+        call->addr = slot->addr;
+        if (slot->result != 0)
+            slot->owner = NULL;
+        break;
+    }
+    return ERR_OK;
+}
+
+static err_t dns_cancel_fn(struct tcpip_api_call_data *data)
+{
+    dns_call_t *call = (dns_call_t *)data;
+
+    for (int i = 0; i < DNS_SLOTS; i++) {
+        //busy slot stays reserved until lwIP calls dns_found_cb()
+        if (dns_slots[i].owner == call->ctx)
+            dns_slots[i].owner = NULL;
+    }
+    return ERR_OK;
+}
+
+int arch_resolve_start(link_ctx_t *ctx)
+{
+    dns_call_t call = { .ctx = ctx };
+
+    tcpip_api_call(dns_start_fn, &call.call);
+    return call.rc;
+}
+
+int arch_resolve_poll(link_ctx_t *ctx, struct sockaddr_storage *addr, socklen_t *addrlen)
+{
+    dns_call_t call = { .ctx = ctx };
+
+    tcpip_api_call(dns_poll_fn, &call.call);
+    if (call.rc != 1)
+        return call.rc;
+
+    memset(addr, 0, sizeof(*addr));
+#if LWIP_IPV6
+    if (IP_IS_V6(&call.addr)) {
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)addr;
+        sa6->sin6_family = AF_INET6;
+        inet6_addr_from_ip6addr(&sa6->sin6_addr, ip_2_ip6(&call.addr));
+        *addrlen = sizeof(*sa6);
+        return 1;
     }
 #endif
-    return send(ctx->sockfd, buf, len, MSG_NOSIGNAL);
+    struct sockaddr_in *sa = (struct sockaddr_in *)addr;
+    sa->sin_family = AF_INET;
+    inet_addr_from_ip4addr(&sa->sin_addr, ip_2_ip4(&call.addr));
+    *addrlen = sizeof(*sa);
+    return 1;
+}
+
+void arch_resolve_cancel(link_ctx_t *ctx)
+{
+    dns_call_t call = { .ctx = ctx };
+
+    tcpip_api_call(dns_cancel_fn, &call.call);
 }
 
-static int link_read(link_ctx_t *ctx, void *buf, int len)
+int arch_dns_load(link_dns_record_t *rec)
 {
+    size_t len = sizeof(*rec);
+    nvs_handle nvs;
+    esp_err_t rc;
+
+    if (nvs_open(DNS_NVS_STORAGE, NVS_READONLY, &nvs) != ESP_OK)
+        return -1;
+
+    rc = nvs_get_blob(nvs, DNS_NVS_KEY, rec, &len);
+    nvs_close(nvs);
+    return (rc == ESP_OK && len == sizeof(*rec)) ? 0 : -1;
+}
+
+void arch_dns_store(const link_dns_record_t *rec)
+{
+    link_dns_record_t stored;
+    nvs_handle nvs;
+
+    //flash is written only when server address really changed
+    if (arch_dns_load(&stored) == 0 && !memcmp(&stored, rec, sizeof(stored)))
+        return;
+
+    if (nvs_open(DNS_NVS_STORAGE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+
+    if (nvs_set_blob(nvs, DNS_NVS_KEY, rec, sizeof(*rec)) == ESP_OK)
+        nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static const esp_partition_t *journal_part;
+
+int arch_journal_open(uint32_t *size)
+{
+    if (!journal_part) {
+        journal_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                ESP_PARTITION_SUBTYPE_ANY, JOURNAL_PARTITION);
+    }
+    if (!journal_part) {
+        supla_log(LOG_ERR, "journal partition %s not found", JOURNAL_PARTITION);
+        return -1;
+    }
+    *size = journal_part->size;
+    return 0;
+}
+
+int arch_journal_read(uint32_t offset, void *buf, size_t len)
+{
+    return esp_partition_read(journal_part, offset, buf, len) == ESP_OK ? 0 : -1;
+}
+
+int arch_journal_write(uint32_t offset, const void *buf, size_t len)
+{
+    return esp_partition_write(journal_part, offset, buf, len) == ESP_OK ? 0 : -1;
+}
+
+int arch_journal_erase(uint32_t offset, size_t len)
+{
+    return esp_partition_erase_range(journal_part, offset, len) == ESP_OK ? 0 : -1;
+}
+
 #ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
-    if (ctx->is_tls) {
-        int ret = esp_tls_conn_read(ctx->tls, buf, len);
-        if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE)
-            return -1;
-        return ret;
+static void tls_session_drop(void)
+{
+#ifdef CONFIG_ESP_LIBSUPLA_TLS_SESSION_RESUMPTION
+    //stale session may be the reason, next handshake will be full
+    if (tls_session) {
+        esp_tls_free_client_session(tls_session);
+        tls_session = NULL;
     }
+#ifdef MBEDTLS_SSL_PROTO_TLS1_2
+    memset(tls_session_master, 0, sizeof(tls_session_master));
+#endif
 #endif
-    return recv(ctx->sockfd, buf, len, MSG_DONTWAIT);
 }
 
-static void link_close(link_ctx_t *ctx)
+static mbedtls_ssl_context *tls_ssl_context(link_ctx_t *ctx)
 {
-#ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
-    if (ctx->is_tls && ctx->tls) {
-        esp_tls_conn_destroy(ctx->tls);
+#ifdef CONFIG_IDF_TARGET_ESP8266
+    return &((esp_tls_t *)ctx->tls)->ssl;
+#else
+    return esp_tls_get_ssl_context(ctx->tls);
+#endif
+}
+
+/* mbedTLS has no public resumed flag. TLS 1.2 abbreviated handshake, by
+ * session ID or ticket, keeps master secret of offered session while full
+ * handshake derives a new one. TLS 1.3 resumption is not detected and such
+ * handshake stays reported as offered only. */
+static void tls_session_check(link_ctx_t *ctx)
+{
+#if defined(CONFIG_ESP_LIBSUPLA_TLS_SESSION_RESUMPTION) && defined(MBEDTLS_SSL_PROTO_TLS1_2)
+    mbedtls_ssl_context *ssl = tls_ssl_context(ctx);
+    const mbedtls_ssl_session *session = ssl ? mbedtls_ssl_get_session_pointer(ssl) : NULL;
+
+    if (ctx->tls_session != LINK_TLS_SESSION_OFFERED || !session)
         return;
-    }
+    if (strcmp(mbedtls_ssl_get_version(ssl), "TLSv1.2"))
+        return;
+    if (!memcmp(session->MBEDTLS_PRIVATE(master), tls_session_master, sizeof(tls_session_master)))
+        ctx->tls_session = LINK_TLS_SESSION_RESUMED;
 #endif
-    if (ctx->sockfd != -1) {
-        shutdown(ctx->sockfd, SHUT_RDWR);
-        close(ctx->sockfd);
-    }
 }
 
-int supla_cloud_connect(supla_link_t *link, const char *host, int port, unsigned char ssl)
+static void tls_session_save(link_ctx_t *ctx)
 {
-    if (!link || !host)
-        return SUPLA_RESULT_FALSE;
+#ifdef CONFIG_ESP_LIBSUPLA_TLS_SESSION_RESUMPTION
+    esp_tls_client_session_t *session = esp_tls_get_client_session(ctx->tls);
+#ifdef MBEDTLS_SSL_PROTO_TLS1_2
+    mbedtls_ssl_context *ssl = tls_ssl_context(ctx);
+    const mbedtls_ssl_session *negotiated = ssl ? mbedtls_ssl_get_session_pointer(ssl) : NULL;
+#endif
 
-    *link = NULL;
+    if (session) {
+        if (tls_session)
+            esp_tls_free_client_session(tls_session);
+        tls_session = session;
+        strlcpy(tls_session_host, ctx->host, sizeof(tls_session_host));
+#ifdef MBEDTLS_SSL_PROTO_TLS1_2
+        if (negotiated)
+            memcpy(tls_session_master, negotiated->MBEDTLS_PRIVATE(master),
+                   sizeof(tls_session_master));
+        else
+            memset(tls_session_master, 0, sizeof(tls_session_master));
+#endif
+    }
+#endif
+}
 
-    link_ctx_t *ctx = calloc(1, sizeof(link_ctx_t));
-    if (!ctx)
-        return SUPLA_RESULT_FALSE;
+/* esp-tls and mbedTLS allocate on their own, connection cost is taken as
+ * free heap drop from esp_tls_init() to the end of handshake. Other tasks
+ * allocating meanwhile make it an estimate. */
+static void tls_heap_account(link_ctx_t *ctx)
+{
+    uint32_t free_heap = esp_get_free_heap_size();
 
-    ctx->sockfd = -1;
-    ctx->is_tls = ssl;
+    ctx->tls_heap = ctx->tls_heap_base > free_heap ? ctx->tls_heap_base - free_heap : 0;
+    ctx->tls_heap_base = 0;
+    supla_mem_account_alloc(SUPLA_MEM_TLS, ctx->tls_heap);
+}
 
-#ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
-    if (ssl) {
-        ctx->tls = esp_tls_init();
-        if (!ctx->tls) {
-            free(ctx);
-            return SUPLA_RESULT_FALSE;
-        }
+static void tls_destroy(link_ctx_t *ctx)
+{
+    esp_tls_conn_destroy(ctx->tls);
+    ctx->tls = NULL;
+    if (!ctx->tls_heap_base)
+        supla_mem_account_free(SUPLA_MEM_TLS, ctx->tls_heap);
+    ctx->tls_heap = 0;
+}
 
-        esp_tls_cfg_t cfg = { 0 };
-        cfg.cacert_buf = server_cert_pem_start;
-        cfg.cacert_bytes = server_cert_pem_end - server_cert_pem_start;
-        cfg.timeout_ms = 10000;
-        cfg.common_name = host;
-
-        int rc = esp_tls_conn_new_sync(host, strlen(host), port, &cfg, ctx->tls);
-        if (rc != 1) {
-            ESP_LOGE(TAG, "TLS connect failed: %s:%d", host, port);
-            esp_tls_conn_destroy(ctx->tls);
-            free(ctx);
-            return SUPLA_RESULT_FALSE;
-        }
+static int tls_ca_store_init(void)
+{
+    esp_err_t rc;
 
-        if (esp_tls_get_conn_sockfd(ctx->tls, &ctx->sockfd) == ESP_OK && ctx->sockfd >= 0) {
-            fcntl(ctx->sockfd, F_SETFL, O_NONBLOCK);
-            set_keepalive(ctx->sockfd);
-        }
+    if (ca_store_ready)
+        return 0;
 
-        *link = ctx;
-        return SUPLA_RESULT_TRUE;
+    rc = esp_tls_set_global_ca_store(server_cert_start, server_cert_end - server_cert_start);
+    if (rc != ESP_OK) {
+        supla_log(LOG_ERR, "TLS CA store init failed: %d", rc);
+        return -1;
     }
+    ca_store_ready = true;
+    return 0;
+}
+
+static int tls_want_write(esp_tls_t *tls)
+{
+#ifdef CONFIG_IDF_TARGET_ESP8266
+    esp_tls_conn_state_t state = tls->conn_state;
+#else
+    esp_tls_conn_state_t state = ESP_TLS_HANDSHAKE;
+    esp_tls_get_conn_state(tls, &state);
 #endif
+    //TCP connect in progress
+    return state != ESP_TLS_HANDSHAKE;
+}
 
-    // Plain TCP fallback
-    struct addrinfo hints = { 0 }, *result, *rp;
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_NUMERICSERV;
+int arch_tls_handshake(link_ctx_t *ctx)
+{
+    esp_tls_cfg_t cfg = { 0 };
+    char addr[48];
+    int rc;
 
-    if (getaddrinfo(host, NULL, &hints, &result) != 0) {
-        free(ctx);
-        return SUPLA_RESULT_FALSE;
+    if (!ctx->tls) {
+        if (tls_ca_store_init() != 0)
+            return -1;
+        ctx->tls_heap_base = esp_get_free_heap_size();
+        ctx->tls = esp_tls_init();
+        if (!ctx->tls)
+            return -1;
+        ctx->want_write = 1;
     }
 
-    for (rp = result; rp != NULL; rp = rp->ai_next) {
-        ctx->sockfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (ctx->sockfd == -1)
-            continue;
+    cfg.use_global_ca_store = true;
+    cfg.timeout_ms = LINK_CONNECT_TIMEOUT_MS;
+    cfg.non_block = true;
+    //address is already resolved, name is used for SNI and verification
+    cfg.common_name = ctx->host;
 
-        if (rp->ai_family == AF_INET) {
-            ((struct sockaddr_in *)rp->ai_addr)->sin_port = htons(port);
-        }
-#if LWIP_IPV6
-        else if (rp->ai_family == AF_INET6) {
-            ((struct sockaddr_in6 *)rp->ai_addr)->sin6_port = htons(port);
-        }
+#ifdef CONFIG_ESP_LIBSUPLA_TLS_SESSION_RESUMPTION
+    if (tls_session && !strcmp(tls_session_host, ctx->host)) {
+        cfg.client_session = tls_session;
+        ctx->tls_session = LINK_TLS_SESSION_OFFERED;
+    }
 #endif
-        else {
-            close(ctx->sockfd);
-            ctx->sockfd = -1;
-            continue;
-        }
 
-        if (connect(ctx->sockfd, rp->ai_addr, rp->ai_addrlen) != -1 || errno == EINPROGRESS) {
-            fcntl(ctx->sockfd, F_SETFL, O_NONBLOCK);
-            set_keepalive(ctx->sockfd);
-            break;
-        }
+    if (ctx->addr.ss_family == AF_INET)
+        inet_ntop(AF_INET, &((struct sockaddr_in *)&ctx->addr)->sin_addr, addr, sizeof(addr));
+#if LWIP_IPV6
+    else
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&ctx->addr)->sin6_addr, addr, sizeof(addr));
+#endif
 
-        close(ctx->sockfd);
+    rc = esp_tls_conn_new_async(addr, strlen(addr), ctx->port, &cfg, ctx->tls);
+    if (ctx->sockfd < 0 && esp_tls_get_conn_sockfd(ctx->tls, &ctx->sockfd) != ESP_OK)
         ctx->sockfd = -1;
-    }
 
-    freeaddrinfo(result);
+    if (rc == 0) {
+        ctx->want_write = tls_want_write(ctx->tls);
+        return 0;
+    }
 
-    if (ctx->sockfd == -1) {
-        free(ctx);
-        return SUPLA_RESULT_FALSE;
+    if (rc < 0) {
+        tls_destroy(ctx);
+        ctx->sockfd = -1;
+        tls_session_drop();
+        return -1;
     }
 
-    *link = ctx;
-    return SUPLA_RESULT_TRUE;
+    tls_session_check(ctx);
+    tls_session_save(ctx);
+    tls_heap_account(ctx);
+    if (ctx->sockfd >= 0)
+        link_set_keepalive(ctx->sockfd);
+    return 1;
 }
 
-int supla_cloud_send(supla_link_t link, void *buf, int count)
+int arch_tls_write(link_ctx_t *ctx, const void *buf, int len)
 {
-    if (!link || !buf || count <= 0)
-        return SUPLA_RESULT_FALSE;
-
-    return link_write((link_ctx_t *)link, buf, count);
+    int ret = esp_tls_conn_write(ctx->tls, buf, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        if (ret == ESP_TLS_ERR_SSL_WANT_READ)
+            ctx->metrics.tls_want_read++;
+        else
+            ctx->metrics.tls_want_write++;
+        errno = EAGAIN;
+        return -1;
+    }
+    //mbedTLS error codes do not set errno
+    if (ret <= 0) {
+        errno = ret == 0 ? ECONNRESET : EIO;
+        return -1;
+    }
+    return ret;
 }
 
-int supla_cloud_recv(supla_link_t link, void *buf, int count)
+int arch_tls_read(link_ctx_t *ctx, void *buf, int len)
 {
-    if (!link || !buf || count <= 0)
-        return SUPLA_RESULT_FALSE;
-
-    return link_read((link_ctx_t *)link, buf, count);
+    int ret = esp_tls_conn_read(ctx->tls, buf, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        //waiting for incoming data is normal for reads
+        if (ret == ESP_TLS_ERR_SSL_WANT_WRITE)
+            ctx->metrics.tls_want_write++;
+        errno = EAGAIN;
+        return -1;
+    }
+    //0 is end of stream like for recv(), close notify is reported so too
+    if (ret < 0) {
+        errno = EIO;
+        return -1;
+    }
+    return ret;
 }
 
-int supla_cloud_disconnect(supla_link_t *link)
+int arch_tls_pending(link_ctx_t *ctx)
 {
-    if (!link || !*link)
-        return SUPLA_RESULT_FALSE;
+    return esp_tls_get_bytes_avail(ctx->tls) > 0;
+}
 
-    link_ctx_t *ctx = *link;
-    link_close(ctx);
-    free(ctx);
+int arch_tls_record_overhead(link_ctx_t *ctx)
+{
+    mbedtls_ssl_context *ssl = tls_ssl_context(ctx);
+    int rc = ssl ? mbedtls_ssl_get_record_expansion(ssl) : 0;
+    return rc > 0 ? rc : 0;
+}
 
-    *link = NULL;
-    return SUPLA_RESULT_TRUE;
+void arch_tls_close(link_ctx_t *ctx)
+{
+    tls_destroy(ctx);
+    //socket is closed by esp-tls
+    ctx->sockfd = -1;
 }
+void arch_tls_free_ca(void)
+{
+    if (ca_store_ready) {
+        esp_tls_free_global_ca_store();
+        ca_store_ready = false;
+    }
+}
+#endif
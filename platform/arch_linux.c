@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "port/util.h"
+#include "supla-common/log.h"
+#include "link.h"
+#include "journal.h"
+#include "esp-supla-mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/stat.h>
+
+#ifdef SUPLA_LINK_USE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#ifndef SUPLA_CA_CERT_FILE
+#define SUPLA_CA_CERT_FILE "supla_org_cert.pem"
+#endif
+
+static SSL_CTX *ssl_ctx;
+//last negotiated session, offered on next connect to the same host
+static SSL_SESSION *tls_session;
+static char tls_session_host[LINK_HOST_MAXSIZE];
+#endif
+
+uint64_t supla_time_getmonotonictime_milliseconds(void)
+{
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC, &current_time);
+    return (uint64_t)((current_time.tv_sec * 1000) + (current_time.tv_nsec / 1000000));
+}
+
+uint32_t arch_random(void)
+{
+    static int seeded;
+
+    if (!seeded) {
+        srandom(time(NULL) ^ getpid());
+        seeded = 1;
+    }
+    return random();
+}
+
+int arch_resolve_start(link_ctx_t *ctx)
+{
+    return 0;
+}
+
+/* getaddrinfo() blocks, acceptable for host benchmarks */
+int arch_resolve_poll(link_ctx_t *ctx, struct sockaddr_storage *addr, socklen_t *addrlen)
+{
+    struct addrinfo hints = { 0 }, *result, *rp;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(ctx->host, NULL, &hints, &result) != 0)
+        return -1;
+
+    *addrlen = 0;
+    for (rp = result; rp != NULL; rp = rp->ai_next) {
+        if (rp->ai_family == AF_INET || rp->ai_family == AF_INET6) {
+            memcpy(addr, rp->ai_addr, rp->ai_addrlen);
+            *addrlen = rp->ai_addrlen;
+            break;
+        }
+    }
+    freeaddrinfo(result);
+    return *addrlen ? 1 : -1;
+}
+
+void arch_resolve_cancel(link_ctx_t *ctx)
+{
+}
+
+/* Address is persisted only when SUPLA_DNS_CACHE_FILE env is set */
+int arch_dns_load(link_dns_record_t *rec)
+{
+    const char *path = getenv("SUPLA_DNS_CACHE_FILE");
+    FILE *f;
+    int rc;
+
+    if (!path || !(f = fopen(path, "rb")))
+        return -1;
+
+    rc = fread(rec, sizeof(*rec), 1, f) == 1 ? 0 : -1;
+    fclose(f);
+    return rc;
+}
+
+void arch_dns_store(const link_dns_record_t *rec)
+{
+    const char *path = getenv("SUPLA_DNS_CACHE_FILE");
+    link_dns_record_t stored;
+    FILE *f;
+
+    if (!path || (arch_dns_load(&stored) == 0 && !memcmp(&stored, rec, sizeof(stored))))
+        return;
+
+    f = fopen(path, "wb");
+    if (!f)
+        return;
+    fwrite(rec, sizeof(*rec), 1, f);
+    fclose(f);
+}
+
+/* Journal area is a file emulating NOR flash, SUPLA_JOURNAL_FILE and
+ * SUPLA_JOURNAL_SIZE env select its path and size. SUPLA_JOURNAL_CUT_AFTER=n
+ * simulates power loss: n-th write or erase is done in half and process exits.
+ */
+#define JOURNAL_FILE_SIZE (16 * JOURNAL_SECTOR_SIZE)
+
+static int journal_fd = -1;
+static uint32_t journal_size;
+static long journal_cut_after;
+
+static size_t journal_power_cut(size_t len)
+{
+    if (journal_cut_after > 0 && --journal_cut_after == 0)
+        return len / 2;
+    return len;
+}
+
+int arch_journal_open(uint32_t *size)
+{
+    const char *path = getenv("SUPLA_JOURNAL_FILE");
+    const char *env;
+    uint8_t blank[256];
+    struct stat st;
+
+    if (journal_fd < 0) {
+        env = getenv("SUPLA_JOURNAL_SIZE");
+        journal_size = env ? strtoul(env, NULL, 0) : JOURNAL_FILE_SIZE;
+        env = getenv("SUPLA_JOURNAL_CUT_AFTER");
+        journal_cut_after = env ? atol(env) : 0;
+
+        journal_fd = open(path ? path : "supla_journal.bin", O_RDWR | O_CREAT, 0644);
+        if (journal_fd < 0 || fstat(journal_fd, &st) != 0)
+            return -1;
+
+        //new area is erased
+        memset(blank, 0xFF, sizeof(blank));
+        for (off_t off = st.st_size; off < journal_size; off += sizeof(blank)) {
+            if (pwrite(journal_fd, blank, sizeof(blank), off) != sizeof(blank))
+                return -1;
+        }
+    }
+    *size = journal_size;
+    return 0;
+}
+
+int arch_journal_read(uint32_t offset, void *buf, size_t len)
+{
+    return pread(journal_fd, buf, len, offset) == (ssize_t)len ? 0 : -1;
+}
+
+int arch_journal_write(uint32_t offset, const void *buf, size_t len)
+{
+    const uint8_t *src = buf;
+    size_t todo = journal_power_cut(len);
+    uint8_t cur[64];
+    size_t n;
+
+    //programming only clears bits
+    for (size_t done = 0; done < todo; done += n) {
+        n = todo - done < sizeof(cur) ? todo - done : sizeof(cur);
+        if (pread(journal_fd, cur, n, offset + done) != (ssize_t)n)
+            return -1;
+        for (size_t i = 0; i < n; i++)
+            cur[i] &= src[done + i];
+        if (pwrite(journal_fd, cur, n, offset + done) != (ssize_t)n)
+            return -1;
+    }
+    if (todo != len)
+        _exit(1);
+    return 0;
+}
+
+int arch_journal_erase(uint32_t offset, size_t len)
+{
+    size_t todo = journal_power_cut(len);
+    uint8_t blank[256];
+    size_t n;
+
+    memset(blank, 0xFF, sizeof(blank));
+    for (size_t done = 0; done < todo; done += n) {
+        n = todo - done < sizeof(blank) ? todo - done : sizeof(blank);
+        if (pwrite(journal_fd, blank, n, offset + done) != (ssize_t)n)
+            return -1;
+    }
+    if (todo != len)
+        _exit(1);
+    return 0;
+}
+
+#ifdef SUPLA_LINK_USE_OPENSSL
+static int tls_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    const char *host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+
+    if (!host)
+        return 0;
+    if (tls_session)
+        SSL_SESSION_free(tls_session);
+    //TLS 1.3 tickets arrive after handshake, keep the latest one
+    tls_session = session;
+    snprintf(tls_session_host, sizeof(tls_session_host), "%s", host);
+    return 1;
+}
+
+static SSL_CTX *tls_ctx_get(void)
+{
+    //SUPLA_CA_FILE env allows to test against local server certificate
+    const char *ca_file = getenv("SUPLA_CA_FILE");
+
+    if (ssl_ctx)
+        return ssl_ctx;
+
+    //SSL_write() on closed socket must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (!ssl_ctx)
+        return NULL;
+
+    SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, NULL);
+    //write retried from link transmit buffer instead of caller buffer
+    SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, tls_new_session_cb);
+    if (SSL_CTX_load_verify_locations(ssl_ctx, ca_file ? ca_file : SUPLA_CA_CERT_FILE, NULL) != 1) {
+        supla_log(LOG_ERR, "TLS CA load failed: %s", ca_file ? ca_file : SUPLA_CA_CERT_FILE);
+        SSL_CTX_free(ssl_ctx);
+        ssl_ctx = NULL;
+    }
+    return ssl_ctx;
+}
+
+static int tls_result(link_ctx_t *ctx, int ret, int is_write)
+{
+    if (ret > 0)
+        return ret;
+
+    switch (SSL_get_error(ctx->tls, ret)) {
+    case SSL_ERROR_WANT_READ:
+        //waiting for incoming data is normal for reads
+        if (is_write)
+            ctx->metrics.tls_want_read++;
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_WANT_WRITE:
+        ctx->metrics.tls_want_write++;
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        //peer closed: end of stream for reads, failure for writes
+        if (!is_write)
+            return 0;
+        errno = ECONNRESET;
+        return -1;
+    default:
+        //errno may be left from earlier stall, report failure explicitly
+        errno = EIO;
+        return -1;
+    }
+}
+
+int arch_tls_handshake(link_ctx_t *ctx)
+{
+    SSL *ssl = ctx->tls;
+    int rc;
+
+    if (!ssl) {
+        SSL_CTX *tls_ctx = tls_ctx_get();
+        if (!tls_ctx || !(ssl = SSL_new(tls_ctx)))
+            return -1;
+        //OpenSSL heap use is not visible, connections are only counted
+        supla_mem_account_alloc(SUPLA_MEM_TLS, 0);
+
+        SSL_set_tlsext_host_name(ssl, ctx->host);
+        SSL_set1_host(ssl, ctx->host);
+        SSL_set_fd(ssl, ctx->sockfd);
+        if (tls_session && !strcmp(tls_session_host, ctx->host)) {
+            SSL_set_session(ssl, tls_session);
+            ctx->tls_session = LINK_TLS_SESSION_OFFERED;
+        }
+        ctx->tls = ssl;
+    }
+
+    rc = SSL_connect(ssl);
+    if (rc == 1) {
+        if (SSL_session_reused(ssl))
+            ctx->tls_session = LINK_TLS_SESSION_RESUMED;
+        return 1;
+    }
+
+    switch (SSL_get_error(ssl, rc)) {
+    case SSL_ERROR_WANT_READ:
+        ctx->want_write = 0;
+        return 0;
+    case SSL_ERROR_WANT_WRITE:
+        ctx->want_write = 1;
+        return 0;
+    default:
+        supla_log(LOG_ERR, "TLS handshake failed: %s",
+                  ERR_reason_error_string(ERR_get_error()));
+        return -1;
+    }
+}
+
+int arch_tls_write(link_ctx_t *ctx, const void *buf, int len)
+{
+    return tls_result(ctx, SSL_write(ctx->tls, buf, len), 1);
+}
+
+int arch_tls_read(link_ctx_t *ctx, void *buf, int len)
+{
+    return tls_result(ctx, SSL_read(ctx->tls, buf, len), 0);
+}
+
+int arch_tls_pending(link_ctx_t *ctx)
+{
+    return SSL_pending(ctx->tls) > 0;
+}
+
+int arch_tls_record_overhead(link_ctx_t *ctx)
+{
+    //header + AEAD tag (+ explicit nonce for TLS 1.2, content type for TLS 1.3)
+    return SSL_version(ctx->tls) >= TLS1_3_VERSION ? 5 + 16 + 1 : 5 + 8 + 16;
+}
+
+void arch_tls_close(link_ctx_t *ctx)
+{
+    SSL_shutdown(ctx->tls);
+    SSL_free(ctx->tls);
+    supla_mem_account_free(SUPLA_MEM_TLS, 0);
+    ctx->tls = NULL;
+    if (ctx->sockfd != -1) {
+        close(ctx->sockfd);
+        ctx->sockfd = -1;
+    }
+}
+void arch_tls_free_ca(void)
+{
+    //SSL objects of open links hold their own context reference
+    if (ssl_ctx) {
+        SSL_CTX_free(ssl_ctx);
+        ssl_ctx = NULL;
+    }
+}
+#endif
@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "port/util.h"
+#include "supla-common/log.h"
+#include "esp-supla-journal.h"
+#include "esp-supla-mem.h"
+#include "journal.h"
+#include "../esp-supla/esp-supla-crc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOURNAL_CHUNK 32 //read and copy unit, keeps stack use low
+
+//location of latest record with given id
+typedef struct {
+    uint16_t id;
+    uint16_t len;
+    uint16_t sector;
+    uint16_t offset;
+} journal_entry_t;
+
+/* Sectors are used as a ring. Records are appended to active sector, the
+ * one after it is kept erased as spare. When active sector is full spare
+ * takes its place and the oldest sector is reclaimed: its live records are
+ * copied to new active sector and it is erased to become next spare. */
+static struct {
+    bool ready;
+    uint16_t sectors;
+    uint16_t active;
+    uint32_t seq;    //sequence of active sector
+    uint32_t offset; //write position in active sector
+    journal_entry_t *entries;
+    uint16_t count;
+} jrn;
+
+static supla_journal_stats_t journal_stats;
+
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+static journal_entry_t journal_entries[JOURNAL_MAX_ENTRIES];
+#endif
+
+static uint32_t sector_addr(uint16_t sector)
+{
+    return (uint32_t)sector * JOURNAL_SECTOR_SIZE;
+}
+
+static journal_entry_t *journal_find(uint16_t id)
+{
+    for (int i = 0; i < jrn.count; i++) {
+        if (jrn.entries[i].id == id)
+            return &jrn.entries[i];
+    }
+    return NULL;
+}
+
+static journal_entry_t *journal_entry_add(uint16_t id)
+{
+    journal_entry_t *entry = journal_find(id);
+
+    if (entry)
+        return entry;
+
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+    if (jrn.count == JOURNAL_MAX_ENTRIES) {
+        supla_mem_account_failed(SUPLA_MEM_JOURNAL);
+        return NULL;
+    }
+    jrn.entries = journal_entries;
+#else
+    entry = supla_mem_realloc(SUPLA_MEM_JOURNAL, jrn.entries, (jrn.count + 1) * sizeof(*entry));
+    if (!entry)
+        return NULL;
+    jrn.entries = entry;
+#endif
+    entry = &jrn.entries[jrn.count++];
+    entry->id = id;
+    return entry;
+}
+
+static int journal_sector_seq(uint16_t sector, uint32_t *seq)
+{
+    journal_sector_hdr_t hdr;
+
+    if (arch_journal_read(sector_addr(sector), &hdr, sizeof(hdr)) != 0)
+        return -1;
+    if (hdr.magic != JOURNAL_MAGIC ||
+        hdr.crc != supla_crc32(0, &hdr, offsetof(journal_sector_hdr_t, crc)))
+        return -1;
+    *seq = hdr.seq;
+    return 0;
+}
+
+static int journal_sector_open(uint16_t sector, uint32_t seq)
+{
+    journal_sector_hdr_t hdr = { .magic = JOURNAL_MAGIC, .seq = seq };
+
+    hdr.crc = supla_crc32(0, &hdr, offsetof(journal_sector_hdr_t, crc));
+    if (arch_journal_write(sector_addr(sector), &hdr, sizeof(hdr)) != 0)
+        return -1;
+
+    jrn.active = sector;
+    jrn.seq = seq;
+    jrn.offset = JOURNAL_DATA_START;
+    return 0;
+}
+
+static int journal_sector_erase(uint16_t sector)
+{
+    journal_stats.erases++;
+    return arch_journal_erase(sector_addr(sector), JOURNAL_SECTOR_SIZE);
+}
+
+static bool journal_sector_blank(uint16_t sector)
+{
+    uint8_t buf[JOURNAL_CHUNK];
+
+    for (uint32_t off = 0; off < JOURNAL_SECTOR_SIZE; off += sizeof(buf)) {
+        if (arch_journal_read(sector_addr(sector) + off, buf, sizeof(buf)) != 0)
+            return false;
+        for (size_t i = 0; i < sizeof(buf); i++) {
+            if (buf[i] != 0xFF)
+                return false;
+        }
+    }
+    return true;
+}
+
+static int journal_record_check(const journal_record_hdr_t *hdr, uint32_t data_addr)
+{
+    uint8_t buf[JOURNAL_CHUNK];
+    uint32_t crc = supla_crc32(0, hdr, offsetof(journal_record_hdr_t, crc));
+    size_t n;
+
+    for (size_t done = 0; done < hdr->len; done += n) {
+        n = hdr->len - done < sizeof(buf) ? hdr->len - done : sizeof(buf);
+        if (arch_journal_read(data_addr + done, buf, n) != 0)
+            return -1;
+        crc = supla_crc32(crc, buf, n);
+    }
+    return crc == hdr->crc ? 0 : -1;
+}
+
+/* Index records of a sector. Returns write position after last record or
+ * sector size when the rest of sector can not be used */
+static uint32_t journal_sector_scan(uint16_t sector)
+{
+    journal_record_hdr_t hdr;
+    journal_entry_t *entry;
+    uint32_t offset = JOURNAL_DATA_START;
+    uint32_t addr;
+
+    while (offset + sizeof(hdr) <= JOURNAL_SECTOR_SIZE) {
+        addr = sector_addr(sector) + offset;
+        if (arch_journal_read(addr, &hdr, sizeof(hdr)) != 0)
+            return JOURNAL_SECTOR_SIZE;
+        if (hdr.id == JOURNAL_FREE_ID && hdr.len == 0xFFFF && hdr.crc == 0xFFFFFFFF)
+            return offset;
+
+        if (hdr.id == JOURNAL_FREE_ID ||
+            offset + JOURNAL_RECORD_SIZE(hdr.len) > JOURNAL_SECTOR_SIZE) {
+            //header cut by power loss, record end unknown
+            journal_stats.torn++;
+            return JOURNAL_SECTOR_SIZE;
+        }
+        if (journal_record_check(&hdr, addr + sizeof(hdr)) != 0) {
+            //data cut by power loss, space it takes is skipped
+            journal_stats.torn++;
+            offset += JOURNAL_RECORD_SIZE(hdr.len);
+            continue;
+        }
+
+        entry = journal_entry_add(hdr.id);
+        if (!entry)
+            return JOURNAL_SECTOR_SIZE;
+        entry->len = hdr.len;
+        entry->sector = sector;
+        entry->offset = offset;
+        offset += JOURNAL_RECORD_SIZE(hdr.len);
+    }
+    return offset;
+}
+
+/* Copy record to active sector */
+static int journal_copy(journal_entry_t *entry)
+{
+    uint8_t buf[JOURNAL_CHUNK];
+    uint32_t src = sector_addr(entry->sector) + entry->offset;
+    uint32_t dst = sector_addr(jrn.active) + jrn.offset;
+    size_t size = sizeof(journal_record_hdr_t) + entry->len;
+    size_t n;
+
+    if (jrn.offset + JOURNAL_RECORD_SIZE(entry->len) > JOURNAL_SECTOR_SIZE)
+        return -1;
+
+    for (size_t done = 0; done < size; done += n) {
+        n = size - done < sizeof(buf) ? size - done : sizeof(buf);
+        if (arch_journal_read(src + done, buf, n) != 0 ||
+            arch_journal_write(dst + done, buf, n) != 0) {
+            jrn.offset = JOURNAL_SECTOR_SIZE;
+            return -1;
+        }
+    }
+    entry->sector = jrn.active;
+    entry->offset = jrn.offset;
+    jrn.offset += JOURNAL_RECORD_SIZE(entry->len);
+    journal_stats.relocated++;
+    return 0;
+}
+
+/* Copy live records out of sector and erase it */
+static int journal_reclaim(uint16_t sector)
+{
+    for (int i = jrn.count - 1; i >= 0; i--) {
+        if (jrn.entries[i].sector != sector || journal_copy(&jrn.entries[i]) == 0)
+            continue;
+
+        supla_log(LOG_ERR, "journal: record %d lost, no room to compact", jrn.entries[i].id);
+        journal_stats.lost++;
+        jrn.entries[i] = jrn.entries[--jrn.count];
+    }
+    return journal_sector_erase(sector);
+}
+
+static int journal_advance(void)
+{
+    uint16_t next = (jrn.active + 1) % jrn.sectors;
+
+    if (journal_sector_open(next, jrn.seq + 1) != 0)
+        return -1;
+    return journal_reclaim((next + 1) % jrn.sectors);
+}
+
+static int journal_format(void)
+{
+    jrn.count = 0;
+    for (uint16_t s = 0; s < jrn.sectors; s++) {
+        if (!journal_sector_blank(s) && journal_sector_erase(s) != 0)
+            return -1;
+    }
+    return journal_sector_open(0, 1);
+}
+
+int supla_journal_init(void)
+{
+    uint64_t start = supla_time_getmonotonictime_milliseconds();
+    uint32_t size, seq, last_seq = 0;
+    uint32_t offset = JOURNAL_SECTOR_SIZE;
+    uint16_t spare;
+    int last = -1;
+
+    if (jrn.ready)
+        return 0;
+    if (arch_journal_open(&size) != 0)
+        return -1;
+
+    jrn.sectors = size / JOURNAL_SECTOR_SIZE;
+    if (jrn.sectors < 2) {
+        supla_log(LOG_ERR, "journal: area needs at least 2 sectors");
+        return -1;
+    }
+
+    for (uint16_t s = 0; s < jrn.sectors; s++) {
+        if (journal_sector_seq(s, &seq) == 0 && (last < 0 || seq > last_seq)) {
+            last = s;
+            last_seq = seq;
+        }
+    }
+
+    if (last < 0) {
+        supla_log(LOG_INFO, "journal: formatting %d sectors", jrn.sectors);
+        if (journal_format() != 0)
+            return -1;
+    } else {
+        //sectors are taken into use in ring order, replay from the oldest
+        for (uint16_t i = 1; i <= jrn.sectors; i++) {
+            uint16_t s = (last + i) % jrn.sectors;
+            if (journal_sector_seq(s, &seq) == 0)
+                offset = journal_sector_scan(s);
+        }
+        jrn.active = last;
+        jrn.seq = last_seq;
+        jrn.offset = offset;
+
+        spare = (last + 1) % jrn.sectors;
+        if (journal_sector_seq(spare, &seq) == 0) {
+            //power loss during compaction, finish it
+            journal_reclaim(spare);
+        } else if (!journal_sector_blank(spare)) {
+            journal_sector_erase(spare);
+        }
+    }
+
+    jrn.ready = true;
+    journal_stats.recovery_ms = supla_time_getmonotonictime_milliseconds() - start;
+    supla_log(LOG_INFO, "journal: %d records, %d torn, recovered in %u ms", jrn.count,
+              journal_stats.torn, journal_stats.recovery_ms);
+    return 0;
+}
+
+int supla_journal_store(uint16_t id, const void *data, size_t len)
+{
+    journal_record_hdr_t hdr = { .id = id, .len = len };
+    journal_entry_t *entry;
+    uint32_t size = JOURNAL_RECORD_SIZE(len);
+    uint32_t addr;
+
+    if (!jrn.ready || id == JOURNAL_FREE_ID || size > JOURNAL_SECTOR_SIZE - JOURNAL_DATA_START)
+        return -1;
+
+    if (jrn.offset + size > JOURNAL_SECTOR_SIZE && journal_advance() != 0)
+        return -1;
+    if (jrn.offset + size > JOURNAL_SECTOR_SIZE) {
+        supla_log(LOG_ERR, "journal: live records do not fit in sector");
+        return -1;
+    }
+
+    hdr.crc = supla_crc32(0, &hdr, offsetof(journal_record_hdr_t, crc));
+    hdr.crc = supla_crc32(hdr.crc, data, len);
+    addr = sector_addr(jrn.active) + jrn.offset;
+    if (arch_journal_write(addr, &hdr, sizeof(hdr)) != 0 ||
+        (len && arch_journal_write(addr + sizeof(hdr), data, len) != 0)) {
+        //space may be partially written, never reused
+        jrn.offset += size;
+        return -1;
+    }
+
+    //record on flash without index entry is found by next init
+    entry = journal_entry_add(id);
+    if (!entry)
+        return -1;
+    entry->len = len;
+    entry->sector = jrn.active;
+    entry->offset = jrn.offset;
+    jrn.offset += size;
+
+    journal_stats.appends++;
+    journal_stats.append_bytes += size;
+    return 0;
+}
+
+int supla_journal_restore(uint16_t id, void *data, size_t len)
+{
+    journal_entry_t *entry = jrn.ready ? journal_find(id) : NULL;
+
+    if (!entry || entry->len != len)
+        return -1;
+    return arch_journal_read(sector_addr(entry->sector) + entry->offset +
+                                 sizeof(journal_record_hdr_t),
+                             data, len);
+}
+
+int supla_journal_erase(void)
+{
+    if (!jrn.ready)
+        return -1;
+    return journal_format();
+}
+
+int supla_journal_get_stats(supla_journal_stats_t *stats)
+{
+    *stats = journal_stats;
+    stats->sectors = jrn.sectors;
+    stats->sector_size = JOURNAL_SECTOR_SIZE;
+    stats->records = jrn.count;
+    return 0;
+}
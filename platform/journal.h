@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef SUPLA_JOURNAL_H_
+#define SUPLA_JOURNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp-supla-journal.h"
+
+#ifndef CONFIG_ESP_LIBSUPLA_STATE_JOURNAL_PARTITION
+#define CONFIG_ESP_LIBSUPLA_STATE_JOURNAL_PARTITION "supla_journal"
+#endif
+
+#define JOURNAL_PARTITION CONFIG_ESP_LIBSUPLA_STATE_JOURNAL_PARTITION
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+#define JOURNAL_MAX_ENTRIES CONFIG_ESP_LIBSUPLA_STATIC_CHANNELS //one record id per channel
+#endif
+#define JOURNAL_SECTOR_SIZE 4096 //flash erase unit
+#define JOURNAL_MAGIC 0x4C4E4A53 //"SJNL"
+#define JOURNAL_DATA_START 16    //records follow sector header
+#define JOURNAL_FREE_ID 0xFFFF   //erased flash
+
+//sector header, written after sector erase
+typedef struct {
+    uint32_t magic;
+    uint32_t seq; //increments with every sector taken into use
+    uint32_t crc;
+} journal_sector_hdr_t;
+
+//record header, data follows padded to 4 bytes
+typedef struct {
+    uint16_t id;
+    uint16_t len;
+    uint32_t crc; //covers id, len and data
+} journal_record_hdr_t;
+
+#define JOURNAL_RECORD_SIZE(len) (sizeof(journal_record_hdr_t) + (((len) + 3) & ~3u))
+
+/* Journal storage - implemented by platform/arch_*.c
+ *
+ * Storage behaves like NOR flash: erase sets bytes to 0xFF in
+ * JOURNAL_SECTOR_SIZE units, write may only clear bits. Offsets are relative
+ * to journal area start. Functions return 0 on success, -1 on failure.
+ */
+int arch_journal_open(uint32_t *size);
+int arch_journal_read(uint32_t offset, void *buf, size_t len);
+int arch_journal_write(uint32_t offset, const void *buf, size_t len);
+int arch_journal_erase(uint32_t offset, size_t len);
+
+#endif /* SUPLA_JOURNAL_H_ */
@@ -0,0 +1,1054 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "port/net.h"
+#include "port/util.h"
+#include "supla-common/log.h"
+#include "esp-supla-link.h"
+#include "esp-supla-mem.h"
+#include "link.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+//open links watched by supla_link_wait()
+static link_ctx_t *open_links;
+//guards open_links, taken by every walk over the list
+static pthread_mutex_t links_lock = PTHREAD_MUTEX_INITIALIZER;
+static const uint16_t hist_bounds_ms[] = SUPLA_LINK_HIST_BOUNDS_MS;
+
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+SUPLA_MEM_POOL_DEFINE(link_pool, SUPLA_MEM_LINK, sizeof(link_ctx_t), LINK_POOL_SIZE);
+#define link_ctx_alloc() supla_mem_pool_alloc(&link_pool, sizeof(link_ctx_t))
+#define link_ctx_free(ctx) supla_mem_pool_free(&link_pool, ctx)
+SUPLA_MEM_POOL_DEFINE(backoff_pool, SUPLA_MEM_LINK, sizeof(link_backoff_t), LINK_POOL_SIZE);
+#define link_backoff_alloc() supla_mem_pool_alloc(&backoff_pool, sizeof(link_backoff_t))
+#else
+#define link_ctx_alloc() supla_mem_calloc(SUPLA_MEM_LINK, 1, sizeof(link_ctx_t))
+#define link_ctx_free(ctx) supla_mem_free(SUPLA_MEM_LINK, ctx)
+#define link_backoff_alloc() supla_mem_calloc(SUPLA_MEM_LINK, 1, sizeof(link_backoff_t))
+#endif
+//loopback UDP socket used to wake up supla_link_wait()
+static int wake_fd = -1;
+
+static supla_link_stats_t link_stats;
+
+typedef struct {
+    char host[LINK_HOST_MAXSIZE];
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    uint64_t expires;
+} link_dns_entry_t;
+
+//resolved addresses, valid for LINK_DNS_CACHE_TTL_MS
+static link_dns_entry_t dns_cache[LINK_DNS_CACHE_SLOTS];
+
+//reconnect schedules of link owners, guarded by links_lock
+static link_backoff_t *backoffs;
+
+static void link_hist_add(supla_link_hist_t *hist, uint32_t ms)
+{
+    int i = 0;
+
+    while (i < SUPLA_LINK_HIST_BUCKETS - 1 && ms > hist_bounds_ms[i])
+        i++;
+    hist->bucket[i]++;
+    hist->count++;
+    hist->sum_ms += ms;
+    if (ms > hist->max_ms)
+        hist->max_ms = ms;
+}
+
+void link_set_keepalive(int sockfd)
+{
+    int keepalive = 1;
+    int idle = 60;
+    int interval = 10;
+    int count = 3;
+
+    setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+}
+
+static int link_addr_set_port(struct sockaddr_storage *addr, int port)
+{
+    if (addr->ss_family == AF_INET) {
+        ((struct sockaddr_in *)addr)->sin_port = htons(port);
+        return 0;
+    }
+#if !defined(LWIP_IPV6) || LWIP_IPV6
+    if (addr->ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+static int link_addr_equal(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    if (a->ss_family != b->ss_family)
+        return 0;
+    if (a->ss_family == AF_INET)
+        return !memcmp(&((struct sockaddr_in *)a)->sin_addr, &((struct sockaddr_in *)b)->sin_addr,
+                       sizeof(struct in_addr));
+#if !defined(LWIP_IPV6) || LWIP_IPV6
+    if (a->ss_family == AF_INET6)
+        return !memcmp(&((struct sockaddr_in6 *)a)->sin6_addr,
+                       &((struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+#endif
+    return 0;
+}
+
+/* Get cached address of ctx->host. Returns 1 when entry is still valid, 0
+ * when it is expired or comes from persistent storage and should be used
+ * only until fresh lookup completes, -1 when nothing is known */
+static int link_dns_cache_get(link_ctx_t *ctx)
+{
+    uint64_t now = supla_time_getmonotonictime_milliseconds();
+    link_dns_record_t rec;
+
+    if (!LINK_DNS_CACHE_TTL_MS)
+        return -1;
+
+    for (int i = 0; i < LINK_DNS_CACHE_SLOTS; i++) {
+        link_dns_entry_t *entry = &dns_cache[i];
+        if (entry->addrlen && !strcmp(entry->host, ctx->host)) {
+            ctx->addr = entry->addr;
+            ctx->addrlen = entry->addrlen;
+            return now < entry->expires ? 1 : 0;
+        }
+    }
+
+    if (arch_dns_load(&rec) == 0 && rec.addrlen && !strcmp(rec.host, ctx->host)) {
+        ctx->addr = rec.addr;
+        ctx->addrlen = rec.addrlen;
+        return 0;
+    }
+    return -1;
+}
+
+static void link_dns_cache_put(const char *host, const struct sockaddr_storage *addr,
+                               socklen_t addrlen)
+{
+    link_dns_entry_t *entry = &dns_cache[0];
+
+    if (!LINK_DNS_CACHE_TTL_MS)
+        return;
+
+    //reuse entry of the same host or the oldest one
+    for (int i = 0; i < LINK_DNS_CACHE_SLOTS; i++) {
+        if (!strcmp(dns_cache[i].host, host)) {
+            entry = &dns_cache[i];
+            break;
+        }
+        if (dns_cache[i].expires < entry->expires)
+            entry = &dns_cache[i];
+    }
+
+    snprintf(entry->host, sizeof(entry->host), "%s", host);
+    entry->addr = *addr;
+    entry->addrlen = addrlen;
+    entry->expires = supla_time_getmonotonictime_milliseconds() + LINK_DNS_CACHE_TTL_MS;
+}
+
+static void link_dns_persist(link_ctx_t *ctx)
+{
+    link_dns_record_t rec = { 0 };
+
+    if (!LINK_DNS_CACHE_TTL_MS)
+        return;
+
+    snprintf(rec.host, sizeof(rec.host), "%s", ctx->host);
+    memcpy(&rec.addr, &ctx->addr, ctx->addrlen);
+    rec.addrlen = ctx->addrlen;
+    link_addr_set_port(&rec.addr, 0);
+    arch_dns_store(&rec);
+}
+
+static int link_tcp_connect_start(link_ctx_t *ctx)
+{
+    struct sockaddr *sa = (struct sockaddr *)&ctx->addr;
+
+    if (link_addr_set_port(&ctx->addr, ctx->port) != 0)
+        return -1;
+
+    ctx->sockfd = socket(sa->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (ctx->sockfd == -1)
+        return -1;
+
+    fcntl(ctx->sockfd, F_SETFL, O_NONBLOCK);
+    if (connect(ctx->sockfd, sa, ctx->addrlen) != 0 && errno != EINPROGRESS) {
+        close(ctx->sockfd);
+        ctx->sockfd = -1;
+        return -1;
+    }
+    ctx->want_write = 1;
+    return 0;
+}
+
+static int link_tcp_connect_poll(link_ctx_t *ctx)
+{
+    struct timeval tv = { 0 };
+    socklen_t len = sizeof(int);
+    fd_set wfds;
+    int err = 0;
+
+    FD_ZERO(&wfds);
+    FD_SET(ctx->sockfd, &wfds);
+    if (select(ctx->sockfd + 1, NULL, &wfds, NULL, &tv) <= 0)
+        return 0;
+
+    if (getsockopt(ctx->sockfd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    ctx->want_write = 0;
+    link_set_keepalive(ctx->sockfd);
+    return 1;
+}
+
+/* Attach reconnect schedule of owner to link, called with links_lock
+ * held. Owner that did not reconnect for LINK_BACKOFF_MAX_MS is gone, e.g.
+ * freed device, and its schedule is reused. Pool of static builds has
+ * schedule for each link so an unused one is taken when pool is empty */
+static int link_backoff_attach(link_ctx_t *ctx, const void *owner)
+{
+    uint64_t now = supla_time_getmonotonictime_milliseconds();
+    link_backoff_t *idle = NULL;
+    link_backoff_t *b;
+
+    for (b = backoffs; b; b = b->next) {
+        if (b->owner == owner)
+            break;
+        if (!b->users && (!idle || b->released_at < idle->released_at))
+            idle = b;
+    }
+
+    if (!b && idle && now - idle->released_at > LINK_BACKOFF_MAX_MS)
+        b = idle;
+    if (!b) {
+        b = link_backoff_alloc();
+        if (b) {
+            b->next = backoffs;
+            backoffs = b;
+        } else if (idle) {
+            b = idle;
+        } else {
+            return -1;
+        }
+    }
+
+    if (b->owner != owner) {
+        link_backoff_t *next = b->next;
+        memset(b, 0, sizeof(*b));
+        b->owner = owner;
+        b->next = next;
+    }
+    b->users++;
+    ctx->backoff = b;
+    return 0;
+}
+
+static void link_backoff_detach(link_ctx_t *ctx)
+{
+    pthread_mutex_lock(&links_lock);
+    ctx->backoff->users--;
+    ctx->backoff->released_at = supla_time_getmonotonictime_milliseconds();
+    pthread_mutex_unlock(&links_lock);
+    ctx->backoff = NULL;
+}
+
+/* Schedule next connect of link owner after failure. Delay doubles with
+ * each failure up to LINK_BACKOFF_MAX_MS, random half of it spreads
+ * reconnects of devices that lost server at the same time */
+static void link_backoff_failure(link_ctx_t *ctx)
+{
+    link_backoff_t *b = ctx->backoff;
+    uint32_t delay = LINK_BACKOFF_MAX_MS;
+
+    if (b->failures < 16)
+        b->failures++;
+    if (((uint32_t)LINK_BACKOFF_MIN_MS << (b->failures - 1)) < delay)
+        delay = (uint32_t)LINK_BACKOFF_MIN_MS << (b->failures - 1);
+    delay = delay / 2 + arch_random() % (delay / 2 + 1);
+
+    b->reconnect_at = supla_time_getmonotonictime_milliseconds() + delay;
+    b->connect_failures++;
+    b->last_error = ctx->error;
+    b->delay_ms = delay;
+    link_stats.connect_failures++;
+    link_stats.connect_last_error = ctx->error;
+    link_stats.reconnect_delay_ms = delay;
+    supla_log(LOG_INFO, "cloud reconnect of %s:%d in %u ms (error %d)", ctx->host, ctx->port,
+              delay, ctx->error);
+}
+
+/* Account link that is being closed by caller */
+static void link_backoff_close(link_ctx_t *ctx)
+{
+    switch (ctx->state) {
+    case LINK_STATE_BACKOFF:
+    case LINK_STATE_FAILED:
+        //not started or already accounted
+        return;
+    case LINK_STATE_READY:
+        if (supla_time_getmonotonictime_milliseconds() - ctx->ready_at >= LINK_STABLE_MS) {
+            //transient drop of healthy link, reconnect at once
+            ctx->backoff->failures = 0;
+            ctx->backoff->reconnect_at = 0;
+            ctx->backoff->delay_ms = 0;
+            return;
+        }
+        //closed shortly after connect e.g. registration rejected by server
+        ctx->error = ECONNRESET;
+        break;
+    default:
+        //connect abandoned by caller
+        ctx->error = ECONNABORTED;
+        break;
+    }
+    link_backoff_failure(ctx);
+}
+
+static void link_connected(link_ctx_t *ctx)
+{
+    uint64_t now = supla_time_getmonotonictime_milliseconds();
+
+    ctx->state = LINK_STATE_READY;
+    ctx->ready_at = now;
+    link_stats.connect_ms = now - ctx->connect_start;
+    link_hist_add(&link_stats.connect_hist, link_stats.connect_ms);
+    if (!link_stats.first_ready_ms)
+        link_stats.first_ready_ms = now;
+    link_dns_persist(ctx);
+#ifdef LINK_TLS_SUPPORT
+    if (ctx->is_tls) {
+        link_stats.tls_handshake_ms = now - ctx->connect_start;
+        link_stats.tls_handshake_ms_total += link_stats.tls_handshake_ms;
+        link_stats.tls_handshakes++;
+        if (ctx->tls_session != LINK_TLS_SESSION_NEW)
+            link_stats.tls_resume_offered++;
+        if (ctx->tls_session == LINK_TLS_SESSION_RESUMED)
+            link_stats.tls_resumed++;
+
+        ctx->record_overhead = arch_tls_record_overhead(ctx);
+    }
+#endif
+}
+
+/* Start connect attempt, cached address is tried first and lookup runs in
+ * parallel unless cached one is fresh */
+static int link_connect_begin(link_ctx_t *ctx)
+{
+    int cached;
+
+    ctx->state = LINK_STATE_RESOLVE;
+    ctx->connect_start = supla_time_getmonotonictime_milliseconds();
+    ctx->backoff->attempts++;
+    link_stats.connect_attempts++;
+
+    cached = link_dns_cache_get(ctx);
+    if (cached >= 0)
+        link_stats.dns_cache_hits++;
+    if (cached < 1) {
+        if (arch_resolve_start(ctx) == 0) {
+            ctx->resolving = 1;
+            link_stats.dns_lookups++;
+        } else if (cached < 0) {
+            errno = EHOSTUNREACH;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Advance connect state machine by one stage. Returns 1 when stage is
+ * complete, 0 when waiting for network and -1 on failure */
+static int link_connect_stage(link_ctx_t *ctx)
+{
+    int rc;
+
+    switch (ctx->state) {
+    case LINK_STATE_BACKOFF:
+        if (supla_time_getmonotonictime_milliseconds() < ctx->backoff->reconnect_at)
+            return 0;
+        return link_connect_begin(ctx) == 0 ? 1 : -1;
+    case LINK_STATE_RESOLVE:
+        if (!ctx->addrlen)
+            return ctx->resolving ? 0 : -1;
+#ifdef LINK_TLS_OWN_SOCKET
+        if (ctx->is_tls) {
+            ctx->state = LINK_STATE_HANDSHAKE;
+            return 1;
+        }
+#endif
+        if (link_tcp_connect_start(ctx) != 0)
+            return -1;
+        ctx->state = LINK_STATE_CONNECT;
+        return 1;
+    case LINK_STATE_CONNECT:
+        rc = link_tcp_connect_poll(ctx);
+        if (rc <= 0)
+            return rc;
+        if (ctx->is_tls)
+            ctx->state = LINK_STATE_HANDSHAKE;
+        else
+            link_connected(ctx);
+        return 1;
+#ifdef LINK_TLS_SUPPORT
+    case LINK_STATE_HANDSHAKE:
+        rc = arch_tls_handshake(ctx);
+        if (rc <= 0)
+            return rc;
+        link_connected(ctx);
+        return 1;
+#endif
+    default:
+        return -1;
+    }
+}
+
+/* Close socket and TLS connection but keep link context */
+static void link_reset(link_ctx_t *ctx)
+{
+#ifdef LINK_TLS_SUPPORT
+    if (ctx->is_tls && ctx->tls)
+        arch_tls_close(ctx);
+#endif
+    if (ctx->sockfd != -1) {
+        shutdown(ctx->sockfd, SHUT_RDWR);
+        close(ctx->sockfd);
+    }
+    ctx->sockfd = -1;
+    ctx->want_write = 0;
+    ctx->tls_session = LINK_TLS_SESSION_NEW;
+}
+
+static void link_resolve_step(link_ctx_t *ctx)
+{
+    struct sockaddr_storage addr = { 0 };
+    socklen_t addrlen = 0;
+    int rc = arch_resolve_poll(ctx, &addr, &addrlen);
+
+    if (rc == 0)
+        return;
+
+    //failed lookup leaves cached address in use
+    ctx->resolving = 0;
+    if (rc < 0)
+        return;
+
+    link_dns_cache_put(ctx->host, &addr, addrlen);
+    if (ctx->state >= LINK_STATE_READY ||
+        (ctx->addrlen && link_addr_equal(&ctx->addr, &addr)))
+        return;
+
+    //cached address is stale, restart connect with the fresh one
+    if (ctx->addrlen) {
+        supla_log(LOG_INFO, "cloud address of %s changed", ctx->host);
+        link_stats.dns_fallbacks++;
+        link_reset(ctx);
+    }
+    ctx->addr = addr;
+    ctx->addrlen = addrlen;
+    ctx->state = LINK_STATE_RESOLVE;
+}
+
+static int link_connect_step(link_ctx_t *ctx)
+{
+    static const char *const stage[] = { "backoff", "resolve", "connect", "handshake" };
+    int rc = 1;
+
+    if (ctx->resolving)
+        link_resolve_step(ctx);
+
+    while (rc > 0 && ctx->state < LINK_STATE_READY)
+        rc = link_connect_stage(ctx);
+
+    if (rc < 0 && ctx->resolving && ctx->state > LINK_STATE_RESOLVE &&
+        ctx->state < LINK_STATE_READY) {
+        //cached address does not work, wait for lookup in progress
+        link_stats.dns_fallbacks++;
+        link_reset(ctx);
+        ctx->addrlen = 0;
+        ctx->state = LINK_STATE_RESOLVE;
+        rc = 0;
+    }
+
+    if (rc == 0 && ctx->state != LINK_STATE_BACKOFF &&
+        supla_time_getmonotonictime_milliseconds() - ctx->connect_start >
+            LINK_CONNECT_TIMEOUT_MS) {
+        errno = ETIMEDOUT;
+        rc = -1;
+    }
+
+    if (rc < 0 && ctx->state < LINK_STATE_READY) {
+        ctx->error = errno ? errno : EIO;
+        supla_log(LOG_ERR, "cloud %s failed: %s:%d", stage[ctx->state], ctx->host, ctx->port);
+        ctx->state = LINK_STATE_FAILED;
+        link_backoff_failure(ctx);
+    }
+    return ctx->state;
+}
+
+static int link_write(link_ctx_t *ctx, const void *buf, int len)
+{
+    int rc;
+#ifdef LINK_TLS_SUPPORT
+    if (ctx->is_tls)
+        rc = arch_tls_write(ctx, buf, len);
+    else
+#endif
+        rc = send(ctx->sockfd, buf, len, MSG_NOSIGNAL);
+
+    if (rc > 0) {
+        ctx->tx.writes++;
+        ctx->metrics.tx_bytes += rc;
+        link_stats.tx_writes++;
+        link_stats.tx_bytes += rc;
+    } else if (rc < 0 && errno == EAGAIN) {
+        ctx->metrics.tx_stalls++;
+    } else {
+        ctx->metrics.tx_errors++;
+    }
+    return rc;
+}
+
+static int link_read(link_ctx_t *ctx, void *buf, int len)
+{
+    int rc;
+#ifdef LINK_TLS_SUPPORT
+    if (ctx->is_tls)
+        rc = arch_tls_read(ctx, buf, len);
+    else
+#endif
+        rc = recv(ctx->sockfd, buf, len, MSG_DONTWAIT);
+
+    ctx->metrics.rx_reads++;
+    link_stats.rx_reads++;
+    if (rc > 0) {
+        ctx->metrics.rx_bytes += rc;
+        link_stats.rx_bytes += rc;
+        if (ctx->rtt_start) {
+            link_hist_add(&ctx->metrics.rtt,
+                          supla_time_getmonotonictime_milliseconds() - ctx->rtt_start);
+            ctx->rtt_start = 0;
+        }
+    } else if (rc < 0 && errno != EAGAIN) {
+        ctx->metrics.rx_errors++;
+    }
+    return rc;
+}
+
+/* Serve SRPC reads from receive buffer, refill it with one large read */
+static int link_rx_recv(link_ctx_t *ctx, void *buf, int count)
+{
+#if LINK_RX_BUF_SIZE > 0
+    link_rx_buf_t *rx = &ctx->rx;
+    int rc;
+
+    link_stats.rx_calls++;
+    if (rx->head == rx->tail) {
+        rx->head = 0;
+        rx->tail = 0;
+        //no point to copy data twice
+        if (count >= (int)sizeof(rx->data))
+            return link_read(ctx, buf, count);
+
+        rc = link_read(ctx, rx->data, sizeof(rx->data));
+        if (rc <= 0)
+            return rc;
+        rx->tail = rc;
+    }
+
+    rc = rx->tail - rx->head;
+    rc = rc < count ? rc : count;
+    memcpy(buf, rx->data + rx->head, rc);
+    rx->head += rc;
+    return rc;
+#else
+    //buffer disabled, each SRPC read goes to socket
+    link_stats.rx_calls++;
+    return link_read(ctx, buf, count);
+#endif
+}
+
+static int link_tx_free(link_ctx_t *ctx)
+{
+    link_tx_buf_t *tx = &ctx->tx;
+
+    //move queued data to the front to make room for whole frame
+    if (tx->head && !tx->retry) {
+        memmove(tx->data, tx->data + tx->head, tx->tail - tx->head);
+        tx->tail -= tx->head;
+        tx->head = 0;
+    }
+    return sizeof(tx->data) - tx->tail;
+}
+
+static void link_tx_push(link_ctx_t *ctx, const void *buf, int len)
+{
+    memcpy(ctx->tx.data + ctx->tx.tail, buf, len);
+    ctx->tx.tail += len;
+}
+
+/* write queued data, returns -1 only on link error */
+static int link_tx_flush(link_ctx_t *ctx)
+{
+    link_tx_buf_t *tx = &ctx->tx;
+    int len, rc;
+
+    if (ctx->state != LINK_STATE_READY)
+        return ctx->state == LINK_STATE_FAILED ? -1 : 0;
+
+    while (tx->head < tx->tail) {
+        len = tx->tail - tx->head;
+#ifdef CONFIG_ESP_LIBSUPLA_LINK_COALESCE
+        len = len < LINK_RECORD_SIZE ? len : LINK_RECORD_SIZE;
+#endif
+        if (tx->retry)
+            len = tx->retry;
+        rc = link_write(ctx, tx->data + tx->head, len);
+        if (rc <= 0) {
+            //only stall reported by transport is retried, zero is an error too
+            if (rc == 0 || errno != EAGAIN)
+                return -1;
+            //TLS record is already encrypted, repeat with the same length
+            if (ctx->is_tls)
+                tx->retry = len;
+            return 0;
+        }
+        tx->retry = 0;
+        tx->head += rc;
+    }
+
+    if (tx->frames > tx->writes) {
+        link_stats.tx_records_saved += tx->frames - tx->writes;
+        link_stats.tx_overhead_saved += (tx->frames - tx->writes) * ctx->record_overhead;
+    }
+    tx->frames = 0;
+    tx->writes = 0;
+    tx->head = 0;
+    tx->tail = 0;
+    return 0;
+}
+
+/* Queue whole frame or nothing. Frame bigger than transmit buffer is
+ * accepted partially, SRPC keeps the rest and calls again */
+static int link_tx_send(link_ctx_t *ctx, const void *buf, int count)
+{
+    int chunk = count < LINK_TX_BUF_SIZE ? count : LINK_TX_BUF_SIZE;
+    int sent = 0;
+
+    link_stats.tx_frames++;
+    ctx->metrics.tx_frames++;
+    //responses are matched with the oldest unanswered request
+    if (!ctx->rtt_start && ctx->state == LINK_STATE_READY)
+        ctx->rtt_start = supla_time_getmonotonictime_milliseconds();
+#ifdef CONFIG_ESP_LIBSUPLA_LINK_COALESCE
+    //keep gathering frames until explicit flush
+    if (count <= link_tx_free(ctx)) {
+        ctx->tx.frames++;
+        link_tx_push(ctx, buf, count);
+        return count;
+    }
+#endif
+    if (link_tx_flush(ctx) != 0)
+        return -1;
+
+    ctx->tx.frames++;
+    if (ctx->tx.tail == 0 && ctx->state == LINK_STATE_READY) {
+        sent = link_write(ctx, buf, chunk);
+        if (sent <= 0) {
+            if (sent == 0 || errno != EAGAIN)
+                return -1;
+            if (ctx->is_tls)
+                ctx->tx.retry = chunk;
+            sent = 0;
+        }
+        if (sent == count)
+            return count;
+    }
+
+    if (count - sent <= link_tx_free(ctx)) {
+        link_tx_push(ctx, (const uint8_t *)buf + sent, count - sent);
+        return count;
+    }
+
+    if (ctx->tx.retry && sent == 0) {
+        link_tx_push(ctx, buf, chunk);
+        return chunk;
+    }
+
+    if (sent > 0)
+        return sent;
+
+    errno = EAGAIN;
+    return -1;
+}
+
+static int link_pending(link_ctx_t *ctx)
+{
+    if (ctx->rx.head != ctx->rx.tail)
+        return 1;
+#ifdef LINK_TLS_SUPPORT
+    //already decrypted data is not visible to select()
+    if (ctx->is_tls && ctx->tls)
+        return arch_tls_pending(ctx);
+#endif
+    return 0;
+}
+
+static void link_close(link_ctx_t *ctx)
+{
+    if (ctx->resolving)
+        arch_resolve_cancel(ctx);
+    link_reset(ctx);
+}
+
+static void link_register(link_ctx_t *ctx)
+{
+    pthread_mutex_lock(&links_lock);
+    ctx->next = open_links;
+    open_links = ctx;
+    pthread_mutex_unlock(&links_lock);
+}
+
+static void link_unregister(link_ctx_t *ctx)
+{
+    pthread_mutex_lock(&links_lock);
+    for (link_ctx_t **pp = &open_links; *pp; pp = &(*pp)->next) {
+        if (*pp == ctx) {
+            *pp = ctx->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&links_lock);
+}
+
+static int wake_fd_init(void)
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addrlen = sizeof(addr);
+    int fd;
+
+    if (wake_fd >= 0)
+        return 0;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    //bind to ephemeral loopback port and connect socket to itself
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &addrlen) != 0 ||
+        connect(fd, (struct sockaddr *)&addr, addrlen) != 0) {
+        supla_log(LOG_ERR, "link wakeup socket init failed: %d", errno);
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    wake_fd = fd;
+    return 0;
+}
+
+int supla_link_wakeup(void)
+{
+    const uint8_t ev = 1;
+
+    if (wake_fd < 0)
+        return -1;
+    //full socket queue means wakeup is already pending
+    send(wake_fd, &ev, sizeof(ev), 0);
+    return 0;
+}
+
+int supla_link_tx_pending(void)
+{
+    int pending = 0;
+
+    pthread_mutex_lock(&links_lock);
+    for (link_ctx_t *ctx = open_links; ctx; ctx = ctx->next)
+        pending += ctx->tx.tail - ctx->tx.head;
+    pthread_mutex_unlock(&links_lock);
+    return pending;
+}
+
+int supla_link_flush(void)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&links_lock);
+    for (link_ctx_t *ctx = open_links; ctx; ctx = ctx->next) {
+        if (link_tx_flush(ctx) != 0)
+            rc = -1;
+    }
+    pthread_mutex_unlock(&links_lock);
+    return rc;
+}
+
+int supla_link_get_stats(supla_link_stats_t *stats)
+{
+    if (!stats)
+        return -1;
+
+    *stats = link_stats;
+    return 0;
+}
+
+int supla_link_get_metrics(int index, supla_link_metrics_t *metrics)
+{
+    link_ctx_t *ctx;
+
+    if (!metrics || index < 0)
+        return -1;
+
+    pthread_mutex_lock(&links_lock);
+    for (ctx = open_links; ctx && index; ctx = ctx->next)
+        index--;
+
+    if (ctx) {
+        *metrics = ctx->metrics;
+        snprintf(metrics->host, sizeof(metrics->host), "%s", ctx->host);
+        metrics->port = ctx->port;
+        metrics->tls = ctx->is_tls;
+        metrics->ready = ctx->state == LINK_STATE_READY;
+        metrics->uptime_ms =
+            metrics->ready ? supla_time_getmonotonictime_milliseconds() - ctx->ready_at : 0;
+        metrics->connect_attempts = ctx->backoff->attempts;
+        metrics->connect_failures = ctx->backoff->connect_failures;
+        metrics->connect_last_error = ctx->backoff->last_error;
+        metrics->reconnect_delay_ms = ctx->backoff->delay_ms;
+    }
+    pthread_mutex_unlock(&links_lock);
+    return ctx ? 0 : -1;
+}
+
+int supla_link_reset_backoff(void)
+{
+    pthread_mutex_lock(&links_lock);
+    for (link_backoff_t *b = backoffs; b; b = b->next) {
+        b->failures = 0;
+        b->reconnect_at = 0;
+        b->delay_ms = 0;
+    }
+    pthread_mutex_unlock(&links_lock);
+    link_stats.reconnect_delay_ms = 0;
+    //let link waiting in backoff start connect
+    supla_link_wakeup();
+    return 0;
+}
+
+int supla_link_free_ca_store(void)
+{
+#ifdef LINK_TLS_SUPPORT
+    int busy = 0;
+
+    pthread_mutex_lock(&links_lock);
+    for (link_ctx_t *ctx = open_links; ctx; ctx = ctx->next) {
+        if (ctx->is_tls && ctx->state > LINK_STATE_BACKOFF && ctx->state < LINK_STATE_READY)
+            busy = 1;
+    }
+    pthread_mutex_unlock(&links_lock);
+    if (busy)
+        return -1;
+    arch_tls_free_ca();
+#endif
+    return 0;
+}
+
+int supla_link_wait(uint32_t timeout_ms)
+{
+    struct timeval tv;
+    fd_set rfds, wfds;
+    uint8_t drain[16];
+    int maxfd = -1;
+    int rc = 0;
+
+    wake_fd_init();
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    if (wake_fd >= 0) {
+        FD_SET(wake_fd, &rfds);
+        maxfd = wake_fd;
+    }
+
+    //lock is not held in select(), links may be closed meanwhile
+    pthread_mutex_lock(&links_lock);
+    for (link_ctx_t *ctx = open_links; ctx; ctx = ctx->next) {
+        if (link_connect_step(ctx) == LINK_STATE_FAILED || link_pending(ctx)) {
+            rc = 1;
+            break;
+        }
+        if (ctx->state == LINK_STATE_BACKOFF) {
+            uint64_t now = supla_time_getmonotonictime_milliseconds();
+            uint64_t at = ctx->backoff->reconnect_at;
+            uint64_t left = at > now ? at - now : 0;
+            if (timeout_ms > left)
+                timeout_ms = left;
+            continue;
+        }
+        if (ctx->state != LINK_STATE_READY) {
+            //resolver results are not signalled by any socket
+            if ((ctx->sockfd < 0 || ctx->resolving) && timeout_ms > LINK_CONNECT_POLL_MS)
+                timeout_ms = LINK_CONNECT_POLL_MS;
+            if (ctx->sockfd >= 0) {
+                FD_SET(ctx->sockfd, ctx->want_write ? &wfds : &rfds);
+                maxfd = ctx->sockfd > maxfd ? ctx->sockfd : maxfd;
+            }
+            continue;
+        }
+        if (ctx->sockfd >= 0) {
+            link_tx_flush(ctx);
+            FD_SET(ctx->sockfd, &rfds);
+            if (ctx->tx.tail)
+                FD_SET(ctx->sockfd, &wfds);
+            maxfd = ctx->sockfd > maxfd ? ctx->sockfd : maxfd;
+        }
+    }
+    pthread_mutex_unlock(&links_lock);
+    if (rc)
+        return rc;
+
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    if (maxfd < 0) {
+        //nothing to watch, just sleep
+        select(0, NULL, NULL, NULL, &tv);
+        return 0;
+    }
+
+    rc = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
+    if (rc <= 0)
+        return rc;
+
+    if (wake_fd >= 0 && FD_ISSET(wake_fd, &rfds)) {
+        while (recv(wake_fd, drain, sizeof(drain), MSG_DONTWAIT) > 0) {
+        }
+    }
+
+    pthread_mutex_lock(&links_lock);
+    for (link_ctx_t *ctx = open_links; ctx; ctx = ctx->next) {
+        if (ctx->state != LINK_STATE_READY)
+            link_connect_step(ctx);
+        if (ctx->sockfd >= 0 && FD_ISSET(ctx->sockfd, &wfds))
+            link_tx_flush(ctx);
+    }
+    pthread_mutex_unlock(&links_lock);
+    return rc;
+}
+
+int supla_cloud_connect(supla_link_t *link, const char *host, int port, unsigned char ssl)
+{
+    int rc;
+
+    if (!link || !host)
+        return SUPLA_RESULT_FALSE;
+
+    *link = NULL;
+
+    link_ctx_t *ctx = link_ctx_alloc();
+    if (!ctx)
+        return SUPLA_RESULT_FALSE;
+
+    ctx->sockfd = -1;
+#ifdef LINK_TLS_SUPPORT
+    ctx->is_tls = ssl;
+#endif
+    ctx->port = port;
+    snprintf(ctx->host, sizeof(ctx->host), "%s", host);
+
+    pthread_mutex_lock(&links_lock);
+    rc = link_backoff_attach(ctx, link);
+    pthread_mutex_unlock(&links_lock);
+    if (rc != 0) {
+        link_ctx_free(ctx);
+        return SUPLA_RESULT_FALSE;
+    }
+
+    //connect is completed in small steps by send/recv/supla_link_wait(),
+    //during backoff link only reports EAGAIN
+    if (supla_time_getmonotonictime_milliseconds() < ctx->backoff->reconnect_at) {
+        ctx->state = LINK_STATE_BACKOFF;
+    } else if (link_connect_begin(ctx) != 0) {
+        ctx->error = errno;
+        supla_log(LOG_ERR, "cloud resolve failed: %s", host);
+        link_backoff_failure(ctx);
+        link_backoff_detach(ctx);
+        link_ctx_free(ctx);
+        return SUPLA_RESULT_FALSE;
+    }
+
+    link_register(ctx);
+    link_connect_step(ctx);
+    *link = ctx;
+    return SUPLA_RESULT_TRUE;
+}
+
+int supla_cloud_send(supla_link_t link, void *buf, int count)
+{
+    if (!link || !buf || count <= 0)
+        return SUPLA_RESULT_FALSE;
+
+    link_connect_step(link);
+    return link_tx_send(link, buf, count);
+}
+
+int supla_cloud_recv(supla_link_t link, void *buf, int count)
+{
+    if (!link || !buf || count <= 0)
+        return SUPLA_RESULT_FALSE;
+
+    link_ctx_t *ctx = link;
+    switch (link_connect_step(ctx)) {
+    case LINK_STATE_READY:
+        break;
+    case LINK_STATE_FAILED:
+        return 0; //seen by SRPC as closed connection
+    default:
+        errno = EAGAIN;
+        return -1;
+    }
+
+#ifndef CONFIG_ESP_LIBSUPLA_LINK_COALESCE
+    link_tx_flush(ctx);
+#endif
+    return link_rx_recv(ctx, buf, count);
+}
+
+int supla_cloud_disconnect(supla_link_t *link)
+{
+    if (!link || !*link)
+        return SUPLA_RESULT_FALSE;
+
+    link_ctx_t *ctx = *link;
+    link_unregister(ctx);
+    link_backoff_close(ctx);
+    link_backoff_detach(ctx);
+    link_close(ctx);
+    link_ctx_free(ctx);
+
+    *link = NULL;
+    return SUPLA_RESULT_TRUE;
+}
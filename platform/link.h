@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef SUPLA_LINK_H_
+#define SUPLA_LINK_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "esp-supla-link.h"
+
+#if defined(CONFIG_ESP_LIBSUPLA_USE_ESP_TLS) || defined(SUPLA_LINK_USE_OPENSSL)
+#define LINK_TLS_SUPPORT 1
+#endif
+
+#ifdef CONFIG_ESP_LIBSUPLA_USE_ESP_TLS
+//esp-tls opens and connects socket by itself
+#define LINK_TLS_OWN_SOCKET 1
+#endif
+
+#ifndef CONFIG_ESP_LIBSUPLA_LINK_TX_BUF_SIZE
+#define CONFIG_ESP_LIBSUPLA_LINK_TX_BUF_SIZE 1024
+#endif
+
+#ifndef CONFIG_ESP_LIBSUPLA_LINK_RX_BUF_SIZE
+#define CONFIG_ESP_LIBSUPLA_LINK_RX_BUF_SIZE 1024
+#endif
+
+#ifndef CONFIG_ESP_LIBSUPLA_LINK_RECORD_SIZE
+#define CONFIG_ESP_LIBSUPLA_LINK_RECORD_SIZE 1400
+#endif
+
+#ifndef CONFIG_ESP_LIBSUPLA_LINK_DNS_CACHE_TTL
+#define CONFIG_ESP_LIBSUPLA_LINK_DNS_CACHE_TTL 300
+#endif
+
+#ifndef CONFIG_ESP_LIBSUPLA_LINK_BACKOFF_MIN_MS
+#define CONFIG_ESP_LIBSUPLA_LINK_BACKOFF_MIN_MS 1000
+#endif
+
+#ifndef CONFIG_ESP_LIBSUPLA_LINK_BACKOFF_MAX_S
+#define CONFIG_ESP_LIBSUPLA_LINK_BACKOFF_MAX_S 120
+#endif
+
+#define LINK_HOST_MAXSIZE 65 //SUPLA_SERVER_NAME_MAXSIZE
+#define LINK_CONNECT_TIMEOUT_MS 10000
+#define LINK_CONNECT_POLL_MS 20
+
+#define LINK_TX_BUF_SIZE CONFIG_ESP_LIBSUPLA_LINK_TX_BUF_SIZE
+#define LINK_RX_BUF_SIZE CONFIG_ESP_LIBSUPLA_LINK_RX_BUF_SIZE
+#define LINK_RECORD_SIZE CONFIG_ESP_LIBSUPLA_LINK_RECORD_SIZE
+#define LINK_DNS_CACHE_TTL_MS (CONFIG_ESP_LIBSUPLA_LINK_DNS_CACHE_TTL * 1000ULL)
+#define LINK_DNS_CACHE_SLOTS 2
+#define LINK_BACKOFF_MIN_MS CONFIG_ESP_LIBSUPLA_LINK_BACKOFF_MIN_MS
+#define LINK_BACKOFF_MAX_MS (CONFIG_ESP_LIBSUPLA_LINK_BACKOFF_MAX_S * 1000UL)
+#define LINK_STABLE_MS 30000 //link up longer than this was healthy
+#ifdef CONFIG_ESP_LIBSUPLA_STATIC_ALLOC
+#define LINK_POOL_SIZE CONFIG_ESP_LIBSUPLA_STATIC_DEVICES //one link per device
+#endif
+
+typedef struct {
+    uint16_t head;
+    uint16_t tail;
+    uint16_t retry;  //TLS write to be repeated with the same length
+    uint16_t frames; //frames queued since buffer was empty
+    uint16_t writes; //writes done since buffer was empty
+    uint8_t data[LINK_TX_BUF_SIZE];
+} link_tx_buf_t;
+
+typedef struct {
+    uint16_t head;
+    uint16_t tail;
+#if LINK_RX_BUF_SIZE > 0
+    uint8_t data[LINK_RX_BUF_SIZE];
+#endif
+} link_rx_buf_t;
+
+enum link_state {
+    LINK_STATE_BACKOFF = 0, //waiting for reconnect scheduler
+    LINK_STATE_RESOLVE,
+    LINK_STATE_CONNECT,
+    LINK_STATE_HANDSHAKE,
+    LINK_STATE_READY,
+    LINK_STATE_FAILED,
+};
+
+enum link_tls_session {
+    LINK_TLS_SESSION_NEW = 0,
+    LINK_TLS_SESSION_OFFERED, //stored session offered to server
+    LINK_TLS_SESSION_RESUMED, //server accepted stored session
+};
+
+//last good cloud address, persisted by platform across reboots
+typedef struct {
+    char host[LINK_HOST_MAXSIZE];
+    uint8_t addrlen;
+    struct sockaddr_storage addr; //port is not stored
+} link_dns_record_t;
+
+/* Reconnect schedule of one link owner. libsupla passes the same handle
+ * location to every supla_cloud_connect() of a device so schedule survives
+ * link context that is freed on disconnect */
+typedef struct link_backoff {
+    const void *owner;     //supla_link_t location given to supla_cloud_connect()
+    uint8_t users;         //open links of owner
+    uint8_t failures;      //failures since link was stable
+    uint64_t reconnect_at; //no connect before this time
+    uint64_t released_at;  //last link of owner closed, schedule may be reused later
+    uint32_t attempts;     //connects started
+    uint32_t connect_failures;
+    int32_t last_error;    //errno of last failure
+    uint32_t delay_ms;     //current backoff delay
+    struct link_backoff *next;
+} link_backoff_t;
+
+typedef struct link_ctx {
+    int sockfd;
+    uint8_t is_tls;
+    uint8_t state;      //enum link_state
+    uint8_t want_write; //connect stage waits for writable socket
+    uint8_t resolving;  //lookup in progress, ctx->addr may be cached one
+    int port;
+    char host[LINK_HOST_MAXSIZE];
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    uint64_t connect_start;
+    uint64_t ready_at;
+    int error; //errno of failed connect
+    link_backoff_t *backoff;
+    void *tls;                //platform TLS connection
+    uint16_t record_overhead; //TLS record expansion in bytes
+    uint8_t tls_session;      //enum link_tls_session
+    uint32_t tls_heap_base;   //free heap when TLS connection was created, 0 once accounted
+    uint32_t tls_heap;        //heap held by TLS connection, see SUPLA_MEM_TLS
+    uint64_t rtt_start;       //first request sent since last received data
+    supla_link_metrics_t metrics;
+    link_tx_buf_t tx;
+    link_rx_buf_t rx;
+    struct link_ctx *next;
+} link_ctx_t;
+
+/* Common link layer - platform/link.c */
+void link_set_keepalive(int sockfd);
+
+/* Random number for reconnect jitter - implemented by platform/arch_*.c */
+uint32_t arch_random(void);
+
+/* Name resolution - implemented by platform/arch_*.c
+ *
+ * arch_resolve_start() starts lookup of ctx->host, arch_resolve_poll()
+ * returns 1 with addr filled, 0 while pending or -1 on failure. Lookup may
+ * run while link connects to cached address so ctx->addr is not touched.
+ *
+ * arch_dns_load()/arch_dns_store() keep last good address in persistent
+ * storage, store is expected to skip write when record is unchanged.
+ */
+int arch_resolve_start(link_ctx_t *ctx);
+int arch_resolve_poll(link_ctx_t *ctx, struct sockaddr_storage *addr, socklen_t *addrlen);
+void arch_resolve_cancel(link_ctx_t *ctx);
+int arch_dns_load(link_dns_record_t *rec);
+void arch_dns_store(const link_dns_record_t *rec);
+
+/* TLS transport - implemented by platform/arch_*.c
+ *
+ * arch_tls_handshake() is called until it returns 1 (established) or -1
+ * (failed), 0 means in progress and ctx->want_write selects socket event to
+ * wait for. Socket is connected by link layer unless LINK_TLS_OWN_SOCKET.
+ * Negotiated session is kept and offered on next connect to the same host
+ * when platform supports it, reported in ctx->tls_session.
+ *
+ * CA certificate is parsed on first handshake and kept until arch_tls_free_ca().
+ *
+ * arch_tls_write()/arch_tls_read() return number of bytes transferred or -1
+ * with errno set to EAGAIN when TLS layer wants to read or write. Waits that
+ * stall the transfer are counted in ctx->metrics.tls_want_read/write.
+ */
+int arch_tls_handshake(link_ctx_t *ctx);
+int arch_tls_write(link_ctx_t *ctx, const void *buf, int len);
+int arch_tls_read(link_ctx_t *ctx, void *buf, int len);
+int arch_tls_pending(link_ctx_t *ctx);
+int arch_tls_record_overhead(link_ctx_t *ctx);
+void arch_tls_close(link_ctx_t *ctx);
+void arch_tls_free_ca(void);
+
+#endif /* SUPLA_LINK_H_ */
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2022 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "esp-supla-mem.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+static const char *const mem_tag_names[SUPLA_MEM_TAG_COUNT] = {
+    [SUPLA_MEM_LINK] = "link",         [SUPLA_MEM_TLS] = "tls",
+    [SUPLA_MEM_CH_STATE] = "ch_state", [SUPLA_MEM_CHANNELS] = "channels",
+    [SUPLA_MEM_REGISTRY] = "registry", [SUPLA_MEM_JOURNAL] = "journal",
+};
+
+const char *supla_mem_tag_str(supla_mem_tag_t tag)
+{
+    return (unsigned)tag < SUPLA_MEM_TAG_COUNT ? mem_tag_names[tag] : "unknown";
+}
+
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *supla_mem_pool_alloc(supla_mem_pool_t *pool, size_t size)
+{
+    uint8_t *block = NULL;
+
+    if (size <= pool->block_size) {
+        pthread_mutex_lock(&mem_lock);
+        for (int i = 0; i < pool->count; i++) {
+            if (!pool->used[i]) {
+                pool->used[i] = 1;
+                block = (uint8_t *)pool->blocks + i * pool->block_size;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&mem_lock);
+    }
+
+    if (!block) {
+        supla_mem_account_failed(pool->tag);
+        return NULL;
+    }
+    memset(block, 0, pool->block_size);
+    supla_mem_account_alloc(pool->tag, pool->block_size);
+    return block;
+}
+
+void supla_mem_pool_free(supla_mem_pool_t *pool, void *ptr)
+{
+    size_t i;
+
+    if (!ptr)
+        return;
+    i = ((uint8_t *)ptr - (uint8_t *)pool->blocks) / pool->block_size;
+    pthread_mutex_lock(&mem_lock);
+    pool->used[i] = 0;
+    pthread_mutex_unlock(&mem_lock);
+    supla_mem_account_free(pool->tag, pool->block_size);
+}
+
+#ifdef CONFIG_ESP_LIBSUPLA_MEM_STATS
+
+//keeps block size, aligned like malloc() result
+typedef union {
+    size_t size;
+    max_align_t align;
+} mem_hdr_t;
+
+static supla_mem_stats_t mem_stats[SUPLA_MEM_TAG_COUNT];
+
+static void mem_update(supla_mem_tag_t tag, size_t old_size, size_t new_size, int count)
+{
+    supla_mem_stats_t *s = &mem_stats[tag];
+
+    pthread_mutex_lock(&mem_lock);
+    s->bytes += new_size - old_size;
+    if (s->bytes > s->peak)
+        s->peak = s->bytes;
+    s->count += count;
+    if (count > 0)
+        s->allocs++;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void supla_mem_account_failed(supla_mem_tag_t tag)
+{
+    pthread_mutex_lock(&mem_lock);
+    mem_stats[tag].failed++;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void *supla_mem_calloc(supla_mem_tag_t tag, size_t n, size_t size)
+{
+    mem_hdr_t *hdr;
+
+    if (size && n > (SIZE_MAX - sizeof(*hdr)) / size) {
+        supla_mem_account_failed(tag);
+        return NULL;
+    }
+    hdr = calloc(1, sizeof(*hdr) + n * size);
+    if (!hdr) {
+        supla_mem_account_failed(tag);
+        return NULL;
+    }
+    hdr->size = n * size;
+    mem_update(tag, 0, hdr->size, 1);
+    return hdr + 1;
+}
+
+void *supla_mem_realloc(supla_mem_tag_t tag, void *ptr, size_t size)
+{
+    mem_hdr_t *hdr = ptr ? (mem_hdr_t *)ptr - 1 : NULL;
+    size_t old_size = hdr ? hdr->size : 0;
+
+    if (size > SIZE_MAX - sizeof(*hdr)) {
+        supla_mem_account_failed(tag);
+        return NULL;
+    }
+    hdr = realloc(hdr, sizeof(*hdr) + size);
+    if (!hdr) {
+        supla_mem_account_failed(tag);
+        return NULL;
+    }
+    hdr->size = size;
+    mem_update(tag, old_size, size, ptr ? 0 : 1);
+    return hdr + 1;
+}
+
+void supla_mem_free(supla_mem_tag_t tag, void *ptr)
+{
+    mem_hdr_t *hdr;
+
+    if (!ptr)
+        return;
+    hdr = (mem_hdr_t *)ptr - 1;
+    mem_update(tag, hdr->size, 0, -1);
+    free(hdr);
+}
+
+void supla_mem_account_alloc(supla_mem_tag_t tag, uint32_t bytes)
+{
+    mem_update(tag, 0, bytes, 1);
+}
+
+void supla_mem_account_free(supla_mem_tag_t tag, uint32_t bytes)
+{
+    mem_update(tag, bytes, 0, -1);
+}
+
+int supla_mem_get_stats(supla_mem_tag_t tag, supla_mem_stats_t *stats)
+{
+    if ((unsigned)tag >= SUPLA_MEM_TAG_COUNT || !stats)
+        return -1;
+
+    pthread_mutex_lock(&mem_lock);
+    *stats = mem_stats[tag];
+    pthread_mutex_unlock(&mem_lock);
+    return 0;
+}
+
+#else
+
+int supla_mem_get_stats(supla_mem_tag_t tag, supla_mem_stats_t *stats)
+{
+    if (stats)
+        memset(stats, 0, sizeof(*stats));
+    return -1;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#!/usr/bin/env python
+#
+# Copyright (c) 2022 <qb4.dev@gmail.com>
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+#
+# Convert first certificate of PEM file to DER so it can be embedded in
+# firmware and parsed without base64 decoding.
+
+import base64
+import sys
+
+
+def pem_to_der(pem):
+    lines = []
+    inside = False
+    for line in pem.splitlines():
+        line = line.strip()
+        if line.startswith('-----BEGIN CERTIFICATE'):
+            inside = True
+        elif line.startswith('-----END CERTIFICATE'):
+            return base64.b64decode(''.join(lines))
+        elif inside:
+            lines.append(line)
+    raise ValueError('no certificate found')
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: pem2der.py <in.pem> <out.der>')
+
+    with open(sys.argv[1], 'r') as f:
+        der = pem_to_der(f.read())
+    with open(sys.argv[2], 'wb') as f:
+        f.write(der)
+
+
+if __name__ == '__main__':
+    main()
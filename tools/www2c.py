@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+#
+# Copyright (c) 2022 <qb4.dev@gmail.com>
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+#
+# Convert HTML template to C source. Lines are joined with leading
+# whitespace removed, {{field}} placeholders split the page into static
+# parts. Every part is kept as plain text and as raw deflate data ending
+# with full flush, so the parts can be streamed as one gzip body with
+# dynamic fields inserted between them as stored blocks.
+
+import re
+import sys
+import zlib
+
+
+def c_string(data):
+    out = ''
+    for b in data:
+        c = chr(b)
+        if c in '"\\':
+            out += '\\' + c
+        elif 0x20 <= b < 0x7f and c != '?':
+            out += c
+        else:
+            out += '\\%03o' % b
+    return '"' + out + '"'
+
+
+def c_array(values, fmt, per_line):
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append('    ' + ', '.join(fmt % v for v in values[i:i + per_line]) + ',')
+    return '\n'.join(lines)
+
+
+def convert(html, name):
+    text = ''.join(line.lstrip() for line in html.splitlines())
+    tokens = re.split(r'\{\{(\w+)\}\}', text)
+    parts = [p.encode('utf-8') for p in tokens[0::2]]
+    fields = tokens[1::2]
+
+    deflate = zlib.compressobj(9, zlib.DEFLATED, -15)
+    txt, gz = b'', b''
+    txt_ofs, gz_ofs = [0], [0]
+    for part in parts:
+        txt += part
+        if part:
+            # history is reset so parts do not refer to each other
+            gz += deflate.compress(part) + deflate.flush(zlib.Z_FULL_FLUSH)
+        txt_ofs.append(len(txt))
+        gz_ofs.append(len(gz))
+    if len(txt) > 0xffff:
+        raise ValueError('template too big')
+
+    out = ['/* Generated by tools/www2c.py, do not edit */',
+           '',
+           '#include "esp-supla-www.h"',
+           '',
+           'static const char %s_txt[] =' % name]
+    for i in range(0, len(txt), 96):
+        out.append('    ' + c_string(txt[i:i + 96]))
+    out[-1] += ';'
+    out += ['',
+            'static const uint8_t %s_gz[] = {' % name,
+            c_array(list(gz), '0x%02x', 16),
+            '};',
+            '',
+            'static const uint16_t %s_txt_ofs[] = {' % name,
+            c_array(txt_ofs, '%d', 12),
+            '};',
+            '',
+            'static const uint16_t %s_gz_ofs[] = {' % name,
+            c_array(gz_ofs, '%d', 12),
+            '};',
+            '',
+            'static const char *const %s_fields[] = {' % name,
+            c_array(fields, '"%s"', 8),
+            '};',
+            '',
+            'const supla_www_page_t %s = {' % name,
+            '    .txt = %s_txt,' % name,
+            '    .gz = %s_gz,' % name,
+            '    .txt_ofs = %s_txt_ofs,' % name,
+            '    .gz_ofs = %s_gz_ofs,' % name,
+            '    .fields = %s_fields,' % name,
+            '    .nfields = %d,' % len(fields),
+            '};',
+            '']
+    return '\n'.join(out), len(txt), len(gz)
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit('usage: www2c.py <in.html> <out.c> <symbol>')
+
+    with open(sys.argv[1], 'r', encoding='utf-8') as f:
+        src, txt_len, gz_len = convert(f.read(), sys.argv[3])
+    with open(sys.argv[2], 'w') as f:
+        f.write(src)
+    print('%s: %d bytes, %d gzipped' % (sys.argv[3], txt_len, gz_len))
+
+
+if __name__ == '__main__':
+    main()